@@ -0,0 +1,310 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the AnnealingOptimizer class.
+ *
+ * A step only looks at the 2 districts of the move: the population
+ * bounds and the change in the Efficiency Gap are O(1), so the
+ * continuity check (the only search) is left until the move is
+ * known to be accepted otherwise.
+ */
+
+#include "annealer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+
+#include "contiguity.h"
+#include "error.h"
+#include "gerrymander.h"
+#include "testing/SimpleTest.h"
+#include "testmaps.h"
+
+// How many steps apart the clock is read (and the temperature recomputed)
+const int CLOCK_CHECK_INTERVAL = 256;
+// The step that a precinct that was never moved was "last moved" on (which is never tabu)
+const int64_t NEVER_MOVED = -1;
+
+/*
+ * Creates an optimizer with a seed drawn from "random.h"
+ */
+AnnealingOptimizer::AnnealingOptimizer(const Plan& start, double margin, Party favored)
+    : AnnealingOptimizer(start, margin, favored, freshSeed()) {}
+
+/*
+ * Creates an optimizer from the given plan, which must already assign every precinct, have
+ * every district within the population bounds, and every district continuous (the local
+ * continuity check of a step assumes the district being left is in one piece)
+ */
+AnnealingOptimizer::AnnealingOptimizer(const Plan& start, double margin, Party favored, uint64_t seed)
+    : scorer(start), boundary(start), rng(seed) {
+    const VotingMap& map = start.votingMap();
+    if (start.districtCount() == 0 || start.unassignedCount() > 0) {
+        error("AnnealingOptimizer: the starting plan does not assign every precinct");
+    }
+
+    const int mean = map.totalPop() / start.districtCount();
+    minPop = mean * (1 - margin);
+    maxPop = mean * (1 + margin);
+    for (int district = 0; district < start.districtCount(); district++) {
+        if (!withinBounds(start.districtPop(district))) {
+            error("AnnealingOptimizer: the starting plan is not within the population margin");
+        }
+    }
+    if (!isContinuousPlan(start)) {     // O(V + E)
+        error("AnnealingOptimizer: the starting plan has a district that is not continuous");
+    }
+
+    direction = (favored == REPUBLICANS) ? 1 : -1;
+    accepted = 0;
+    rejected = 0;
+    steps = 0;
+    tabuTenure = 0;
+    lastMoved.assign(map.size(), NEVER_MOVED);
+    bestObjective = objective();
+    atBest = true;
+}
+
+/*
+ * Runs the schedule, cooling geometrically from the start to the end temperature.
+ *
+ * The temperature follows whichever is further along, the steps or the time budget,
+ * so a run that is cut short by its budget still cools all the way down. The best
+ * plan is handed to the callback every checkpointInterval steps (and at the end),
+ * as long as it improved since it was last handed over.
+ */
+int AnnealingOptimizer::run(const AnnealingSchedule& schedule, CheckpointCallback checkpoint) {
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point started = Clock::now();
+
+    // The temperatures are in units of the Efficiency Gap, and the moves are scored in wasted votes
+    const double votes = std::max(scorer.totalVotes(), 1);
+    const double cooling = (schedule.startTemperature > 0 && schedule.endTemperature > 0)
+                               ? schedule.endTemperature / schedule.startTemperature : 0;
+    double temperature = votes * schedule.startTemperature;
+
+    tabuTenure = schedule.tabuTenure;
+    int checkpointed = bestObjective;
+    auto report = [&](int step) {
+        if (checkpoint && bestObjective != checkpointed) {
+            checkpointed = bestObjective;
+            checkpoint(step, best(), bestEfficiencyGap());
+        }
+    };
+
+    int ran = 0;
+    for (; ran < schedule.maxSteps; ran++) {
+        if (ran % CLOCK_CHECK_INTERVAL == 0) {
+            double progress = double(ran) / schedule.maxSteps;
+            if (schedule.timeLimitMs > 0) {
+                const double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - started).count();
+                if (elapsed >= schedule.timeLimitMs) {
+                    break;
+                }
+                progress = std::max(progress, elapsed / schedule.timeLimitMs);
+            }
+            temperature = votes * schedule.startTemperature * std::pow(cooling, progress);
+        }
+
+        step(temperature);
+        if (schedule.checkpointInterval > 0 && (ran + 1) % schedule.checkpointInterval == 0) {
+            report(ran + 1);
+        }
+    }
+
+    report(ran);
+    return ran;
+}
+
+/*
+ * Proposes a Flip of a random border precinct, which is made if both districts stay within
+ * the bounds, the precinct isn't tabu, it passes the Metropolis test, and the district it
+ * leaves stays continuous (checked last, since it is the only search).
+ */
+bool AnnealingOptimizer::step(double temperature) {
+    const Plan& cur = scorer.plan();
+    steps++;
+
+    int precinct;
+    int neighbor;
+    if (!boundary.randomCutEdge(rng, precinct, neighbor)) {     // O(1)
+        rejected++;
+        return false;
+    }
+
+    const int from = cur.districtOf(precinct);
+    const int to = cur.districtOf(neighbor);
+    const int pop = cur.votingMap().popAt(precinct);
+    if (!withinBounds(cur.districtPop(from) - pop) || !withinBounds(cur.districtPop(to) + pop)) {
+        rejected++;
+        return false;
+    }
+
+    const int delta = direction * scorer.deltaWaste(precinct, from, to);     // O(1)
+    const int reached = objective() + delta;
+
+    // A tabu precinct can still be moved if it reaches a new best (the aspiration criterion)
+    const bool tabu = lastMoved[precinct] != NEVER_MOVED && steps - lastMoved[precinct] <= tabuTenure
+                      && reached <= bestObjective;
+    const bool worse = delta < 0 && (temperature <= 0 || !rng.nextChance(std::exp(delta / temperature)));
+    if (tabu || worse || !staysContinuousLocal(cur, precinct)) {     // O(degree) for most precincts
+        rejected++;
+        return false;
+    }
+
+    // Leaving the best plan for a worse one, so it has to be kept
+    if (atBest && reached < bestObjective) {
+        bestPlan = cur;
+        atBest = false;
+    }
+
+    scorer.applyMove(precinct, from, to);       // O(1)
+    boundary.applyMove(precinct, from, to);     // O(degree)
+    lastMoved[precinct] = steps;
+    if (reached > bestObjective) {
+        bestObjective = reached;
+        atBest = true;
+    }
+
+    accepted++;
+    return true;
+}
+
+const Plan& AnnealingOptimizer::best() const {
+    return atBest ? scorer.plan() : bestPlan;
+}
+
+double AnnealingOptimizer::bestEfficiencyGap() const {
+    const int votes = scorer.totalVotes();
+    return votes == 0 ? 0 : double(direction * bestObjective) / votes;
+}
+
+const Plan& AnnealingOptimizer::plan() const {
+    return scorer.plan();
+}
+
+const EfficiencyGapScorer& AnnealingOptimizer::state() const {
+    return scorer;
+}
+
+const BoundaryIndex& AnnealingOptimizer::boundaryIndex() const {
+    return boundary;
+}
+
+uint64_t AnnealingOptimizer::seed() const {
+    return rng.seed();
+}
+
+int AnnealingOptimizer::acceptedCount() const {
+    return accepted;
+}
+
+int AnnealingOptimizer::rejectedCount() const {
+    return rejected;
+}
+
+int AnnealingOptimizer::objective() const {
+    return direction * (scorer.demWaste() - scorer.repWaste());
+}
+
+bool AnnealingOptimizer::withinBounds(int districtPop) const {
+    return districtPop <= maxPop && districtPop >= minPop;
+}
+
+
+/************** TESTS **************/
+
+// 10x10 grid, where every other column votes Democrat (by 3 to 1)
+static void addStripedGrid(Gerrymander& map) {
+    addGridMap(map, 10, 10, [](int id) { return landslide(id % 2 == 0); });
+}
+
+STUDENT_TEST("Annealing skews valid plans towards either party") {
+    Gerrymander map;
+    addStripedGrid(map);
+
+    Rng rng(3);
+    Plan start = map.randomPlan(4, rng);
+    EfficiencyGapScorer initial(start);
+
+    for (Party favored : {REPUBLICANS, DEMOCRATS}) {
+        AnnealingOptimizer optimizer(start, 0.2, favored, 17);
+        AnnealingSchedule schedule;
+        schedule.maxSteps = 20000;
+        schedule.tabuTenure = 10;
+        schedule.checkpointInterval = 500;
+
+        double lastGap = initial.efficiencyGap();
+        bool improving = true;
+        bool allValid = true;
+        int checkpoints = 0;
+        int ran = optimizer.run(schedule, [&](int, const Plan& best, double gap) {
+            checkpoints++;
+            improving = improving && (favored == REPUBLICANS ? gap > lastGap : gap < lastGap);
+            allValid = allValid && map.isValidPlan(best, 0.2);
+            lastGap = gap;
+        });
+
+        EXPECT_EQUAL(ran, 20000);
+        EXPECT_EQUAL(optimizer.acceptedCount() + optimizer.rejectedCount(), 20000);
+        EXPECT(checkpoints > 0);
+        EXPECT(improving);
+        EXPECT(allValid);
+
+        // The best plan is valid, scored correctly, and better than the start
+        const Plan& best = optimizer.best();
+        EfficiencyGapScorer bestScore(best);
+        EXPECT(map.isValidPlan(best, 0.2));
+        EXPECT_EQUAL(bestScore.efficiencyGap(), optimizer.bestEfficiencyGap());
+        EXPECT_EQUAL(lastGap, optimizer.bestEfficiencyGap());
+        if (favored == REPUBLICANS) {
+            EXPECT(optimizer.bestEfficiencyGap() > initial.efficiencyGap());
+            EXPECT(optimizer.bestEfficiencyGap() >= optimizer.state().efficiencyGap());
+        } else {
+            EXPECT(optimizer.bestEfficiencyGap() < initial.efficiencyGap());
+            EXPECT(optimizer.bestEfficiencyGap() <= optimizer.state().efficiencyGap());
+        }
+    }
+}
+
+STUDENT_TEST("Annealing runs are reproducible and bounded in time") {
+    Gerrymander map;
+    addStripedGrid(map);
+
+    Rng rng(8);
+    Plan start = map.randomPlan(5, rng);
+    AnnealingSchedule schedule;
+    schedule.maxSteps = 5000;
+
+    AnnealingOptimizer first(start, 0.2, DEMOCRATS, 23);
+    AnnealingOptimizer second(start, 0.2, DEMOCRATS, 23);
+    first.run(schedule);
+    second.run(schedule);
+    EXPECT(first.best() == second.best());
+    EXPECT(first.plan() == second.plan());
+    EXPECT_EQUAL(first.seed(), 23);
+
+    // The time budget stops a run that would otherwise take far longer
+    AnnealingOptimizer timed(start, 0.2, DEMOCRATS, 23);
+    schedule.maxSteps = INT_MAX;
+    schedule.timeLimitMs = 50;
+    int ran = timed.run(schedule);
+    EXPECT(ran < INT_MAX);
+    EXPECT(map.isValidPlan(timed.best(), 0.2));
+
+    // Only valid plans can be optimized
+    Plan lopsided(map.votingMap(), 2);
+    for (int index = 0; index < 100; index++) {
+        lopsided.assign(index, index < 10 ? 0 : 1);
+    }
+    EXPECT_ERROR(AnnealingOptimizer(lopsided, 0.2, REPUBLICANS));
+
+    // Balanced, but the first district is split between the top and the bottom rows
+    Plan split(map.votingMap(), 2);
+    for (int index = 0; index < 100; index++) {
+        split.assign(index, (index < 30 || index >= 80) ? 0 : 1);
+    }
+    EXPECT_EQUAL(split.districtPop(0), split.districtPop(1));
+    EXPECT_ERROR(AnnealingOptimizer(split, 0.2, REPUBLICANS));
+}
@@ -0,0 +1,126 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the AnnealingOptimizer class, which skews a
+ * valid plan towards a party by simulated annealing, instead of
+ * growing gerrymandered districts and retrying until one is valid.
+ *
+ * Every step proposes a Flip (a precinct on the border of 2 districts
+ * moves into the other district) that keeps the plan valid, and scores
+ * it with the incremental Efficiency Gap of the EfficiencyGapScorer:
+ *
+ * Better => the move is always made
+ * Worse => the move is made with probability e^(delta / temperature),
+ *          where the temperature falls geometrically over the schedule
+ *
+ * Precincts that were just moved can be made tabu for a few steps, so that
+ * the chain doesn't keep flipping the same precincts back and forth.
+ *
+ * The run stops when the schedule or the time budget runs out, whichever is
+ * first, and the best plan seen so far is always kept (and can be handed to
+ * a callback as the run goes, to checkpoint it).
+ */
+
+#pragma once
+
+#ifndef ANNEALER_H
+#define ANNEALER_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "boundary.h"
+#include "plan.h"
+#include "rng.h"
+#include "scorer.h"
+
+// How an AnnealingOptimizer runs
+struct AnnealingSchedule {
+    /* The temperature of the first and the last step, in units of the Efficiency Gap (a move
+     * that lowers the gap of the favored party by the temperature is made with probability 1/e)
+     */
+    double startTemperature = 0.01;
+    double endTemperature = 0.00001;
+    // The most proposals to make
+    int maxSteps = 100000;
+    // The wall-clock budget in milliseconds (0 => no limit), which the cooling is sped up to fit in
+    int timeLimitMs = 0;
+    // How many steps a moved precinct can't be moved again (0 => no tabu), unless it would reach a new best
+    int tabuTenure = 0;
+    // How many steps apart the best plan is checkpointed (if it improved since the last checkpoint)
+    int checkpointInterval = 1000;
+};
+
+class AnnealingOptimizer
+{
+public:
+    // Called with the step number, and the best plan so far and its signed Efficiency Gap
+    typedef std::function<void(int step, const Plan& best, double efficiencyGap)> CheckpointCallback;
+
+    /* Creates an optimizer starting from a valid plan, whose districts must stay within margin of
+     * the mean population, and whose proposals are drawn from a generator with the given seed
+     */
+    AnnealingOptimizer(const Plan& start, double margin, Party favored);
+    AnnealingOptimizer(const Plan& start, double margin, Party favored, uint64_t seed);
+
+    /* Runs the schedule (or until the time budget runs out), checkpointing the best plan as it
+     * improves, and returns how many steps were run
+     */
+    int run(const AnnealingSchedule& schedule, CheckpointCallback checkpoint = nullptr);
+
+    // Runs a single proposal at the given temperature, and returns whether it was accepted
+    bool step(double temperature);
+
+    // Returns the best plan seen so far, and its signed Efficiency Gap
+    const Plan& best() const;
+    double bestEfficiencyGap() const;
+    // Returns the current plan and its score
+    const Plan& plan() const;
+    const EfficiencyGapScorer& state() const;
+    // Returns the borders of the current plan (and how many there are, a measure of compactness)
+    const BoundaryIndex& boundaryIndex() const;
+    // Returns the seed of the optimizer (the same seed, start and schedule always produce the same plans)
+    uint64_t seed() const;
+    // Returns the number of proposals accepted/rejected so far
+    int acceptedCount() const;
+    int rejectedCount() const;
+
+private:
+    // The current plan, which keeps the Efficiency Gap up to date
+    EfficiencyGapScorer scorer;
+    // The borders between the districts of the current plan, which the proposals are drawn from
+    BoundaryIndex boundary;
+    // Draws every random choice of the optimizer
+    Rng rng;
+    // +1 if the Republicans are favored (who want more Democratic votes wasted), -1 otherwise
+    int direction;
+    // The population bounds of every district
+    double minPop;
+    double maxPop;
+    int accepted;
+    int rejected;
+
+    /* How many steps have been proposed (over every run, so 64 bits, since a run can be
+     * bounded by time alone), and how many steps a moved precinct stays tabu
+     */
+    int64_t steps;
+    int tabuTenure;
+    // precinct => the step it was last moved on
+    std::vector<int64_t> lastMoved;
+
+    /* The best plan is only copied when the chain is about to leave it (atBest => the
+     * current plan is the best one, and bestPlan is out of date), so that a long run
+     * of improving moves doesn't copy the plan every step
+     */
+    Plan bestPlan;
+    // direction * (demWaste - repWaste) of the best plan
+    int bestObjective;
+    bool atBest;
+
+    // Returns direction * (demWaste - repWaste) of the current plan
+    int objective() const;
+    // Returns whether a district population is within the bounds
+    bool withinBounds(int districtPop) const;
+};
+
+#endif // ANNEALER_H
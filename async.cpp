@@ -0,0 +1,153 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the AsyncGerrymander class.
+ *
+ * The jobs only read the map, so its compact layout is built before any job is
+ * submitted (like the parallel generators of the Gerrymander class).
+ */
+
+#include "async.h"
+
+#include "testing/SimpleTest.h"
+#include "testmaps.h"
+
+AsyncGerrymander::AsyncGerrymander(const Gerrymander& map, int workers) : map(map), pool(workers) {}
+
+AsyncGerrymander::~AsyncGerrymander() {
+    // The jobs stop at their next check (queued jobs stop before their first attempt)
+    shutdown.cancel();
+}
+
+template <typename Generate>
+JobHandle<GenerationResult> AsyncGerrymander::submit(const JobControl& control, Generate generate) {
+    map.votingMap().freeze();
+
+    JobControl linked = control;
+    linked.token = control.token.linkedWith(shutdown);
+    return JobHandle<GenerationResult>(pool.submit([linked, generate]() {
+        return generate(linked);
+    }), linked.token);
+}
+
+JobHandle<GenerationResult> AsyncGerrymander::gerrymander(int totalDistricts, bool favorRep, const JobControl& control, uint64_t seed) {
+    const Gerrymander& map = this->map;
+    return submit(control, [&map, totalDistricts, favorRep, seed](const JobControl& control) {
+        Rng rng(seed);
+        return map.gerrymanderPlan(totalDistricts, favorRep, control, rng);
+    });
+}
+
+JobHandle<GenerationResult> AsyncGerrymander::naiveGerrymander(int totalDistricts, int margin, const JobControl& control, uint64_t seed) {
+    const Gerrymander& map = this->map;
+    return submit(control, [&map, totalDistricts, margin, seed](const JobControl& control) {
+        Rng rng(seed);
+        return map.naiveGerrymanderPlan(totalDistricts, margin, control, rng);
+    });
+}
+
+JobHandle<GenerationResult> AsyncGerrymander::randomPlan(int totalDistricts, const JobControl& control, uint64_t seed) {
+    const Gerrymander& map = this->map;
+    return submit(control, [&map, totalDistricts, seed](const JobControl& control) {
+        Rng rng(seed);
+        return map.randomPlan(totalDistricts, control, rng);
+    });
+}
+
+JobHandle<GenerationResult> AsyncGerrymander::gerrymander(int totalDistricts, bool favorRep, const JobControl& control) {
+    return gerrymander(totalDistricts, favorRep, control, freshSeed());
+}
+
+JobHandle<GenerationResult> AsyncGerrymander::naiveGerrymander(int totalDistricts, int margin, const JobControl& control) {
+    return naiveGerrymander(totalDistricts, margin, control, freshSeed());
+}
+
+JobHandle<GenerationResult> AsyncGerrymander::randomPlan(int totalDistricts, const JobControl& control) {
+    return randomPlan(totalDistricts, control, freshSeed());
+}
+
+JobHandle<int> AsyncGerrymander::score(const Plan& plan) {
+    map.votingMap().freeze();
+
+    const Gerrymander& map = this->map;
+    CancellationToken token = shutdown.linkedWith(CancellationToken());
+    return JobHandle<int>(pool.submit([&map, plan, token]() {
+        // Scoring is O(districts), so it is only skipped if it was cancelled before it started
+        return token.isCancelled() ? -1 : map.howGerrymandered(plan);
+    }), token);
+}
+
+int AsyncGerrymander::pendingCount() const {
+    return pool.pendingCount();
+}
+
+
+/************** TESTS **************/
+
+// 10x10 grid, where every other column votes Democrat (by 3 to 1)
+static void addStripedGrid(Gerrymander& map) {
+    addGridMap(map, 10, 10, [](int id) { return landslide(id % 2 == 0); });
+}
+
+STUDENT_TEST("Generating and scoring plans asynchronously") {
+    Gerrymander map;
+    addStripedGrid(map);
+
+    AsyncGerrymander jobs(map, 2);
+
+    // The same seed gives the same plan as the blocking generator
+    JobHandle<GenerationResult> random = jobs.randomPlan(4, JobControl(), 3);
+    JobHandle<GenerationResult> gerrymandered = jobs.gerrymander(4, true, JobControl(), 4);
+    EXPECT_EQUAL(random.get().status, VALID_PLAN);
+    Rng rng(3);
+    EXPECT(random.get().plan == map.randomPlan(4, rng));
+    EXPECT_EQUAL(gerrymandered.get().status, VALID_PLAN);
+    EXPECT(map.isValidPlan(gerrymandered.get().plan, 0.2));
+
+    JobHandle<int> score = jobs.score(random.get().plan);
+    EXPECT_EQUAL(score.get(), map.howGerrymandered(random.get().plan));
+}
+
+STUDENT_TEST("Stopping asynchronous jobs") {
+    Gerrymander map;
+    addStripedGrid(map);
+
+    AsyncGerrymander jobs(map, 2);
+
+    // No plan is ever above an Efficiency Gap of 100, so only a cancellation stops the job
+    std::atomic<int> reports(0);
+    std::atomic<int> lastAttempts(0);
+    JobControl control;
+    control.progressInterval = 10;
+    control.progress = [&](const JobProgress& progress) {
+        reports++;
+        lastAttempts = progress.attempts;
+    };
+    JobHandle<GenerationResult> endless = jobs.naiveGerrymander(4, 100, control, 5);
+    EXPECT(!endless.waitFor(50));
+    endless.cancel();
+
+    const GenerationResult& stopped = endless.get();
+    EXPECT_EQUAL(stopped.status, CANCELLED);
+    EXPECT(stopped.iterations > 0);
+    EXPECT(reports > 0);
+    EXPECT_EQUAL(lastAttempts.load(), stopped.iterations);
+    // The most gerrymandered valid plan is kept
+    EXPECT(map.isValidPlan(stopped.plan, 0.2));
+
+    // Cancelling a handle doesn't stop the other jobs of the same control
+    JobControl timed;
+    timed.setTimeLimit(30);
+    JobHandle<GenerationResult> first = jobs.naiveGerrymander(4, 100, timed, 6);
+    JobHandle<GenerationResult> second = jobs.naiveGerrymander(4, 100, timed, 7);
+    first.cancel();
+    EXPECT_EQUAL(first.get().status, CANCELLED);
+    EXPECT_EQUAL(second.get().status, DEADLINE_EXCEEDED);
+
+    // Cancelling the token of the control stops every job holding it
+    JobControl shared;
+    JobHandle<GenerationResult> third = jobs.naiveGerrymander(4, 100, shared, 8);
+    JobHandle<GenerationResult> fourth = jobs.naiveGerrymander(4, 100, shared, 9);
+    shared.token.cancel();
+    EXPECT_EQUAL(third.get().status, CANCELLED);
+    EXPECT_EQUAL(fourth.get().status, CANCELLED);
+}
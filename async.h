@@ -0,0 +1,67 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the AsyncGerrymander class, an asynchronous
+ * front-end of a Gerrymander, whose generation and scoring jobs run on
+ * its own pool of threads instead of blocking the caller.
+ *
+ * Every job returns a JobHandle right away, which can be waited on or
+ * cancelled. The generators check for cancellation and their deadline
+ * before every attempt, so a job that can't find a plan still finishes
+ * (with the status CANCELLED or DEADLINE_EXCEEDED), and report their
+ * progress (attempts, and the best score so far) to a callback.
+ */
+
+#pragma once
+
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <cstdint>
+
+#include "gerrymander.h"
+#include "jobs.h"
+
+class AsyncGerrymander
+{
+public:
+    /* Creates a front-end over the map, with the given number of threads (0 => one per core).
+     * The map must outlive the front-end, and can't be changed while it has jobs.
+     */
+    explicit AsyncGerrymander(const Gerrymander& map, int workers = 0);
+    // Cancels every job that hasn't finished, and waits for the threads
+    ~AsyncGerrymander();
+
+    AsyncGerrymander(const AsyncGerrymander&) = delete;
+    AsyncGerrymander& operator=(const AsyncGerrymander&) = delete;
+
+    /* Submits the generators of the same name of the Gerrymander, drawing from an Rng with the given
+     * seed. The job stops when the token of the control is cancelled (and so does its handle),
+     * or at the deadline of the control.
+     */
+    JobHandle<GenerationResult> gerrymander(int totalDistricts, bool favorRep, const JobControl& control, uint64_t seed);
+    JobHandle<GenerationResult> naiveGerrymander(int totalDistricts, int margin, const JobControl& control, uint64_t seed);
+    JobHandle<GenerationResult> randomPlan(int totalDistricts, const JobControl& control, uint64_t seed);
+    // The same, from a fresh seed (which is kept in the plan)
+    JobHandle<GenerationResult> gerrymander(int totalDistricts, bool favorRep, const JobControl& control = JobControl());
+    JobHandle<GenerationResult> naiveGerrymander(int totalDistricts, int margin, const JobControl& control = JobControl());
+    JobHandle<GenerationResult> randomPlan(int totalDistricts, const JobControl& control = JobControl());
+
+    // Submits "Gerrymander::howGerrymandered(Plan)" on a copy of the plan (-1 if it is cancelled before it starts)
+    JobHandle<int> score(const Plan& plan);
+
+    // Returns how many jobs are waiting for a thread
+    int pendingCount() const;
+
+private:
+    const Gerrymander& map;
+    // Cancelled when the front-end is destroyed, and linked with the token of every job
+    CancellationToken shutdown;
+    // Declared last, so that its threads are joined before anything they use is destroyed
+    JobPool pool;
+
+    // Submits generate(control), where the control holds a token linked with the shutdown
+    template <typename Generate>
+    JobHandle<GenerationResult> submit(const JobControl& control, Generate generate);
+};
+
+#endif // ASYNC_H
@@ -0,0 +1,464 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the benchmark suite.
+ *
+ * The maps are generated as text once (in the loader's format), so the
+ * load time is measured the same way a real map is loaded. Every run
+ * that has to start from a clean state (e.g. validation, which would
+ * otherwise hit the plan cache) is prepared outside of its timing.
+ */
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "error.h"
+#include "gerrymander.h"
+#include "rng.h"
+#include "testing/SimpleTest.h"
+
+// The names of the maps in the results
+static std::string mapName(SyntheticMap kind) {
+    return kind == GRID_MAP ? "grid" : "planar";
+}
+
+/*
+ * Lays the precincts out row by row on a grid as close to square as possible (the
+ * last row may be short). Every precinct borders the ones beside it, and on a planar
+ * map, one of the diagonals of every full square.
+ */
+void writeSyntheticMap(SyntheticMap kind, int precincts, uint64_t seed, std::ostream& demographics, std::ostream& adjacency) {
+    Rng rng(seed);
+    const int width = std::max(1, int(std::ceil(std::sqrt(double(precincts)))));
+
+    demographics << "id,dem,rep,pop\n";
+    adjacency << "id,neighbor\n";
+    auto border = [&](int a, int b) {
+        adjacency << a << ',' << b << '\n' << b << ',' << a << '\n';
+    };
+
+    for (int id = 0; id < precincts; id++) {
+        const int column = id % width;
+
+        // Half of the population votes, and the Democratic share rises from 30% to 70% going east (give or take 10%)
+        const int pop = rng.nextInt(100, 1000);
+        const int votes = pop / 2;
+        const double share = 0.3 + 0.4 * column / width + (rng.nextInt(-100, 100) / 1000.0);
+        const int dem = std::min(votes, std::max(0, int(votes * share)));
+        demographics << id << ',' << dem << ',' << votes - dem << ',' << pop << '\n';
+
+        const bool east = column + 1 < width && id + 1 < precincts;
+        const bool south = id + width < precincts;
+        if (east) {
+            border(id, id + 1);
+        }
+        if (south) {
+            border(id, id + width);
+        }
+        if (kind == PLANAR_MAP && east && id + width + 1 < precincts) {
+            if (rng.nextBool()) {
+                border(id, id + width + 1);
+            } else {
+                border(id + 1, id + width);
+            }
+        }
+    }
+}
+
+/*
+ * Reads a whole number of at least minimum for a flag, or throws an error
+ */
+static int parseCount(const std::string& flag, const std::string& text, int minimum) {
+    const char* start = text.c_str();
+    char* end = nullptr;
+    const long value = std::strtol(start, &end, 10);
+    if (end == start || *end != '\0' || value < minimum || value > INT_MAX) {
+        error("benchmark: " + flag + " expects a whole number of at least " + std::to_string(minimum) + ", not \"" + text + "\"");
+    }
+    return int(value);
+}
+
+// Splits a comma separated list (empty items are left out)
+static std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::istringstream input(text);
+    std::string item;
+    while (std::getline(input, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+BenchmarkOptions parseBenchmarkOptions(const std::vector<std::string>& args) {
+    BenchmarkOptions options;
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string& flag = args[i];
+        if (flag != "--sizes" && flag != "--maps" && flag != "--samples" && flag != "--budget") {
+            error("benchmark: unknown flag \"" + flag + "\" (expected --sizes, --maps, --samples or --budget)");
+        }
+        if (i + 1 == args.size()) {
+            error("benchmark: " + flag + " is missing its value");
+        }
+        const std::string& value = args[++i];
+
+        if (flag == "--sizes" || flag == "--maps") {
+            std::vector<std::string> items = splitList(value);
+            if (items.empty()) {
+                error("benchmark: " + flag + " expects a comma separated list");
+            }
+            if (flag == "--sizes") {
+                options.sizes.clear();
+                for (const std::string& item : items) {
+                    options.sizes.push_back(parseCount(flag, item, 1));
+                }
+            } else {
+                options.maps.clear();
+                for (const std::string& item : items) {
+                    if (item != mapName(GRID_MAP) && item != mapName(PLANAR_MAP)) {
+                        error("benchmark: unknown map \"" + item + "\" (expected grid or planar)");
+                    }
+                    options.maps.push_back(item == mapName(GRID_MAP) ? GRID_MAP : PLANAR_MAP);
+                }
+            }
+        } else if (flag == "--samples") {
+            options.samples = parseCount(flag, value, 1);
+        } else {
+            options.timeBudgetMs = parseCount(flag, value, 0);
+        }
+    }
+    return options;
+}
+
+/*
+ * Returns the latency that the given share of the runs took at most (nearest rank)
+ */
+static double percentile(const std::vector<double>& sorted, double share) {
+    int rank = int(std::ceil(share * sorted.size())) - 1;
+    return sorted[std::max(0, std::min(rank, int(sorted.size()) - 1))];
+}
+
+/*
+ * Makes runs of an operation (each after prepare(), which isn't timed) until there are
+ * enough samples, or the time budget is spent, and writes the result to out
+ */
+template <typename Prepare, typename Operation>
+static BenchmarkResult measure(const std::string& map, int precincts, const std::string& operation,
+                               const BenchmarkOptions& options, std::ostream& out, Prepare prepare, Operation run) {
+    typedef std::chrono::steady_clock Clock;
+    std::vector<double> latencies;
+    int successes = 0;
+    double spent = 0;
+
+    while (latencies.empty() || (int(latencies.size()) < options.samples && spent < options.timeBudgetMs)) {
+        prepare();
+        const Clock::time_point start = Clock::now();
+        const bool success = run();
+        const double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        latencies.push_back(elapsed);
+        spent += elapsed;
+        successes += success;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    BenchmarkResult result;
+    result.map = map;
+    result.precincts = precincts;
+    result.operation = operation;
+    result.samples = latencies.size();
+    result.throughput = spent > 0 ? latencies.size() * 1000.0 / spent : 0;
+    result.p50Ms = percentile(latencies, 0.5);
+    result.p99Ms = percentile(latencies, 0.99);
+    result.successRate = double(successes) / latencies.size();
+    result.peakRssKb = peakResidentKb();
+
+    out << toJson(result) << std::endl;
+    return result;
+}
+
+/*
+ * Writes the result of an operation that wasn't run to out
+ */
+static BenchmarkResult skippedResult(const std::string& map, int precincts, const std::string& operation,
+                                     const std::string& reason, std::ostream& out) {
+    BenchmarkResult result;
+    result.map = map;
+    result.precincts = precincts;
+    result.operation = operation;
+    result.samples = 0;
+    result.throughput = 0;
+    result.p50Ms = 0;
+    result.p99Ms = 0;
+    result.successRate = 0;
+    result.peakRssKb = peakResidentKb();
+    result.skipped = reason;
+
+    out << toJson(result) << std::endl;
+    return result;
+}
+
+/*
+ * For every map: loads it, runs each of the bounded generators, then validates and scores
+ * the last valid partitioned plan (so that validation goes all the way through the continuity
+ * check). The checks are skipped if no partitioned plan was valid, and every operation is
+ * skipped on the maps at least as large as one where its median run took the whole time budget.
+ */
+std::vector<BenchmarkResult> runBenchmarks(const BenchmarkOptions& options, std::ostream& out) {
+    std::vector<BenchmarkResult> results;
+    auto nothing = []() {};
+
+    for (SyntheticMap kind : options.maps) {
+        // operation => the fewest precincts it took the whole time budget on
+        std::map<std::string, int> overBudget;
+
+        for (int precincts : options.sizes) {
+            const std::string name = mapName(kind);
+
+            // Measures an operation (unless it has to be skipped), and returns whether it was run
+            auto record = [&](const std::string& operation, std::string reason, auto prepare, auto run) {
+                auto over = overBudget.find(operation);
+                if (reason.empty() && over != overBudget.end() && precincts >= over->second) {
+                    reason = "over the time budget on " + std::to_string(over->second) + " precincts";
+                }
+                if (!reason.empty()) {
+                    results.push_back(skippedResult(name, precincts, operation, reason, out));
+                    return false;
+                }
+
+                results.push_back(measure(name, precincts, operation, options, out, prepare, run));
+                if (results.back().p50Ms >= options.timeBudgetMs && (over == overBudget.end() || precincts < over->second)) {
+                    overBudget[operation] = precincts;
+                }
+                return true;
+            };
+
+            std::ostringstream demographics;
+            std::ostringstream adjacency;
+            writeSyntheticMap(kind, precincts, options.seed, demographics, adjacency);
+            const std::string demographicsText = demographics.str();
+            const std::string adjacencyText = adjacency.str();
+
+            // Load time, into a new map every time
+            std::unique_ptr<Gerrymander> map;
+            std::istringstream demographicsInput;
+            std::istringstream adjacencyInput;
+            const bool loaded = record("load", "", [&]() {
+                map.reset(new Gerrymander());
+                demographicsInput.str(demographicsText);
+                demographicsInput.clear();
+                adjacencyInput.str(adjacencyText);
+                adjacencyInput.clear();
+            }, [&]() {
+                map->loadFromStreams(demographicsInput, adjacencyInput);
+                return map->votingMap().size() == precincts;
+            });
+            const std::string notLoaded = loaded ? "" : "the map wasn't loaded";
+
+            // The generators, each drawing from its own generator
+            const int districts = std::min(options.totalDistricts, precincts);
+            Rng randomRng(streamSeed(options.seed, 0));
+            record("randomPlan", notLoaded, nothing, [&]() {
+                return map->repairedRandomPlan(districts, options.margin, options.maxIterations, randomRng).status == VALID_PLAN;
+            });
+
+            Rng gerrymanderRng(streamSeed(options.seed, 1));
+            record("gerrymander", notLoaded, nothing, [&]() {
+                return map->repairedGerrymander(districts, true, options.margin, options.maxIterations, gerrymanderRng).status == VALID_PLAN;
+            });
+
+            Rng partitionRng(streamSeed(options.seed, 2));
+            Plan plan;
+            bool planned = false;
+            record("partitionedPlan", notLoaded, nothing, [&]() {
+                GenerationResult generated = map->partitionedPlan(districts, options.margin, options.maxIterations, partitionRng);
+                if (generated.status != VALID_PLAN) {
+                    return false;
+                }
+                plan = generated.plan;
+                planned = true;
+                return true;
+            });
+
+            // The checks, with the cache cleared so that every run does the work
+            const std::string noPlan = !notLoaded.empty() ? notLoaded : planned ? "" : "no partitioned plan was valid";
+            auto uncached = [&]() {
+                map->clearPlanCache();
+            };
+            record("validate", noPlan, uncached, [&]() {
+                return map->isValidPlan(plan, options.margin);
+            });
+            record("validateParallel", noPlan, uncached, [&]() {
+                return map->isValidPlanParallel(plan, options.margin);
+            });
+            record("score", noPlan, uncached, [&]() {
+                return map->howGerrymandered(plan) >= 0;
+            });
+        }
+    }
+
+    return results;
+}
+
+std::string toJson(const BenchmarkResult& result) {
+    std::ostringstream json;
+    json << std::setprecision(6)
+         << "{\"map\":\"" << result.map << "\""
+         << ",\"precincts\":" << result.precincts
+         << ",\"operation\":\"" << result.operation << "\""
+         << ",\"samples\":" << result.samples
+         << ",\"throughput\":" << result.throughput
+         << ",\"p50_ms\":" << result.p50Ms
+         << ",\"p99_ms\":" << result.p99Ms
+         << ",\"success_rate\":" << result.successRate
+         << ",\"peak_rss_kb\":" << result.peakRssKb;
+    if (!result.skipped.empty()) {
+        json << ",\"skipped\":\"" << result.skipped << "\"";
+    }
+    json << "}";
+    return json.str();
+}
+
+/*
+ * The peak resident set size from getrusage() (which Linux reports in kilobytes, and macOS in bytes)
+ */
+long peakResidentKb() {
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+
+/************** TESTS **************/
+
+STUDENT_TEST("Generating synthetic maps") {
+    for (SyntheticMap kind : {GRID_MAP, PLANAR_MAP}) {
+        std::ostringstream demographics;
+        std::ostringstream adjacency;
+        writeSyntheticMap(kind, 1000, 3, demographics, adjacency);
+
+        // The loader checks that every border is listed both ways
+        std::istringstream demographicsInput(demographics.str());
+        std::istringstream adjacencyInput(adjacency.str());
+        VotingMap map;
+        map.loadFromStreams(demographicsInput, adjacencyInput);
+        EXPECT_EQUAL(map.size(), 1000);
+
+        int degrees = 0;
+        for (int index = 0; index < map.size(); index++) {
+            degrees += map.degreeAt(index);
+        }
+        // About 4 neighbors on a grid, and 6 on a planar map (fewer on the edges)
+        double meanDegree = double(degrees) / map.size();
+        EXPECT(kind == GRID_MAP ? meanDegree > 3.5 && meanDegree <= 4 : meanDegree > 5.5 && meanDegree <= 6);
+    }
+}
+
+STUDENT_TEST("Benchmarking small synthetic maps") {
+    BenchmarkOptions options;
+    options.sizes = {400};
+    options.totalDistricts = 4;
+    options.margin = 0.2;
+    options.samples = 3;
+    options.maxIterations = 200;
+
+    std::ostringstream out;
+    std::vector<BenchmarkResult> results = runBenchmarks(options, out);
+    EXPECT_EQUAL(results.size(), 14u);
+
+    // One line of JSON per result
+    std::istringstream lines(out.str());
+    std::string line;
+    int count = 0;
+    bool allJson = true;
+    while (std::getline(lines, line)) {
+        allJson = allJson && line.front() == '{' && line.back() == '}' && line.find("\"p99_ms\":") != std::string::npos;
+        count++;
+    }
+    EXPECT_EQUAL(count, 14);
+    EXPECT(allJson);
+
+    for (const BenchmarkResult& result : results) {
+        if (result.skipped.empty()) {
+            EXPECT(result.samples >= 1 && result.samples <= 3);
+            EXPECT(result.p50Ms <= result.p99Ms);
+            EXPECT(result.throughput > 0);
+        } else {
+            // Only the checks are skipped, when no partitioned plan was valid
+            EXPECT_EQUAL(result.samples, 0);
+            EXPECT(result.operation == "validate" || result.operation == "validateParallel" || result.operation == "score");
+        }
+    }
+    EXPECT_EQUAL(results[0].operation, "load");
+    EXPECT_EQUAL(results[0].successRate, 1.0);
+}
+
+STUDENT_TEST("Skipping the operations that took the whole time budget") {
+    BenchmarkOptions options;
+    options.sizes = {100, 400};
+    options.maps = {GRID_MAP};
+    options.totalDistricts = 4;
+    options.margin = 0.2;
+    options.maxIterations = 50;
+    // Every run takes the whole budget, so every operation is run once on the first map, and skipped on the second
+    options.timeBudgetMs = 0;
+
+    std::ostringstream out;
+    std::vector<BenchmarkResult> results = runBenchmarks(options, out);
+    EXPECT_EQUAL(results.size(), 14u);
+    for (int i = 0; i < 7; i++) {
+        EXPECT_EQUAL(results[i].precincts, 100);
+        EXPECT(results[i].samples == 1 || !results[i].skipped.empty());
+    }
+    for (int i = 7; i < 14; i++) {
+        EXPECT_EQUAL(results[i].precincts, 400);
+        EXPECT_EQUAL(results[i].samples, 0);
+        EXPECT(!results[i].skipped.empty());
+    }
+    EXPECT(out.str().find("\"skipped\":\"over the time budget on 100 precincts\"") != std::string::npos);
+}
+
+STUDENT_TEST("Reading the benchmark options from the command line") {
+    BenchmarkOptions defaults = parseBenchmarkOptions({});
+    EXPECT_EQUAL(defaults.sizes.size(), 3u);
+    EXPECT_EQUAL(defaults.samples, 20);
+
+    BenchmarkOptions options = parseBenchmarkOptions({"--sizes", "500,2000", "--maps", "planar", "--samples", "5", "--budget", "0"});
+    EXPECT_EQUAL(options.sizes.size(), 2u);
+    EXPECT_EQUAL(options.sizes[1], 2000);
+    EXPECT_EQUAL(options.maps.size(), 1u);
+    EXPECT(options.maps[0] == PLANAR_MAP);
+    EXPECT_EQUAL(options.samples, 5);
+    EXPECT_EQUAL(options.timeBudgetMs, 0);
+
+    EXPECT_ERROR(parseBenchmarkOptions({"--size", "500"}));
+    EXPECT_ERROR(parseBenchmarkOptions({"--sizes"}));
+    EXPECT_ERROR(parseBenchmarkOptions({"--sizes", "500,big"}));
+    EXPECT_ERROR(parseBenchmarkOptions({"--sizes", ","}));
+    EXPECT_ERROR(parseBenchmarkOptions({"--maps", "hex"}));
+    EXPECT_ERROR(parseBenchmarkOptions({"--samples", "0"}));
+    EXPECT_ERROR(parseBenchmarkOptions({"--budget", "-1"}));
+}
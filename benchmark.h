@@ -0,0 +1,99 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the benchmark suite, which measures how the
+ * generators and checks scale on synthetic maps (from a thousand to
+ * a million precincts), instead of timing single calls on the 10x5 grid.
+ *
+ * Synthetic maps => a grid (4 neighbors per precinct), or a planar map
+ *          (a grid where every square is split by a random diagonal, which
+ *          has about 6 neighbors per precinct, like real precinct maps)
+ *
+ * Every operation is run a number of times on every map, and reported as
+ * one line of JSON (throughput, median and 99th percentile latency, how
+ * many runs succeeded, and the peak resident memory of the process), so
+ * runs can be compared by scripts to track regressions.
+ *
+ * The suite is run from main() with the "--benchmark" argument, followed by
+ * any of the flags read by parseBenchmarkOptions().
+ */
+
+#pragma once
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The synthetic maps
+enum SyntheticMap {
+    GRID_MAP,
+    PLANAR_MAP
+};
+
+// What the suite runs
+struct BenchmarkOptions {
+    // How many precincts every map has (a million can be asked for, but the greedy generators take minutes on it)
+    std::vector<int> sizes = {1000, 10000, 100000};
+    std::vector<SyntheticMap> maps = {GRID_MAP, PLANAR_MAP};
+    int totalDistricts = 10;
+    double margin = 0.1;
+    /* The most runs of an operation on a map, and the time they can take. At least 1 run is always
+     * made, so an operation whose median run takes the whole budget isn't run on larger maps (it is
+     * reported as skipped instead).
+     */
+    int samples = 20;
+    int timeBudgetMs = 10000;
+    // The budget of the bounded generators (see "Gerrymander::repairedRandomPlan")
+    int maxIterations = 500;
+    // The seed of the maps and of every generator
+    uint64_t seed = 1;
+};
+
+// The measurements of an operation on a map
+struct BenchmarkResult {
+    std::string map;
+    int precincts;
+    std::string operation;
+    int samples;
+    // Runs per second
+    double throughput;
+    double p50Ms;
+    double p99Ms;
+    // The share of the runs that succeeded (e.g. generated a valid plan)
+    double successRate;
+    // The peak resident memory of the whole process so far
+    long peakRssKb;
+    // Why the operation wasn't run (empty if it was), in which case there are no samples
+    std::string skipped;
+};
+
+/* Writes a synthetic map with the given number of precincts (ids 0 to precincts - 1), in the
+ * format of "VotingMap::loadFromStreams". The Democratic share of the vote rises from west to
+ * east (with noise), so the plans have something to gerrymander.
+ */
+void writeSyntheticMap(SyntheticMap kind, int precincts, uint64_t seed, std::ostream& demographics, std::ostream& adjacency);
+
+/* Reads the options from the command line arguments that follow "--benchmark":
+ *
+ * --sizes 1000,10000 => the number of precincts of every map
+ * --maps grid,planar => the synthetic maps
+ * --samples 20 => the most runs of an operation on a map
+ * --budget 10000 => the time budget of an operation on a map, in milliseconds
+ *
+ * Anything not given keeps its default. Throws an error on an unknown flag or a malformed value.
+ */
+BenchmarkOptions parseBenchmarkOptions(const std::vector<std::string>& args);
+
+// Runs every operation on every map, writing each result to out as soon as it is measured
+std::vector<BenchmarkResult> runBenchmarks(const BenchmarkOptions& options, std::ostream& out);
+
+// Returns a result as a single line of JSON
+std::string toJson(const BenchmarkResult& result);
+
+// Returns the peak resident memory of the process in kilobytes (0 where it can't be read)
+long peakResidentKb();
+
+#endif // BENCHMARK_H
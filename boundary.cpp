@@ -0,0 +1,293 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the BoundaryIndex class.
+ *
+ * An edge (precinct => neighbor) is cut when its ends are in different
+ * districts, and it belongs to the district of the precinct it starts
+ * from, so moving a precinct can only change its own edges, and the
+ * edges of its neighbors that lead back to it.
+ */
+
+#include "boundary.h"
+
+#include <algorithm>
+#include <set>
+#include <utility>
+
+#include "error.h"
+#include "rng.h"
+#include "testing/SimpleTest.h"
+#include "testmaps.h"
+
+const int BoundaryIndex::ABSENT;
+
+/*
+ * Finds the edges leading to every precinct (a counting sort of the edges by where they
+ * lead), and whether each border is listed both ways (the neighbors of every precinct
+ * are sorted, so it is a binary search), then adds every cut edge to the lists
+ */
+BoundaryIndex::BoundaryIndex(const Plan& plan) {
+    if (plan.unassignedCount() > 0) {
+        error("BoundaryIndex: the plan does not assign every precinct");
+    }
+
+    map = &plan.votingMap();
+    const int size = plan.size();
+    neighbors = size > 0 ? map->neighborsOf(0).begin() : nullptr;
+    districts = plan.assignment();
+    foreign.assign(size, 0);
+    districtCuts.assign(plan.districtCount(), std::vector<int>());
+    oneWayCuts = 0;
+
+    const int edges = size > 0 ? map->neighborsOf(size - 1).end() - neighbors : 0;
+    source.resize(edges);
+    oneWay.resize(edges);
+    cutPosition.assign(edges, ABSENT);
+    districtPosition.assign(edges, ABSENT);
+
+    incomingOffsets.assign(size + 1, 0);
+    for (int edge = 0; edge < edges; edge++) {                  // O(E)
+        incomingOffsets[neighbors[edge] + 1]++;
+    }
+    for (int precinct = 0; precinct < size; precinct++) {
+        incomingOffsets[precinct + 1] += incomingOffsets[precinct];
+    }
+    incoming.resize(edges);
+    std::vector<int> filled(incomingOffsets.begin(), incomingOffsets.end() - 1);
+
+    for (int precinct = 0; precinct < size; precinct++) {     // O(E log degree)
+        NeighborView adj = map->neighborsOf(precinct);
+        for (const int* slot = adj.begin(); slot != adj.end(); slot++) {
+            const int edge = slot - neighbors;
+            NeighborView back = map->neighborsOf(*slot);
+            source[edge] = precinct;
+            oneWay[edge] = !std::binary_search(back.begin(), back.end(), precinct);
+            incoming[filled[*slot]++] = edge;
+
+            if (districts[*slot] != districts[precinct]) {
+                foreign[precinct]++;
+                addCut(edge, districts[precinct]);
+            }
+        }
+    }
+}
+
+/*
+ * Every edge of the precinct moves to the list of its new district (if it is still cut),
+ * and the edges leading to it are cut, or stop being cut, as their far end moves
+ */
+void BoundaryIndex::applyMove(int precinct, int fromDistrict, int toDistrict) {
+    if (fromDistrict == toDistrict) {
+        return;
+    }
+
+    NeighborView adj = map->neighborsOf(precinct);
+    for (const int* slot = adj.begin(); slot != adj.end(); slot++) {
+        const int edge = slot - neighbors;
+        const int district = districts[*slot];
+        if (*slot == precinct) {
+            continue;
+        }
+
+        if (district != fromDistrict) {
+            removeCut(edge, fromDistrict);
+            foreign[precinct]--;
+        }
+        if (district != toDistrict) {
+            addCut(edge, toDistrict);
+            foreign[precinct]++;
+        }
+    }
+
+    for (int i = incomingOffsets[precinct]; i < incomingOffsets[precinct + 1]; i++) {
+        const int edge = incoming[i];
+        const int neighbor = source[edge];
+        const int district = districts[neighbor];
+        if (neighbor == precinct) {
+            continue;
+        }
+
+        if (district == fromDistrict) {
+            // The neighbor is now across a border
+            addCut(edge, district);
+            foreign[neighbor]++;
+        } else if (district == toDistrict) {
+            // The neighbor is no longer across a border
+            removeCut(edge, district);
+            foreign[neighbor]--;
+        }
+    }
+
+    districts[precinct] = toDistrict;
+}
+
+int BoundaryIndex::cutEdgeCount() const {
+    return (cuts.size() + oneWayCuts) / 2;
+}
+
+int BoundaryIndex::cutEdgeCount(int district) const {
+    return districtCuts[district].size();
+}
+
+int BoundaryIndex::foreignNeighbors(int precinct) const {
+    return foreign[precinct];
+}
+
+bool BoundaryIndex::isBoundary(int precinct) const {
+    return foreign[precinct] > 0;
+}
+
+void BoundaryIndex::cutEdgeAt(int district, int position, int& precinct, int& neighbor) const {
+    const int edge = districtCuts[district][position];
+    precinct = source[edge];
+    neighbor = neighbors[edge];
+}
+
+void BoundaryIndex::addCut(int edge, int district) {
+    oneWayCuts += oneWay[edge];
+    cutPosition[edge] = cuts.size();
+    cuts.push_back(edge);
+
+    std::vector<int>& list = districtCuts[district];
+    districtPosition[edge] = list.size();
+    list.push_back(edge);
+}
+
+void BoundaryIndex::removeCut(int edge, int district) {
+    oneWayCuts -= oneWay[edge];
+    const int last = cuts.back();
+    cuts[cutPosition[edge]] = last;
+    cutPosition[last] = cutPosition[edge];
+    cuts.pop_back();
+    cutPosition[edge] = ABSENT;
+
+    std::vector<int>& list = districtCuts[district];
+    const int lastOfDistrict = list.back();
+    list[districtPosition[edge]] = lastOfDistrict;
+    districtPosition[lastOfDistrict] = districtPosition[edge];
+    list.pop_back();
+    districtPosition[edge] = ABSENT;
+}
+
+
+/************** TESTS **************/
+
+/*
+ * The borders between precincts in different districts, counted directly (each once, whichever
+ * of its precincts lists it)
+ */
+static int countBorders(const Plan& plan) {
+    const VotingMap& map = plan.votingMap();
+    std::set<std::pair<int, int>> borders;
+    for (int index = 0; index < plan.size(); index++) {
+        for (int next : map.neighborsOf(index)) {
+            if (plan.districtOf(index) != plan.districtOf(next)) {
+                borders.insert({std::min(index, next), std::max(index, next)});
+            }
+        }
+    }
+    return borders.size();
+}
+
+STUDENT_TEST("Keeping the boundary of a plan up to date through moves") {
+    // 10x5 grid
+    VotingMap map;
+    addGridMap(map, 5, 10, [](int id) { return oneVote(id % 5 < 2); });
+
+    // 5 districts of 2 rows each => 4 borders of 5 edges
+    Plan plan(map, 5);
+    for (int index = 0; index < 50; index++) {
+        plan.assign(index, index / 10);
+    }
+    BoundaryIndex boundary(plan);
+    EXPECT_EQUAL(boundary.cutEdgeCount(), 20);
+    EXPECT_EQUAL(boundary.cutEdgeCount(0), 5);
+    EXPECT_EQUAL(boundary.cutEdgeCount(2), 10);
+    EXPECT(boundary.isBoundary(12));
+    EXPECT(!boundary.isBoundary(0));
+
+    // After random moves, the index matches one built from scratch
+    Rng rng(6);
+    for (int move = 0; move < 500; move++) {
+        int precinct;
+        int neighbor;
+        EXPECT(boundary.randomCutEdge(rng, precinct, neighbor));
+        EXPECT(plan.districtOf(precinct) != plan.districtOf(neighbor));
+        const int from = plan.districtOf(precinct);
+        const int to = plan.districtOf(neighbor);
+        plan.assign(precinct, to);
+        boundary.applyMove(precinct, from, to);
+    }
+
+    BoundaryIndex rebuilt(plan);
+    EXPECT_EQUAL(boundary.cutEdgeCount(), rebuilt.cutEdgeCount());
+    EXPECT_EQUAL(boundary.cutEdgeCount(), countBorders(plan));
+    for (int district = 0; district < 5; district++) {
+        EXPECT_EQUAL(boundary.cutEdgeCount(district), rebuilt.cutEdgeCount(district));
+
+        int precinct;
+        int neighbor;
+        if (boundary.randomCutEdge(district, rng, precinct, neighbor)) {
+            EXPECT_EQUAL(plan.districtOf(precinct), district);
+            EXPECT(plan.districtOf(neighbor) != district);
+        }
+    }
+    for (int index = 0; index < 50; index++) {
+        EXPECT_EQUAL(boundary.foreignNeighbors(index), rebuilt.foreignNeighbors(index));
+    }
+
+    // A single district has no boundary
+    Plan whole(map, 1);
+    for (int index = 0; index < 50; index++) {
+        whole.assign(index, 0);
+    }
+    int precinct;
+    int neighbor;
+    EXPECT(!BoundaryIndex(whole).randomCutEdge(rng, precinct, neighbor));
+    EXPECT_ERROR(BoundaryIndex(Plan(map, 2)));
+}
+
+STUDENT_TEST("Borders listed by only one precinct (Vaguely based off of a small area in TX)") {
+    // 50005 and 50006 list 50002, which doesn't list them back
+    VotingMap voting;
+    voting.addArea(new Area(50001, 121, 162, 636, {50002, 50007}));
+    voting.addArea(new Area(50002, 1011, 351, 2837, {50001, 50003, 50004}));
+    voting.addArea(new Area(50003, 234, 1141, 2527, {50002, 50005}));
+    voting.addArea(new Area(50004, 366, 452, 1223, {50002, 50005}));
+    voting.addArea(new Area(50005, 468, 611, 2168, {50002, 50004, 50003, 50006}));
+    voting.addArea(new Area(50006, 51, 275, 619, {50002, 50005, 50007}));
+    voting.addArea(new Area(50007, 121, 909, 2918, {50001, 50006}));
+
+    EXPECT(voting.isAdjacdent(50005, 50002));
+    EXPECT(!voting.isAdjacdent(50002, 50005));
+
+    Plan plan(voting, 3);
+    for (int index = 0; index < voting.size(); index++) {
+        plan.assign(index, index % 3);
+    }
+    BoundaryIndex boundary(plan);
+    EXPECT_EQUAL(boundary.cutEdgeCount(), countBorders(plan));
+
+    Rng rng(3);
+    for (int move = 0; move < 200; move++) {
+        int precinct;
+        int neighbor;
+        if (!boundary.randomCutEdge(rng, precinct, neighbor)) {
+            break;
+        }
+        const int from = plan.districtOf(precinct);
+        const int to = plan.districtOf(neighbor);
+        plan.assign(precinct, to);
+        boundary.applyMove(precinct, from, to);
+    }
+
+    BoundaryIndex rebuilt(plan);
+    EXPECT_EQUAL(boundary.cutEdgeCount(), rebuilt.cutEdgeCount());
+    EXPECT_EQUAL(boundary.cutEdgeCount(), countBorders(plan));
+    for (int district = 0; district < 3; district++) {
+        EXPECT_EQUAL(boundary.cutEdgeCount(district), rebuilt.cutEdgeCount(district));
+    }
+    for (int index = 0; index < voting.size(); index++) {
+        EXPECT_EQUAL(boundary.foreignNeighbors(index), rebuilt.foreignNeighbors(index));
+    }
+}
@@ -0,0 +1,116 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the BoundaryIndex class, which keeps track of
+ * every border between 2 districts of a Plan as precincts are moved,
+ * for the move-based algorithms (the ensemble sampler and the annealer).
+ *
+ * The borders are the cut edges of the adjacency graph, counted in both
+ * directions (precinct => neighbor in another district), and kept in
+ * 2 unordered lists (one over the whole plan, and one per district), where
+ * every edge knows its position in both, so:
+ *
+ * Moving a precinct => only the edges from and to the precinct change, O(degree)
+ * A random cut edge => a random position in a list, O(1)
+ * The number of cut edges => the size of the list, O(1) (a running compactness metric)
+ *
+ * The edges are the slots of the VotingMap's neighbor buffer, so the index
+ * is only valid while the map is not modified. A border can be listed by
+ * only one of its precincts (maps built with addArea() aren't checked), in
+ * which case it is a single edge, so the edges leading to a precinct are
+ * kept apart from its own.
+ */
+
+#pragma once
+
+#ifndef BOUNDARY_H
+#define BOUNDARY_H
+
+#include <cstdint>
+#include <vector>
+
+#include "plan.h"
+#include "votingmap.h"
+
+class BoundaryIndex
+{
+public:
+    // Builds the index of a (fully assigned) plan, O(V + E)
+    BoundaryIndex(const Plan& plan);
+
+    // Moves a precinct from one district to another, updating every edge from or to the precinct, O(degree)
+    void applyMove(int precinct, int fromDistrict, int toDistrict);
+
+    // Returns the number of borders between precincts in different districts (each counted once)
+    int cutEdgeCount() const;
+    // Returns the number of cut edges leaving a district (its perimeter, in borders)
+    int cutEdgeCount(int district) const;
+    // Returns how many neighbors of a precinct (that it lists) are in another district
+    int foreignNeighbors(int precinct) const;
+    // Returns whether a precinct borders another district
+    bool isBoundary(int precinct) const;
+
+    /* Picks a uniformly random cut edge (of the whole plan, or leaving a given district), where precinct
+     * is on the near side and neighbor on the far side, O(1). Returns false if there are none.
+     */
+    template <typename Random> bool randomCutEdge(Random& rng, int& precinct, int& neighbor) const;
+    template <typename Random> bool randomCutEdge(int district, Random& rng, int& precinct, int& neighbor) const;
+    // Returns the ends of a cut edge leaving a district, by its position (below cutEdgeCount(district), in no order), O(1)
+    void cutEdgeAt(int district, int position, int& precinct, int& neighbor) const;
+
+private:
+    // The position of an edge that isn't in a list
+    static const int ABSENT = -1;
+
+    const VotingMap* map;
+    // The start of the map's neighbor buffer (edge => neighbors[edge] is the precinct it leads to)
+    const int* neighbors;
+    // dense index => district number (kept in step with the plan by applyMove())
+    std::vector<uint16_t> districts;
+    // dense index => how many of its neighbors are in another district
+    std::vector<int> foreign;
+
+    // edge => the precinct it starts from, and whether the border is listed one way only
+    std::vector<int> source;
+    std::vector<char> oneWay;
+    // index => [incomingOffsets[index], incomingOffsets[index + 1]) range in incoming, the edges leading to it
+    std::vector<int> incomingOffsets;
+    std::vector<int> incoming;
+
+    // Every cut edge, and the cut edges starting in each district (in no order)
+    std::vector<int> cuts;
+    std::vector<std::vector<int>> districtCuts;
+    // edge => its position in cuts, and in the list of its district (ABSENT if it isn't cut)
+    std::vector<int> cutPosition;
+    std::vector<int> districtPosition;
+    // How many of the cut edges are one way (so that cutEdgeCount() counts every border once)
+    int oneWayCuts;
+
+    // Adds a cut edge to both lists, or removes it from them (swapping the last edge into its place), O(1)
+    void addCut(int edge, int district);
+    void removeCut(int edge, int district);
+};
+
+template <typename Random>
+bool BoundaryIndex::randomCutEdge(Random& rng, int& precinct, int& neighbor) const {
+    if (cuts.empty()) {
+        return false;
+    }
+    const int edge = cuts[rng.nextInt(0, int(cuts.size()) - 1)];
+    precinct = source[edge];
+    neighbor = neighbors[edge];
+    return true;
+}
+
+template <typename Random>
+bool BoundaryIndex::randomCutEdge(int district, Random& rng, int& precinct, int& neighbor) const {
+    const std::vector<int>& edges = districtCuts[district];
+    if (edges.empty()) {
+        return false;
+    }
+    const int edge = edges[rng.nextInt(0, int(edges.size()) - 1)];
+    precinct = source[edge];
+    neighbor = neighbors[edge];
+    return true;
+}
+
+#endif // BOUNDARY_H
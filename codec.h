@@ -0,0 +1,134 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the variable-length integer encoding shared by the
+ * binary streams of the project (the shard records of "distributed.h",
+ * and the plan streams of "planstream.h").
+ *
+ * Varint => 7 bits per byte, lowest bits first, where the top bit of a
+ *          byte is set if more bytes follow (so values below 128 take
+ *          a single byte)
+ * ZigZag => signed values are interleaved (0, -1, 1, -2, 2, ...) so
+ *          that small negative values are encoded in few bytes too
+ *
+ * The readers throw an error at the end of the stream, or on a varint
+ * longer than 64 bits, so a truncated stream is never read as data.
+ */
+
+#pragma once
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "error.h"
+
+inline void writeVarint(std::ostream& out, uint64_t value) {
+    char bytes[10];
+    int count = 0;
+    while (value >= 0x80) {
+        bytes[count++] = char((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    bytes[count++] = char(value);
+    out.write(bytes, count);
+}
+
+inline uint64_t readVarint(std::istream& in) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const int byte = in.get();
+        if (byte == std::char_traits<char>::eof()) {
+            error("readVarint: unexpected end of stream");
+        }
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    error("readVarint: varint is longer than 64 bits");
+    return 0;
+}
+
+inline uint64_t zigzagEncode(int64_t value) {
+    return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+inline int64_t zigzagDecode(uint64_t value) {
+    return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+inline void writeSignedVarint(std::ostream& out, int64_t value) {
+    writeVarint(out, zigzagEncode(value));
+}
+
+inline int64_t readSignedVarint(std::istream& in) {
+    return zigzagDecode(readVarint(in));
+}
+
+// Fixed-width 64-bit values (e.g. seeds and hashes, which are random and wouldn't shrink as varints), lowest byte first
+inline void writeFixed64(std::ostream& out, uint64_t value) {
+    char bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = char(value >> (8 * i));
+    }
+    out.write(bytes, 8);
+}
+
+inline uint64_t readFixed64(std::istream& in) {
+    unsigned char bytes[8];
+    if (!in.read(reinterpret_cast<char*>(bytes), 8)) {
+        error("readFixed64: unexpected end of stream");
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= uint64_t(bytes[i]) << (8 * i);
+    }
+    return value;
+}
+
+/* A whole assignment (dense index => district) as runs of (district, length), after the
+ * number of runs. Neighboring indices are usually in the same district, so it is much
+ * smaller than the assignment.
+ */
+inline void writeAssignmentRuns(std::ostream& out, const std::vector<uint16_t>& assignment) {
+    uint64_t runs = 0;
+    for (size_t index = 0; index < assignment.size(); index++) {
+        runs += (index == 0 || assignment[index] != assignment[index - 1]);
+    }
+    writeVarint(out, runs);
+
+    for (size_t start = 0; start < assignment.size();) {
+        size_t end = start + 1;
+        while (end < assignment.size() && assignment[end] == assignment[start]) {
+            end++;
+        }
+        writeVarint(out, assignment[start]);
+        writeVarint(out, end - start);
+        start = end;
+    }
+}
+
+// Reads runs into assignment, which must come out to exactly precincts indices in districts below the given number
+inline void readAssignmentRuns(std::istream& in, int precincts, int districts, std::vector<uint16_t>& assignment) {
+    assignment.clear();
+    assignment.reserve(precincts);
+
+    const uint64_t runs = readVarint(in);
+    for (uint64_t run = 0; run < runs; run++) {
+        const uint64_t district = readVarint(in);
+        const uint64_t length = readVarint(in);
+        if (district >= uint64_t(districts) || length > uint64_t(precincts) - assignment.size()) {
+            error("readAssignmentRuns: malformed assignment");
+        }
+        assignment.insert(assignment.end(), length, uint16_t(district));
+    }
+    if (int(assignment.size()) != precincts) {
+        error("readAssignmentRuns: malformed assignment");
+    }
+}
+
+#endif // CODEC_H
@@ -0,0 +1,366 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the continuity checks.
+ *
+ * All of them are the same search: starting from some precinct, it
+ * repeatedly takes a precinct off the stack and pushes every unvisited
+ * neighbor that belongs to the same district.
+ */
+
+#include "contiguity.h"
+
+#include <algorithm>
+
+#include "rng.h"
+#include "testing/SimpleTest.h"
+#include "testmaps.h"
+
+// How many precincts a local search of "staysContinuousLocal" takes off its queue before it gives up
+const int LOCAL_SEARCH_LIMIT = 64;
+
+// How a local search of "staysContinuousLocal" ended
+enum LocalSearch {
+    // Every target was reached
+    REACHED_TARGETS,
+    // The piece of the district ran out first
+    EXHAUSTED,
+    // LOCAL_SEARCH_LIMIT precincts were searched first
+    OUT_OF_BUDGET
+};
+
+/*
+ * Each thread gets its own arena the first time it checks a plan
+ */
+ContiguityScratch& contiguityScratch() {
+    thread_local ContiguityScratch scratch;
+    return scratch;
+}
+
+/*
+ * Visits (and counts) every precinct reachable from start without leaving
+ * its district. Precincts that are already visited are treated as walls.
+ */
+static int searchDistrict(const Plan& plan, int start, ContiguityScratch& scratch) {
+    const VotingMap& map = plan.votingMap();
+    const int district = plan.districtOf(start);
+    int reached = 1;
+
+    scratch.stack.clear();
+    scratch.stack.push_back(start);
+    scratch.markVisited(start);
+
+    while (!scratch.stack.empty()) {
+        int cur = scratch.stack.back();
+        scratch.stack.pop_back();
+
+        for (int next : map.neighborsOf(cur)) {
+            if (!scratch.isVisited(next) && plan.districtOf(next) == district) {
+                scratch.markVisited(next);
+                scratch.stack.push_back(next);
+                reached++;
+            }
+        }
+    }
+
+    return reached;
+}
+
+/*
+ * Searches from every precinct that hasn't been reached yet. Each search covers
+ * exactly one connected piece of a district, so if any district is found in a
+ * second piece, that district isn't continuous.
+ *
+ * Every precinct and every edge is looked at a constant number of times, O(V + E).
+ */
+bool isContinuousPlan(const Plan& plan) {
+    ContiguityScratch& scratch = contiguityScratch();
+    scratch.clearVisited(plan.size());
+    scratch.seen.assign(plan.districtCount(), false);
+
+    for (int index = 0; index < plan.size(); index++) {
+        int district = plan.districtOf(index);
+        if (scratch.isVisited(index) || district == Plan::UNASSIGNED) {
+            continue;
+        }
+
+        if (scratch.seen[district]) {
+            return false;
+        }
+        scratch.seen[district] = true;
+        searchDistrict(plan, index, scratch);
+    }
+
+    return true;
+}
+
+/*
+ * The same searches as "isContinuousPlan", but instead of stopping at the first split
+ * district, it counts how many of the searches start in each district
+ */
+std::vector<int> districtPieces(const Plan& plan) {
+    ContiguityScratch& scratch = contiguityScratch();
+    scratch.clearVisited(plan.size());
+    std::vector<int> pieces(plan.districtCount(), 0);
+
+    for (int index = 0; index < plan.size(); index++) {
+        int district = plan.districtOf(index);
+        if (scratch.isVisited(index) || district == Plan::UNASSIGNED) {
+            continue;
+        }
+
+        pieces[district]++;
+        searchDistrict(plan, index, scratch);
+    }
+
+    return pieces;
+}
+
+/*
+ * Searches the district from its first precinct, and checks that every precinct
+ * of the district was reached
+ */
+bool isContinuousDistrict(const Plan& plan, int district) {
+    if (plan.districtSize(district) == 0) {
+        return false;
+    }
+
+    int start = 0;
+    while (plan.districtOf(start) != district) {
+        start++;
+    }
+
+    ContiguityScratch& scratch = contiguityScratch();
+    scratch.clearVisited(plan.size());
+    return searchDistrict(plan, start, scratch) == plan.districtSize(district);
+}
+
+/*
+ * Searches the district from start, and checks that every precinct of the district was reached
+ */
+bool isContinuousFrom(const Plan& plan, int start, ContiguityScratch& scratch) {
+    return searchDistrict(plan, start, scratch) == plan.districtSize(plan.districtOf(start));
+}
+
+/*
+ * Searches the rest of the precinct's district, starting from one of its neighbors
+ * in the same district (with the precinct itself marked as visited, so the search
+ * can't pass through it), and checks that every other precinct is reached.
+ */
+bool staysContinuous(const Plan& plan, int precinct) {
+    const VotingMap& map = plan.votingMap();
+    const int district = plan.districtOf(precinct);
+    const int remaining = plan.districtSize(district) - 1;
+    if (remaining <= 0) {
+        return false;
+    }
+
+    int start = -1;
+    for (int next : map.neighborsOf(precinct)) {
+        if (plan.districtOf(next) == district) {
+            start = next;
+            break;
+        }
+    }
+    if (start == -1) {
+        return false;
+    }
+
+    ContiguityScratch& scratch = contiguityScratch();
+    scratch.clearVisited(plan.size());
+    scratch.markVisited(precinct);
+    return searchDistrict(plan, start, scratch) == remaining;     // O(|district|)
+}
+
+/*
+ * Searches (BFS, so the nearest precincts come first) from start without leaving its district
+ * or passing through the removed precinct, until every one of the targets has been reached
+ */
+static LocalSearch searchLocally(const Plan& plan, int start, int removed, ContiguityScratch& scratch) {
+    const VotingMap& map = plan.votingMap();
+    const int district = plan.districtOf(start);
+    const std::vector<int>& targets = scratch.targets;
+
+    scratch.nextStamp(plan.size());
+    scratch.stamps[removed] = scratch.stamp;
+    scratch.stamps[start] = scratch.stamp;
+    scratch.stack.clear();
+    scratch.stack.push_back(start);
+    size_t found = 1;
+
+    for (size_t head = 0; head < scratch.stack.size(); head++) {
+        if (head >= size_t(LOCAL_SEARCH_LIMIT)) {
+            return OUT_OF_BUDGET;
+        }
+
+        for (int next : map.neighborsOf(scratch.stack[head])) {
+            if (scratch.stamps[next] != scratch.stamp && plan.districtOf(next) == district) {
+                scratch.stamps[next] = scratch.stamp;
+                scratch.stack.push_back(next);
+                if (std::find(targets.begin(), targets.end(), next) != targets.end() && ++found == targets.size()) {
+                    return REACHED_TARGETS;
+                }
+            }
+        }
+    }
+    return EXHAUSTED;
+}
+
+/*
+ * The district is continuous, so it stays continuous without the precinct exactly when the
+ * precinct's neighbors in the district (the targets) are still connected to each other:
+ *
+ * A search from one target reaches every other target => every path that went through the
+ *          precinct can go around it, so the district stays continuous
+ * A search runs out of precincts first => it found a whole piece that is missing a target,
+ *          so the district splits (this is how a small piece being cut off is caught)
+ *
+ * Each search is bounded, and is tried from every target in turn (as the smallest piece is the
+ * one that runs out first). Only if every search runs out of budget is the district searched.
+ */
+bool staysContinuousLocal(const Plan& plan, int precinct) {
+    const VotingMap& map = plan.votingMap();
+    const int district = plan.districtOf(precinct);
+    if (plan.districtSize(district) <= 1) {
+        return false;
+    }
+
+    ContiguityScratch& scratch = contiguityScratch();
+    scratch.targets.clear();
+    for (int next : map.neighborsOf(precinct)) {    // O(degree)
+        if (plan.districtOf(next) == district) {
+            scratch.targets.push_back(next);
+        }
+    }
+
+    // A precinct with 1 neighbor in the district is a leaf, which can always be removed
+    if (scratch.targets.size() <= 1) {
+        return !scratch.targets.empty();
+    }
+
+    for (size_t i = 0; i < scratch.targets.size(); i++) {
+        LocalSearch outcome = searchLocally(plan, scratch.targets[i], precinct, scratch);   // O(LOCAL_SEARCH_LIMIT)
+        if (outcome != OUT_OF_BUDGET) {
+            return outcome == REACHED_TARGETS;
+        }
+    }
+
+    return staysContinuous(plan, precinct);     // O(|district|)
+}
+
+
+/************** TESTS **************/
+
+STUDENT_TEST("Removing precincts from a district") {
+    // A line of 4 precincts: 0 - 1 - 2 - 3
+    VotingMap map;
+    map.addArea(new Area(0, 1, 0, 1, {1}));
+    map.addArea(new Area(1, 1, 0, 1, {0, 2}));
+    map.addArea(new Area(2, 0, 1, 1, {1, 3}));
+    map.addArea(new Area(3, 0, 1, 1, {2}));
+
+    Plan plan(map, 2);
+    plan.assign(0, 0);
+    plan.assign(1, 0);
+    plan.assign(2, 0);
+    plan.assign(3, 1);
+
+    EXPECT(staysContinuous(plan, 0));
+    EXPECT(!staysContinuous(plan, 1));
+    EXPECT(staysContinuous(plan, 2));
+
+    // The last precinct of a district can't be removed
+    EXPECT(!staysContinuous(plan, 3));
+}
+
+STUDENT_TEST("Checking every district of a plan in one pass") {
+    // A line of 4 precincts: 0 - 1 - 2 - 3
+    VotingMap map;
+    map.addArea(new Area(0, 1, 0, 1, {1}));
+    map.addArea(new Area(1, 1, 0, 1, {0, 2}));
+    map.addArea(new Area(2, 0, 1, 1, {1, 3}));
+    map.addArea(new Area(3, 0, 1, 1, {2}));
+
+    Plan plan(map, 2);
+    plan.assign(0, 0);
+    plan.assign(1, 0);
+    plan.assign(2, 1);
+    plan.assign(3, 1);
+    EXPECT(isContinuousPlan(plan));
+    EXPECT(isContinuousDistrict(plan, 1));
+
+    // {0, 2} and {1, 3} are both split
+    plan.assign(1, 1);
+    plan.assign(2, 0);
+    EXPECT(!isContinuousPlan(plan));
+    EXPECT(!isContinuousDistrict(plan, 0));
+    EXPECT(districtPieces(plan) == std::vector<int>({2, 2}));
+}
+
+STUDENT_TEST("Checking a long district without recursion") {
+    // A line of 100000 precincts, which used to be 100000 stack frames deep
+    VotingMap map;
+    addGridMap(map, 100000, 1, [](int) { return oneVote(true); });
+
+    Plan plan(map, 1);
+    for (int index = 0; index < plan.size(); index++) {
+        plan.assign(index, 0);
+    }
+    EXPECT(isContinuousPlan(plan));
+    EXPECT(staysContinuous(plan, 0));
+    EXPECT(!staysContinuous(plan, 50000));
+}
+
+STUDENT_TEST("Removing precincts with a local search") {
+    // A 20x20 grid
+    const int side = 20;
+    VotingMap map;
+    addGridMap(map, side, side, [](int) { return oneVote(true); });
+
+    // Every precinct of random continuous plans gets the same answer as the full search
+    Rng rng(12);
+    for (int trial = 0; trial < 20; trial++) {
+        // Districts grown by BFS from random starts are continuous
+        Plan plan(map, 4);
+        std::vector<int> queue;
+        for (int district = 0; district < 4; district++) {
+            int start;
+            do {
+                start = rng.nextInt(0, plan.size() - 1);
+            } while (plan.districtOf(start) != Plan::UNASSIGNED);
+            plan.assign(start, district);
+            queue.push_back(start);
+        }
+        while (!queue.empty()) {
+            int pick = rng.nextInt(0, queue.size() - 1);
+            int cur = queue[pick];
+            queue[pick] = queue.back();
+            queue.pop_back();
+            for (int next : map.neighborsOf(cur)) {
+                if (plan.districtOf(next) == Plan::UNASSIGNED) {
+                    plan.assign(next, plan.districtOf(cur));
+                    queue.push_back(next);
+                }
+            }
+        }
+
+        bool allSame = isContinuousPlan(plan);
+        for (int index = 0; index < plan.size(); index++) {
+            allSame = allSame && staysContinuousLocal(plan, index) == staysContinuous(plan, index);
+        }
+        EXPECT(allSame);
+    }
+
+    // A ring around the edge, whose neighbors on either side only meet the long way round
+    Plan ring(map, 2);
+    for (int index = 0; index < ring.size(); index++) {
+        bool edge = index < side || index >= side * (side - 1) || index % side == 0 || index % side == side - 1;
+        ring.assign(index, edge ? 0 : 1);
+    }
+    EXPECT(staysContinuousLocal(ring, side / 2));
+
+    // A tail of 2 precincts is cut off by removing its neck
+    ring.assign(side + side / 2, 0);
+    ring.assign(2 * side + side / 2, 0);
+    EXPECT(staysContinuousLocal(ring, 2 * side + side / 2));
+    EXPECT(!staysContinuousLocal(ring, side / 2));
+}
@@ -0,0 +1,93 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the continuity checks that are shared by
+ * every part of the program that validates plans, or moves
+ * precincts between the districts of a Plan.
+ *
+ * The checks are iterative searches over the dense indices of the
+ * VotingMap. They don't recurse (so large districts can't overflow
+ * the stack), and their visited bitset and stack live in a scratch
+ * arena owned by the calling thread, which is reused by every check,
+ * so they don't allocate once the arena has grown to the size of the map.
+ */
+
+#pragma once
+
+#ifndef CONTIGUITY_H
+#define CONTIGUITY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "plan.h"
+
+/* The scratch space of the continuity checks (one per thread).
+ *
+ * The vectors are only ever cleared, never shrunk, so their capacity carries
+ * over from one check to the next.
+ */
+struct ContiguityScratch {
+    // 1 bit per dense index
+    std::vector<uint64_t> visited;
+    // The explicit stack of the search
+    std::vector<int> stack;
+    // 1 flag per district (whether a piece of it has been found yet)
+    std::vector<char> seen;
+    /* The marks of the local searches of "staysContinuousLocal", which are stamped (a search
+     * only has to bump the stamp, instead of clearing a bitset the size of the map)
+     */
+    std::vector<int> stamps;
+    int stamp = 0;
+    // The neighbors of the precinct being removed that are in its district
+    std::vector<int> targets;
+
+    // Starts a new set of marks for a map of the given size
+    void nextStamp(int size) {
+        if (int(stamps.size()) < size) {
+            stamps.resize(size, 0);
+        }
+        if (++stamp == 0) {
+            // The stamp wrapped around, so the old marks have to go
+            std::fill(stamps.begin(), stamps.end(), 0);
+            stamp = 1;
+        }
+    }
+
+    // Clears the bitset for a map of the given size
+    void clearVisited(int size) {
+        visited.assign((size + 63) / 64, 0);
+    }
+
+    bool isVisited(int index) const {
+        return (visited[index >> 6] >> (index & 63)) & 1;
+    }
+
+    void markVisited(int index) {
+        visited[index >> 6] |= uint64_t(1) << (index & 63);
+    }
+};
+
+// Returns the scratch space of the calling thread
+ContiguityScratch& contiguityScratch();
+
+// Returns true if every district of the plan is continuous, in a single O(V + E) pass
+bool isContinuousPlan(const Plan& plan);
+// Returns true if the given district of the plan is continuous (and not empty)
+bool isContinuousDistrict(const Plan& plan, int district);
+// Returns true if the district of the given precinct would still be continuous (and not empty) without it
+bool staysContinuous(const Plan& plan, int precinct);
+/* The same as "staysContinuous", for a district that is continuous now (as every district of a valid
+ * plan is). Most precincts are decided by bounded searches around the precinct, O(degree), and only
+ * the rest fall back to searching the district, O(|district|).
+ */
+bool staysContinuousLocal(const Plan& plan, int precinct);
+// Returns the number of disconnected pieces of every district (1 if it is continuous, 0 if it is empty), O(V + E)
+std::vector<int> districtPieces(const Plan& plan);
+/* Returns true if the district of the precinct at start is continuous, searching with the given
+ * scratch space without clearing it first. The search only marks (and only looks at) precincts
+ * of that district, so one cleared scratch can check every district of a plan once.
+ */
+bool isContinuousFrom(const Plan& plan, int start, ContiguityScratch& scratch);
+
+#endif // CONTIGUITY_H
@@ -0,0 +1,635 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the distributed ensemble mode.
+ *
+ * The chains of a node run at the same time, so every record is encoded on
+ * the thread of its chain, and only the finished bytes are written to the
+ * stream (under a lock), so that the records are never interleaved.
+ */
+
+#include "distributed.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+
+#include "codec.h"
+#include "error.h"
+#include "rng.h"
+#include "scheduler.h"
+#include "testing/SimpleTest.h"
+#include "testmaps.h"
+
+// The first bytes of every shard stream
+static const char SHARD_MAGIC[8] = {'G', 'M', 'S', 'H', 'A', 'R', 'D', '1'};
+static const uint64_t SHARD_VERSION = 1;
+// The tags that start every record, and the footer
+static const int FOOTER_TAG = 0;
+static const int RECORD_TAG = 1;
+/* The most precincts a shard stream is read for (far more than any real map, but small enough
+ * that a corrupt header can't make the coordinator reserve gigabytes for an assignment)
+ */
+static const uint64_t MAX_SHARD_PRECINCTS = uint64_t(1) << 26;
+
+// Doubles are written as their bits
+static void writeDouble(std::ostream& out, double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    writeFixed64(out, bits);
+}
+
+static double readDouble(std::istream& in) {
+    uint64_t bits = readFixed64(in);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+ScoreHistogram::ScoreHistogram(double low, double high, int bins)
+    : low(low), high(high), bins(std::max(1, bins), 0), total(0), sum(0), lowest(0), highest(0) {
+    if (!(high > low)) {
+        error("ScoreHistogram: the range of the histogram is empty");
+    }
+}
+
+int ScoreHistogram::binOf(double value) const {
+    const int bin = int(std::floor((value - low) / (high - low) * bins.size()));
+    return std::max(0, std::min(bin, int(bins.size()) - 1));
+}
+
+void ScoreHistogram::add(double value) {
+    bins[binOf(value)]++;
+    lowest = (total == 0) ? value : std::min(lowest, value);
+    highest = (total == 0) ? value : std::max(highest, value);
+    total++;
+    sum += value;
+}
+
+void ScoreHistogram::merge(const ScoreHistogram& other) {
+    if (other.low != low || other.high != high || other.bins.size() != bins.size()) {
+        error("ScoreHistogram: can't merge histograms with different bins");
+    }
+    if (other.total == 0) {
+        return;
+    }
+
+    for (size_t bin = 0; bin < bins.size(); bin++) {
+        bins[bin] += other.bins[bin];
+    }
+    lowest = (total == 0) ? other.lowest : std::min(lowest, other.lowest);
+    highest = (total == 0) ? other.highest : std::max(highest, other.highest);
+    total += other.total;
+    sum += other.sum;
+}
+
+long long ScoreHistogram::count() const {
+    return total;
+}
+
+double ScoreHistogram::mean() const {
+    return total == 0 ? 0 : sum / total;
+}
+
+double ScoreHistogram::min() const {
+    return lowest;
+}
+
+double ScoreHistogram::max() const {
+    return highest;
+}
+
+/*
+ * Finds the bin the value falls in by the running count, and interpolates within it
+ * (the result is kept within the exact minimum and maximum)
+ */
+double ScoreHistogram::quantile(double share) const {
+    if (total == 0) {
+        error("ScoreHistogram: the quantile of an empty histogram");
+    }
+
+    const double target = std::max(0.0, std::min(share, 1.0)) * total;
+    const double width = (high - low) / bins.size();
+    long long seen = 0;
+    for (size_t bin = 0; bin < bins.size(); bin++) {
+        if (bins[bin] > 0 && seen + bins[bin] >= target) {
+            const double within = (target - seen) / bins[bin];
+            const double value = low + (bin + within) * width;
+            return std::max(lowest, std::min(value, highest));
+        }
+        seen += bins[bin];
+    }
+    return highest;
+}
+
+int ScoreHistogram::binCount() const {
+    return bins.size();
+}
+
+long long ScoreHistogram::binAt(int bin) const {
+    return bins[bin];
+}
+
+void ScoreHistogram::write(std::ostream& out) const {
+    writeDouble(out, low);
+    writeDouble(out, high);
+    writeVarint(out, bins.size());
+    writeVarint(out, total);
+    writeDouble(out, sum);
+    writeDouble(out, lowest);
+    writeDouble(out, highest);
+    for (long long count : bins) {
+        writeVarint(out, count);
+    }
+}
+
+ScoreHistogram ScoreHistogram::read(std::istream& in) {
+    const double low = readDouble(in);
+    const double high = readDouble(in);
+    const uint64_t size = readVarint(in);
+    if (size == 0 || size > (1u << 24)) {
+        error("ScoreHistogram: malformed histogram");
+    }
+
+    ScoreHistogram histogram(low, high, int(size));
+    histogram.total = readVarint(in);
+    histogram.sum = readDouble(in);
+    histogram.lowest = readDouble(in);
+    histogram.highest = readDouble(in);
+    for (long long& count : histogram.bins) {
+        count = readVarint(in);
+    }
+    return histogram;
+}
+
+uint64_t chainSeed(uint64_t seed, int chain) {
+    return streamSeed(seed, chain);
+}
+
+// Districts where the Democrats got more votes, O(districts)
+static int demDistrictsOf(const Plan& plan) {
+    int won = 0;
+    for (int district = 0; district < plan.districtCount(); district++) {
+        won += plan.districtDem(district) > plan.districtRep(district);
+    }
+    return won;
+}
+
+/*
+ * Submits every chain of the shard to a scheduler, whose callbacks encode the records, and
+ * writes the footer once every chain has finished
+ */
+long long runShard(const std::shared_ptr<const Gerrymander>& map, const ShardSpec& spec, std::ostream& out) {
+    if (spec.shard < 0 || spec.shard >= spec.shardCount || spec.totalDistricts <= 0) {
+        error("runShard: invalid shard specification");
+    }
+
+    const VotingMap& votingMap = map->votingMap();
+    votingMap.freeze();
+    int totalVotes = 0;
+    for (int index = 0; index < votingMap.size(); index++) {
+        totalVotes += votingMap.demAt(index) + votingMap.repAt(index);
+    }
+
+    out.write(SHARD_MAGIC, sizeof(SHARD_MAGIC));
+    writeVarint(out, SHARD_VERSION);
+    writeFixed64(out, mapFingerprint(votingMap));
+    writeVarint(out, votingMap.size());
+    writeVarint(out, spec.totalDistricts);
+    writeVarint(out, totalVotes);
+    writeVarint(out, spec.shard);
+
+    std::mutex outLock;
+    long long records = 0;
+    std::vector<JobHandle<EnsembleSummary>> handles;
+    {
+        EnsembleScheduler scheduler(spec.workers, spec.chunkSteps);
+        for (int chain = 0; chain < spec.chainsPerShard; chain++) {
+            EnsembleJob job;
+            job.map = map;
+            job.totalDistricts = spec.totalDistricts;
+            job.margin = spec.margin;
+            job.steps = spec.steps;
+            job.seed = chainSeed(spec.seed, spec.shard * spec.chainsPerShard + chain);
+            job.recomProbability = spec.recomProbability;
+
+            const uint64_t seed = job.seed;
+            int accepted = 0;
+            job.callback = [&, seed, accepted](int step, const EfficiencyGapScorer& state) mutable {
+                if (accepted++ % std::max(1, spec.recordEvery) != 0) {
+                    return;
+                }
+
+                std::ostringstream record;
+                writeVarint(record, RECORD_TAG);
+                writeFixed64(record, seed);
+                writeVarint(record, step);
+                writeSignedVarint(record, state.demWaste() - state.repWaste());
+                writeVarint(record, demDistrictsOf(state.plan()));
+                writeVarint(record, spec.includeAssignments);
+                if (spec.includeAssignments) {
+                    writeAssignmentRuns(record, state.plan().assignment());
+                }
+
+                const std::string bytes = record.str();
+                std::lock_guard<std::mutex> guard(outLock);
+                out.write(bytes.data(), bytes.size());
+                records++;
+            };
+            handles.push_back(scheduler.submit(job));
+        }
+
+        for (const JobHandle<EnsembleSummary>& handle : handles) {
+            if (handle.get().status != VALID_PLAN) {
+                error("runShard: a chain could not build a valid starting plan");
+            }
+        }
+    }
+
+    writeVarint(out, FOOTER_TAG);
+    writeVarint(out, records);
+    if (!out) {
+        error("runShard: failed to write the shard stream");
+    }
+    return records;
+}
+
+long long runShard(const std::string& snapshotPath, const ShardSpec& spec, std::ostream& out) {
+    std::shared_ptr<Gerrymander> map = std::make_shared<Gerrymander>();
+    map->openSnapshot(snapshotPath);
+    return runShard(std::shared_ptr<const Gerrymander>(map), spec, out);
+}
+
+EnsembleCoordinator::EnsembleCoordinator(int gapBins)
+    : gaps(-1, 1, gapBins), seats(-0.5, 0.5, 1), records(0), shards(0), fingerprint(0), districts(0) {}
+
+void EnsembleCoordinator::addShard(std::istream& in, RecordCallback callback) {
+    char magic[sizeof(SHARD_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, SHARD_MAGIC, sizeof(magic)) != 0) {
+        error("EnsembleCoordinator: not a shard stream");
+    }
+    if (readVarint(in) != SHARD_VERSION) {
+        error("EnsembleCoordinator: unsupported shard stream version");
+    }
+
+    // The header is checked before anything is sized by it
+    const uint64_t shardFingerprint = readFixed64(in);
+    const uint64_t precinctField = readVarint(in);
+    const uint64_t districtField = readVarint(in);
+    const uint64_t votesField = readVarint(in);
+    const uint64_t shardField = readVarint(in);
+    if (precinctField == 0 || precinctField > MAX_SHARD_PRECINCTS || districtField == 0
+            || districtField > Plan::UNASSIGNED || districtField > precinctField
+            || votesField > uint64_t(INT_MAX) || shardField > uint64_t(INT_MAX)) {
+        error("EnsembleCoordinator: malformed shard stream header");
+    }
+    const int precincts = int(precinctField);
+    const int shardDistricts = int(districtField);
+    const int totalVotes = int(votesField);
+    const int shard = int(shardField);
+    if (shards > 0 && (shardFingerprint != fingerprint || shardDistricts != districts)) {
+        error("EnsembleCoordinator: the shard was run over a different map or number of districts");
+    }
+    if (shardNumbers.count(shard) > 0) {
+        error("EnsembleCoordinator: shard " + std::to_string(shard) + " was already merged");
+    }
+
+    // The records are merged into histograms of their own, so that a malformed stream leaves the totals as they were
+    ScoreHistogram shardGaps(-1, 1, gaps.binCount());
+    ScoreHistogram shardSeats(-0.5, shardDistricts + 0.5, shardDistricts + 1);
+    long long shardRecords = 0;
+
+    PlanRecord record;
+    while (true) {
+        const uint64_t tag = readVarint(in);
+        if (tag == FOOTER_TAG) {
+            break;
+        }
+        if (tag != RECORD_TAG) {
+            error("EnsembleCoordinator: malformed record in shard stream");
+        }
+
+        // The fields are bounded like the header, so that nothing is truncated or clamped into a bin
+        record.chainSeed = readFixed64(in);
+        const uint64_t step = readVarint(in);
+        const int64_t wasteDifference = readSignedVarint(in);
+        const uint64_t demDistricts = readVarint(in);
+        if (step > uint64_t(INT_MAX) || wasteDifference > totalVotes || wasteDifference < -int64_t(totalVotes)
+                || demDistricts > uint64_t(shardDistricts)) {
+            error("EnsembleCoordinator: malformed record in shard stream");
+        }
+        record.step = int(step);
+        record.wasteDifference = int(wasteDifference);
+        record.demDistricts = int(demDistricts);
+        record.assignment.clear();
+        if (readVarint(in)) {
+            readAssignmentRuns(in, precincts, shardDistricts, record.assignment);
+        }
+
+        shardGaps.add(totalVotes == 0 ? 0 : double(record.wasteDifference) / totalVotes);
+        shardSeats.add(record.demDistricts);
+        shardRecords++;
+        if (callback) {
+            callback(shard, record);
+        }
+    }
+    if (readVarint(in) != uint64_t(shardRecords)) {
+        error("EnsembleCoordinator: the shard stream is missing records");
+    }
+
+    if (shards == 0) {
+        fingerprint = shardFingerprint;
+        districts = shardDistricts;
+        seats = shardSeats;
+    } else {
+        seats.merge(shardSeats);
+    }
+    gaps.merge(shardGaps);
+    records += shardRecords;
+    shards++;
+    shardNumbers.insert(shard);
+}
+
+void EnsembleCoordinator::merge(const EnsembleCoordinator& other) {
+    if (other.shards == 0) {
+        return;
+    }
+    for (int shard : other.shardNumbers) {
+        if (shardNumbers.count(shard) > 0) {
+            error("EnsembleCoordinator: shard " + std::to_string(shard) + " was merged by both coordinators");
+        }
+    }
+    if (shards == 0) {
+        fingerprint = other.fingerprint;
+        districts = other.districts;
+        seats = other.seats;
+    } else if (other.fingerprint != fingerprint || other.districts != districts) {
+        error("EnsembleCoordinator: can't merge coordinators of different maps or numbers of districts");
+    } else {
+        seats.merge(other.seats);
+    }
+    gaps.merge(other.gaps);
+    records += other.records;
+    shards += other.shards;
+    shardNumbers.insert(other.shardNumbers.begin(), other.shardNumbers.end());
+}
+
+const ScoreHistogram& EnsembleCoordinator::efficiencyGaps() const {
+    return gaps;
+}
+
+const ScoreHistogram& EnsembleCoordinator::demDistricts() const {
+    return seats;
+}
+
+long long EnsembleCoordinator::recordCount() const {
+    return records;
+}
+
+int EnsembleCoordinator::shardCount() const {
+    return shards;
+}
+
+
+/************** TESTS **************/
+
+// Every other column votes Democrat (by 3 to 1), on a map that the jobs share
+static std::shared_ptr<Gerrymander> stripedGrid(int size) {
+    std::shared_ptr<Gerrymander> map = std::make_shared<Gerrymander>();
+    addGridMap(*map, size, size, [](int id) { return landslide(id % 2 == 0); });
+    return map;
+}
+
+STUDENT_TEST("Encoding varints") {
+    std::stringstream stream;
+    const std::vector<int64_t> values = {0, 1, -1, 127, 128, -300, 1LL << 40, INT64_MIN, INT64_MAX};
+    for (int64_t value : values) {
+        writeSignedVarint(stream, value);
+    }
+    writeVarint(stream, UINT64_MAX);
+    writeFixed64(stream, 0x0123456789ABCDEFULL);
+
+    for (int64_t value : values) {
+        EXPECT_EQUAL(readSignedVarint(stream), value);
+    }
+    EXPECT_EQUAL(readVarint(stream), UINT64_MAX);
+    EXPECT_EQUAL(readFixed64(stream), 0x0123456789ABCDEFULL);
+    EXPECT_ERROR(readVarint(stream));
+
+    // Small values take a single byte
+    std::ostringstream small;
+    writeVarint(small, 127);
+    writeSignedVarint(small, -64);
+    EXPECT_EQUAL(small.str().size(), 2u);
+}
+
+STUDENT_TEST("Merging score histograms") {
+    ScoreHistogram all(0, 1, 100);
+    ScoreHistogram first(0, 1, 100);
+    ScoreHistogram second(0, 1, 100);
+    for (int i = 0; i < 1000; i++) {
+        double value = (i % 997) / 1000.0;
+        all.add(value);
+        (i % 3 == 0 ? first : second).add(value);
+    }
+
+    first.merge(second);
+    EXPECT_EQUAL(first.count(), all.count());
+    for (int bin = 0; bin < all.binCount(); bin++) {
+        EXPECT_EQUAL(first.binAt(bin), all.binAt(bin));
+    }
+    EXPECT_EQUAL(first.min(), all.min());
+    EXPECT_EQUAL(first.max(), all.max());
+    EXPECT(std::abs(first.mean() - all.mean()) < 1e-12);
+
+    // The quantiles are within a bin of the true ones
+    EXPECT(std::abs(all.quantile(0.5) - 0.5) <= 0.01);
+    EXPECT(std::abs(all.quantile(0.9) - 0.9) <= 0.01);
+    EXPECT_EQUAL(all.quantile(0), all.min());
+    EXPECT_EQUAL(all.quantile(1), all.max());
+
+    std::stringstream stream;
+    all.write(stream);
+    ScoreHistogram copy = ScoreHistogram::read(stream);
+    EXPECT_EQUAL(copy.count(), all.count());
+    EXPECT_EQUAL(copy.quantile(0.25), all.quantile(0.25));
+
+    EXPECT_ERROR(all.merge(ScoreHistogram(0, 1, 50)));
+    EXPECT_ERROR(ScoreHistogram(0, 1, 10).quantile(0.5));
+}
+
+STUDENT_TEST("Running shards and merging them on a coordinator") {
+    std::shared_ptr<Gerrymander> map = stripedGrid(10);
+
+    ShardSpec spec;
+    spec.seed = 21;
+    spec.shardCount = 2;
+    spec.chainsPerShard = 2;
+    spec.steps = 400;
+    spec.totalDistricts = 4;
+    spec.includeAssignments = true;
+    spec.workers = 2;
+    spec.chunkSteps = 100;
+
+    std::stringstream streams[2];
+    long long written = 0;
+    for (int shard = 0; shard < 2; shard++) {
+        spec.shard = shard;
+        written += runShard(map, spec, streams[shard]);
+    }
+    EXPECT(written > 0);
+
+    // Every record checks out against its assignment
+    EnsembleCoordinator coordinator;
+    Set<uint64_t> seeds;
+    bool recordsMatch = true;
+    for (int shard = 0; shard < 2; shard++) {
+        coordinator.addShard(streams[shard], [&](int from, const PlanRecord& record) {
+            seeds.add(record.chainSeed);
+            Plan plan(map->votingMap(), 4);
+            for (int index = 0; index < int(record.assignment.size()); index++) {
+                plan.assign(index, record.assignment[index]);
+            }
+            EfficiencyGapScorer scorer(plan);
+            recordsMatch = recordsMatch && from == shard && map->isValidPlan(plan, 0.2)
+                           && scorer.demWaste() - scorer.repWaste() == record.wasteDifference
+                           && demDistrictsOf(plan) == record.demDistricts;
+        });
+    }
+    EXPECT(recordsMatch);
+    EXPECT_EQUAL(seeds.size(), 4);
+    EXPECT_EQUAL(coordinator.recordCount(), written);
+    EXPECT_EQUAL(coordinator.shardCount(), 2);
+    EXPECT_EQUAL(coordinator.efficiencyGaps().count(), written);
+    EXPECT_EQUAL(coordinator.demDistricts().binCount(), 5);
+
+    // A shard reruns to the same records anywhere (their order depends on the threads)
+    spec.shard = 1;
+    spec.workers = 1;
+    std::stringstream again;
+    runShard(map, spec, again);
+    std::stringstream original(streams[1].str());
+    EnsembleCoordinator rerun;
+    EnsembleCoordinator once;
+    rerun.addShard(again);
+    once.addShard(original);
+    EXPECT_EQUAL(rerun.recordCount(), once.recordCount());
+    bool sameBins = true;
+    for (int bin = 0; bin < once.efficiencyGaps().binCount(); bin++) {
+        sameBins = sameBins && rerun.efficiencyGaps().binAt(bin) == once.efficiencyGaps().binAt(bin);
+    }
+    EXPECT(sameBins);
+
+    // Coordinators of parts of the cluster merge into the same totals
+    std::stringstream first(streams[0].str());
+    std::stringstream second(streams[1].str());
+    EnsembleCoordinator left;
+    EnsembleCoordinator right;
+    left.addShard(first);
+    right.addShard(second);
+    left.merge(right);
+    EXPECT_EQUAL(left.recordCount(), coordinator.recordCount());
+    EXPECT_EQUAL(left.efficiencyGaps().quantile(0.5), coordinator.efficiencyGaps().quantile(0.5));
+
+    // Truncated streams, and shards of another map, are turned down
+    std::stringstream truncated(streams[0].str().substr(0, streams[0].str().size() - 3));
+    EXPECT_ERROR(EnsembleCoordinator().addShard(truncated));
+
+    std::stringstream other;
+    ShardSpec otherSpec = spec;
+    otherSpec.includeAssignments = false;
+    runShard(stripedGrid(8), otherSpec, other);
+    EXPECT_ERROR(coordinator.addShard(other));
+    EXPECT_EQUAL(coordinator.shardCount(), 2);
+}
+
+/*
+ * A shard stream header with the given fields, written by hand
+ */
+static std::string shardHeader(uint64_t precincts, uint64_t districts, uint64_t totalVotes, uint64_t shard = 0) {
+    std::ostringstream out;
+    out.write(SHARD_MAGIC, sizeof(SHARD_MAGIC));
+    writeVarint(out, SHARD_VERSION);
+    writeFixed64(out, 42);
+    writeVarint(out, precincts);
+    writeVarint(out, districts);
+    writeVarint(out, totalVotes);
+    writeVarint(out, shard);
+    return out.str();
+}
+
+STUDENT_TEST("Turning down malformed shard headers and records") {
+    std::ostringstream footer;
+    writeVarint(footer, FOOTER_TAG);
+    writeVarint(footer, 0);
+
+    std::stringstream empty(shardHeader(100, 4, 1000) + footer.str());
+    EnsembleCoordinator coordinator;
+    coordinator.addShard(empty);
+    EXPECT_EQUAL(coordinator.recordCount(), 0);
+    EXPECT_EQUAL(coordinator.demDistricts().binCount(), 5);
+
+    // Sizes that would be allocated, or don't fit in an int
+    for (const std::string& header : {shardHeader(100, uint64_t(1) << 40, 1000), shardHeader(uint64_t(1) << 40, 4, 1000),
+                                      shardHeader(100, 0, 1000), shardHeader(3, 4, 1000), shardHeader(100, 4, uint64_t(1) << 33)}) {
+        std::stringstream stream(header + footer.str());
+        EXPECT_ERROR(EnsembleCoordinator().addShard(stream));
+    }
+
+    // A record that wins more districts than there are, wastes more votes than were cast, or has a step past INT_MAX
+    auto record = [&](uint64_t step, int64_t wasteDifference, uint64_t demDistricts) {
+        std::ostringstream out;
+        writeVarint(out, RECORD_TAG);
+        writeFixed64(out, 7);
+        writeVarint(out, step);
+        writeSignedVarint(out, wasteDifference);
+        writeVarint(out, demDistricts);
+        writeVarint(out, 0);
+        writeVarint(out, FOOTER_TAG);
+        writeVarint(out, 1);
+        return out.str();
+    };
+    for (const std::string& bad : {record(0, 10, 5), record(0, 1001, 2), record(0, -1001, 2), record(uint64_t(INT_MAX) + 1, 10, 2)}) {
+        std::stringstream stream(shardHeader(100, 4, 1000, 1) + bad);
+        EXPECT_ERROR(coordinator.addShard(stream));
+    }
+    EXPECT_EQUAL(coordinator.shardCount(), 1);
+
+    std::stringstream edge(shardHeader(100, 4, 1000, 1) + record(0, -1000, 2));
+    coordinator.addShard(edge);
+    EXPECT_EQUAL(coordinator.recordCount(), 1);
+    EXPECT_EQUAL(coordinator.efficiencyGaps().min(), -1);
+}
+
+STUDENT_TEST("Turning down shards that were already merged") {
+    std::ostringstream footer;
+    writeVarint(footer, FOOTER_TAG);
+    writeVarint(footer, 0);
+
+    EnsembleCoordinator left;
+    EnsembleCoordinator right;
+    for (int shard : {0, 1}) {
+        std::stringstream stream(shardHeader(100, 4, 1000, shard) + footer.str());
+        left.addShard(stream);
+    }
+
+    // A retried node sends the same shard again
+    std::stringstream retried(shardHeader(100, 4, 1000, 1) + footer.str());
+    EXPECT_ERROR(left.addShard(retried));
+    EXPECT_EQUAL(left.shardCount(), 2);
+
+    std::stringstream overlapping(shardHeader(100, 4, 1000, 0) + footer.str());
+    right.addShard(overlapping);
+    EXPECT_ERROR(left.merge(right));
+    EXPECT_EQUAL(left.shardCount(), 2);
+
+    EnsembleCoordinator disjoint;
+    std::stringstream third(shardHeader(100, 4, 1000, 2) + footer.str());
+    disjoint.addShard(third);
+    left.merge(disjoint);
+    EXPECT_EQUAL(left.shardCount(), 3);
+    std::stringstream again(shardHeader(100, 4, 1000, 2) + footer.str());
+    EXPECT_ERROR(left.addShard(again));
+}
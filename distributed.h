@@ -0,0 +1,164 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the distributed ensemble mode, where every node
+ * of a cluster runs its own shard of the chains, and a coordinator
+ * merges what they found.
+ *
+ * Node => opens the same VotingMap snapshot as every other node (which
+ *          is memory mapped, see "votingmap.h"), runs its chains on an
+ *          EnsembleScheduler, and streams a record of every accepted
+ *          plan to an output stream (e.g. a socket or a pipe)
+ * Coordinator => reads the stream of every node, checks that they ran
+ *          over the same map, and merges the records into histograms
+ *
+ * The chains are seeded by their index across the whole cluster, so
+ * they are independent, and a shard can be rerun anywhere with the same
+ * result. The histograms have fixed bins, so merging them is exact
+ * (and in any order); quantiles are read from them to within a bin.
+ *
+ * The layout of a shard stream (version 1, see "codec.h" for the encodings) is:
+ *
+ * header => magic "GMSHARD1", version, fingerprint of the map (fixed 64-bit),
+ *          precincts, districts, total votes, shard
+ * record => tag 1, chain seed (fixed 64-bit), step, demWaste - repWaste (zigzag),
+ *          districts won by the Democrats, then 0, or 1 and the assignment as runs
+ *          of (district, length) over the dense indices
+ * footer => tag 0, number of records
+ */
+
+#pragma once
+
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gerrymander.h"
+
+/* A histogram with a fixed number of equal bins between low and high (values outside
+ * are counted in the first or last bin), which also keeps the exact count, sum, minimum
+ * and maximum. Histograms with the same bins can be merged.
+ */
+class ScoreHistogram
+{
+public:
+    ScoreHistogram(double low, double high, int bins);
+
+    void add(double value);
+    // Adds every value of another histogram, which must have the same bins
+    void merge(const ScoreHistogram& other);
+
+    long long count() const;
+    double mean() const;
+    double min() const;
+    double max() const;
+    // Returns the value below which the given share of the values lie (to within a bin), O(bins)
+    double quantile(double share) const;
+
+    int binCount() const;
+    long long binAt(int bin) const;
+
+    // Writes / reads the histogram (its bins and totals) to / from a binary stream
+    void write(std::ostream& out) const;
+    static ScoreHistogram read(std::istream& in);
+
+private:
+    double low;
+    double high;
+    std::vector<long long> bins;
+    long long total;
+    double sum;
+    double lowest;
+    double highest;
+
+    int binOf(double value) const;
+};
+
+// A single accepted plan of a shard
+struct PlanRecord {
+    uint64_t chainSeed;
+    int step;
+    // demWaste - repWaste, so the signed Efficiency Gap is wasteDifference / total votes
+    int wasteDifference;
+    int demDistricts;
+    // dense index => district (empty unless the shard includes the assignments)
+    std::vector<uint16_t> assignment;
+};
+
+// The share of the chains a node runs
+struct ShardSpec {
+    // The seed of the whole ensemble
+    uint64_t seed = 1;
+    // The shard the node runs, out of shardCount
+    int shard = 0;
+    int shardCount = 1;
+    // The chains of every shard, and the steps of every chain
+    int chainsPerShard = 1;
+    int steps = 1000;
+    int totalDistricts = 0;
+    double margin = 0.2;
+    double recomProbability = 0.5;
+    // Only every recordEvery-th accepted plan of a chain is recorded
+    int recordEvery = 1;
+    // Whether the records carry the assignment of the plan (which makes them much larger)
+    bool includeAssignments = false;
+    // The threads of the node (0 => one per core), and the steps of each chunk (see "EnsembleScheduler")
+    int workers = 0;
+    int chunkSteps = 1000;
+};
+
+// Returns the seed of a chain, given its index across every shard
+uint64_t chainSeed(uint64_t seed, int chain);
+
+/* Runs the chains of a shard over the map, and writes the stream of the shard to out.
+ * Returns how many records were written. Throws an error if a chain could not start.
+ */
+long long runShard(const std::shared_ptr<const Gerrymander>& map, const ShardSpec& spec, std::ostream& out);
+// The same, over the map of a snapshot (see "Gerrymander::openSnapshot(string)")
+long long runShard(const std::string& snapshotPath, const ShardSpec& spec, std::ostream& out);
+
+class EnsembleCoordinator
+{
+public:
+    // Called for every record merged, with the shard it came from
+    typedef std::function<void(int shard, const PlanRecord& record)> RecordCallback;
+
+    // Creates a coordinator whose Efficiency Gap histogram has the given bins
+    explicit EnsembleCoordinator(int gapBins = 2000);
+
+    /* Reads the stream of a shard, merging its records into the histograms. Throws an error if
+     * the stream is malformed or truncated, if it was run over a different map than the others,
+     * or if its shard was already merged.
+     */
+    void addShard(std::istream& in, RecordCallback callback = nullptr);
+    // Merges everything another coordinator has merged (e.g. of another part of the cluster), which can't share a shard
+    void merge(const EnsembleCoordinator& other);
+
+    // The signed Efficiency Gap of every record, in [-1, 1]
+    const ScoreHistogram& efficiencyGaps() const;
+    // The districts won by the Democrats in every record
+    const ScoreHistogram& demDistricts() const;
+    long long recordCount() const;
+    int shardCount() const;
+
+private:
+    ScoreHistogram gaps;
+    // One bin per number of districts (replaced by the first shard, once the number is known)
+    ScoreHistogram seats;
+    long long records;
+    int shards;
+    // The shard numbers merged so far (a shard merged twice would count its records twice)
+    std::set<int> shardNumbers;
+    // The map of the first shard (0 before it)
+    uint64_t fingerprint;
+    int districts;
+};
+
+#endif // DISTRIBUTED_H
@@ -0,0 +1,393 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the EnsembleSampler class.
+ *
+ * Both proposals only touch the districts that change, and the
+ * score of the plan is updated through the EfficiencyGapScorer,
+ * so a step costs about as much as the districts it changes.
+ */
+
+#include "ensemble.h"
+
+#include "contiguity.h"
+#include "error.h"
+#include "gerrymander.h"
+#include "metrics.h"
+#include "testing/SimpleTest.h"
+#include "testmaps.h"
+
+// How many spanning trees ReCom draws before it gives up on a pair of districts
+const int RECOM_TREE_TRIES = 10;
+
+/*
+ * Creates a chain with a seed drawn from "random.h"
+ */
+EnsembleSampler::EnsembleSampler(const Plan& start, double margin)
+    : EnsembleSampler(start, margin, freshSeed()) {}
+
+/*
+ * Creates a chain from the given plan, which must already assign every precinct, have
+ * every district within the population bounds, and every district continuous (ReCom
+ * spans the merged area of 2 districts with a tree, which needs it to be connected)
+ */
+EnsembleSampler::EnsembleSampler(const Plan& start, double margin, uint64_t seed)
+    : scorer(start), boundary(start), rng(seed) {
+    const VotingMap& map = start.votingMap();
+    if (start.districtCount() == 0 || start.unassignedCount() > 0) {
+        error("EnsembleSampler: the starting plan does not assign every precinct");
+    }
+
+    const int mean = map.totalPop() / start.districtCount();
+    minPop = mean * (1 - margin);
+    maxPop = mean * (1 + margin);
+    for (int district = 0; district < start.districtCount(); district++) {
+        if (!withinBounds(start.districtPop(district))) {
+            error("EnsembleSampler: the starting plan is not within the population margin");
+        }
+    }
+    if (!isContinuousPlan(start)) {     // O(V + E)
+        error("EnsembleSampler: the starting plan has a district that is not continuous");
+    }
+
+    recomProbability = 0.5;
+    accepted = 0;
+    rejected = 0;
+    local.assign(map.size(), -1);
+}
+
+void EnsembleSampler::setRecomProbability(double probability) {
+    recomProbability = probability;
+}
+
+/*
+ * Runs the chain, choosing between a ReCom and a Flip proposal at random every step.
+ * Rejected proposals leave the plan as it was (and aren't reported).
+ */
+int EnsembleSampler::run(int steps, PlanCallback callback) {
+    int acceptedHere = 0;
+    for (int step = 0; step < steps; step++) {
+        bool success = rng.nextChance(recomProbability) ? recomStep() : flipStep();
+        if (success) {
+            acceptedHere++;
+            if (callback) {
+                callback(step, scorer);
+            }
+        }
+    }
+    return acceptedHere;
+}
+
+/*
+ * Flip: moves a random border precinct into the neighboring district, as long as
+ * both districts stay within the bounds, and the district it leaves stays continuous.
+ */
+bool EnsembleSampler::flipStep() {
+    const Plan& cur = scorer.plan();
+    int precinct;
+    int neighbor;
+    if (!boundary.randomCutEdge(rng, precinct, neighbor)) {     // O(1)
+        rejected++;
+        return false;
+    }
+
+    const int from = cur.districtOf(precinct);
+    const int to = cur.districtOf(neighbor);
+    const int pop = cur.votingMap().popAt(precinct);
+    if (!withinBounds(cur.districtPop(from) - pop) || !withinBounds(cur.districtPop(to) + pop)
+            || !staysContinuousLocal(cur, precinct)) {     // O(degree) for most precincts
+        rejected++;
+        return false;
+    }
+
+    scorer.applyMove(precinct, from, to);       // O(1)
+    boundary.applyMove(precinct, from, to);     // O(degree)
+    accepted++;
+    return true;
+}
+
+/*
+ * ReCom: merges the 2 districts on either side of a random border, draws a random
+ * spanning tree of the merged area (Kruskal's algorithm over randomly ordered edges),
+ * and splits it along a random tree edge that leaves both halves within the bounds.
+ *
+ * Both halves of a spanning tree are connected, so both new districts are continuous.
+ * The merged area is found by a search from the border, so a step costs about as much
+ * as the 2 districts, and every buffer is a member that keeps its capacity.
+ */
+bool EnsembleSampler::recomStep() {
+    const Plan& cur = scorer.plan();
+    const VotingMap& map = cur.votingMap();
+    int precinct;
+    int neighbor;
+    if (!boundary.randomCutEdge(rng, precinct, neighbor)) {     // O(1)
+        rejected++;
+        return false;
+    }
+
+    const int first = cur.districtOf(precinct);
+    const int second = cur.districtOf(neighbor);
+    const int mergedPop = cur.districtPop(first) + cur.districtPop(second);
+
+    // Collects the merged area (BFS from the border), and every edge within it once
+    members.clear();
+    edges.clear();
+    local[precinct] = 0;
+    members.push_back(precinct);
+    for (size_t head = 0; head < members.size(); head++) {     // O(size of both districts + their edges)
+        for (int next : map.neighborsOf(members[head])) {
+            const int district = cur.districtOf(next);
+            if (district != first && district != second) {
+                continue;
+            }
+            if (local[next] == -1) {
+                local[next] = members.size();
+                members.push_back(next);
+            }
+            if (local[next] > int(head)) {
+                edges.push_back({int(head), local[next]});
+            }
+        }
+    }
+
+    const int size = members.size();
+    // The search only misses precincts of an area that isn't connected, which has no spanning tree
+    bool success = false;
+    bool connected = size == cur.districtSize(first) + cur.districtSize(second);
+    for (int attempt = 0; attempt < RECOM_TREE_TRIES && connected && !success; attempt++) {
+        // Random spanning tree => Kruskal's algorithm over a shuffled edge list
+        for (int i = edges.size() - 1; i > 0; i--) {
+            std::swap(edges[i], edges[rng.nextInt(0, i)]);
+        }
+
+        parent.resize(size);
+        for (int i = 0; i < size; i++) {
+            parent[i] = i;
+        }
+        auto find = [this](int x) {
+            while (parent[x] != x) {
+                parent[x] = parent[parent[x]];
+                x = parent[x];
+            }
+            return x;
+        };
+
+        treeEdges.clear();
+        for (const std::pair<int, int>& edge : edges) {
+            int a = find(edge.first);
+            int b = find(edge.second);
+            if (a != b) {
+                parent[a] = b;
+                treeEdges.push_back(edge);
+            }
+        }
+
+        // The tree in compressed-sparse-row form (counted, then filled in place)
+        treeOffsets.assign(size + 1, 0);
+        for (const std::pair<int, int>& edge : treeEdges) {
+            treeOffsets[edge.first + 1]++;
+            treeOffsets[edge.second + 1]++;
+        }
+        for (int i = 0; i < size; i++) {
+            treeOffsets[i + 1] += treeOffsets[i];
+        }
+        treeFill.assign(treeOffsets.begin(), treeOffsets.end() - 1);
+        treeNeighbors.resize(2 * treeEdges.size());
+        for (const std::pair<int, int>& edge : treeEdges) {
+            treeNeighbors[treeFill[edge.first]++] = edge.second;
+            treeNeighbors[treeFill[edge.second]++] = edge.first;
+        }
+
+        // Roots the tree (BFS order), then sums the population of every subtree
+        order.clear();
+        order.push_back(0);
+        up.assign(size, -1);
+        up[0] = 0;
+        for (size_t head = 0; head < order.size(); head++) {
+            for (int i = treeOffsets[order[head]]; i < treeOffsets[order[head] + 1]; i++) {
+                const int next = treeNeighbors[i];
+                if (up[next] == -1) {
+                    up[next] = order[head];
+                    order.push_back(next);
+                }
+            }
+        }
+
+        // A merged area that isn't connected has no spanning tree
+        if (int(order.size()) != size) {
+            break;
+        }
+
+        subtreePop.assign(size, 0);
+        for (int i = size - 1; i >= 0; i--) {
+            int node = order[i];
+            subtreePop[node] += map.popAt(members[node]);
+            if (i > 0) {
+                subtreePop[up[node]] += subtreePop[node];
+            }
+        }
+
+        // Every edge (node => parent) that can be cut into 2 valid districts
+        cutNodes.clear();
+        for (int i = 1; i < size; i++) {
+            int node = order[i];
+            if (withinBounds(subtreePop[node]) && withinBounds(mergedPop - subtreePop[node])) {
+                cutNodes.push_back(node);
+            }
+        }
+
+        if (cutNodes.empty()) {
+            continue;
+        }
+
+        // The subtree of the cut becomes the first district, the rest the second
+        int cut = cutNodes[rng.nextInt(0, cutNodes.size() - 1)];
+        inSubtree.assign(size, false);
+        inSubtree[cut] = true;
+        for (int i = 1; i < size; i++) {
+            int node = order[i];
+            inSubtree[node] = inSubtree[node] || inSubtree[up[node]];
+        }
+
+        for (int i = 0; i < size; i++) {
+            int to = inSubtree[i] ? first : second;
+            int from = cur.districtOf(members[i]);
+            if (from != to) {
+                scorer.applyMove(members[i], from, to);
+                boundary.applyMove(members[i], from, to);
+            }
+        }
+        success = true;
+    }
+
+    for (int index : members) {
+        local[index] = -1;
+    }
+
+    success ? accepted++ : rejected++;
+    return success;
+}
+
+const Plan& EnsembleSampler::plan() const {
+    return scorer.plan();
+}
+
+const EfficiencyGapScorer& EnsembleSampler::state() const {
+    return scorer;
+}
+
+const BoundaryIndex& EnsembleSampler::boundaryIndex() const {
+    return boundary;
+}
+
+uint64_t EnsembleSampler::seed() const {
+    return rng.seed();
+}
+
+int EnsembleSampler::acceptedCount() const {
+    return accepted;
+}
+
+int EnsembleSampler::rejectedCount() const {
+    return rejected;
+}
+
+bool EnsembleSampler::withinBounds(int districtPop) const {
+    return districtPop <= maxPop && districtPop >= minPop;
+}
+
+
+/************** TESTS **************/
+
+// 10x5 grid where the 2 left columns vote Democrat
+static void addDefaultGrid(Gerrymander& map) {
+    addGridMap(map, 5, 10, [](int id) { return oneVote(id % 5 < 2); });
+}
+
+STUDENT_TEST("Every plan of the chain is valid and scored correctly") {
+    Gerrymander map;
+    addDefaultGrid(map);
+
+    Plan start = map.randomPlan(5);
+    for (double recom : {0.0, 0.5, 1.0}) {
+        EnsembleSampler sampler(start, 0.2);
+        sampler.setRecomProbability(recom);
+
+        int reported = 0;
+        bool allValid = true;
+        bool allScored = true;
+        bool allBordersKept = true;
+        int accepted = sampler.run(200, [&](int, const EfficiencyGapScorer& state) {
+            reported++;
+            allValid = allValid && map.isValidPlan(state.plan(), 0.2);
+            allScored = allScored && state.score() == map.howGerrymandered(state.plan());
+            allBordersKept = allBordersKept && sampler.boundaryIndex().cutEdgeCount() == tallyPlan(state.plan()).cutEdges;
+        });
+
+        EXPECT(accepted > 0);
+        EXPECT_EQUAL(reported, accepted);
+        EXPECT_EQUAL(sampler.acceptedCount() + sampler.rejectedCount(), 200);
+        EXPECT(allValid);
+        EXPECT(allScored);
+        EXPECT(allBordersKept);
+    }
+}
+
+STUDENT_TEST("Chains with the same seed are the same") {
+    Gerrymander map;
+    addDefaultGrid(map);
+
+    Rng rng(5);
+    Plan start = map.randomPlan(5, rng);
+    EnsembleSampler first(start, 0.2, 11);
+    EnsembleSampler second(start, 0.2, 11);
+
+    Vector<int> firstScores;
+    Vector<int> secondScores;
+    first.run(100, [&](int step, const EfficiencyGapScorer& state) {
+        firstScores.add(step * 1000 + state.score());
+    });
+    second.run(100, [&](int step, const EfficiencyGapScorer& state) {
+        secondScores.add(step * 1000 + state.score());
+    });
+
+    EXPECT_EQUAL(firstScores, secondScores);
+    EXPECT(first.plan() == second.plan());
+    EXPECT_EQUAL(first.seed(), 11);
+}
+
+STUDENT_TEST("The chain only starts from valid plans") {
+    Gerrymander map;
+    addDefaultGrid(map);
+
+    Plan lopsided(map.votingMap(), 2);
+    for (int index = 0; index < 50; index++) {
+        lopsided.assign(index, index < 10 ? 0 : 1);
+    }
+    EXPECT_ERROR(EnsembleSampler(lopsided, 0.2));
+    EXPECT_ERROR(EnsembleSampler(Plan(map.votingMap(), 2), 0.2));
+
+    // Balanced, but the first district is split in 2 corners
+    Plan split(map.votingMap(), 2);
+    for (int index = 0; index < 50; index++) {
+        split.assign(index, (index < 13 || index >= 37) ? 0 : 1);
+    }
+    EXPECT_EQUAL(split.districtPop(0), 26);
+    EXPECT_ERROR(EnsembleSampler(split, 0.2));
+}
+
+STUDENT_TEST("Sampling a map with borders listed by only one precinct (Vaguely based off of a small area in TX)") {
+    // 50005 and 50006 list 50002, which doesn't list them back
+    Gerrymander map;
+    map.addArea(new Area(50001, 121, 162, 636, {50002, 50007}));
+    map.addArea(new Area(50002, 1011, 351, 2837, {50001, 50003, 50004}));
+    map.addArea(new Area(50003, 234, 1141, 2527, {50002, 50005}));
+    map.addArea(new Area(50004, 366, 452, 1223, {50002, 50005}));
+    map.addArea(new Area(50005, 468, 611, 2168, {50002, 50004, 50003, 50006}));
+    map.addArea(new Area(50006, 51, 275, 619, {50002, 50005, 50007}));
+    map.addArea(new Area(50007, 121, 909, 2918, {50001, 50006}));
+
+    Rng rng(4);
+    EnsembleSampler sampler(map.randomPlan(2, rng), 0.2, 5);
+    sampler.run(500, nullptr);
+    EXPECT(map.isValidPlan(sampler.plan(), 0.2));
+}
@@ -0,0 +1,113 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the EnsembleSampler class, which samples
+ * valid plans with a Markov chain instead of generating independent
+ * random plans.
+ *
+ * Starting from a valid plan, every step of the chain proposes a
+ * change that keeps the plan valid:
+ *
+ * Flip => a single precinct on the border of 2 districts moves into
+ *          the other district
+ * ReCom => 2 adjacent districts are merged, a random spanning tree of
+ *          the merged area is drawn, and it is cut into 2 new districts
+ *          of similar population (spanning-tree recombination)
+ *
+ * Every accepted plan is handed to a callback as it is made (along with
+ * its incrementally updated score), so that huge ensembles can be
+ * generated without ever holding them in memory.
+ */
+
+#pragma once
+
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "boundary.h"
+#include "plan.h"
+#include "rng.h"
+#include "scorer.h"
+
+class EnsembleSampler
+{
+public:
+    // Called for every accepted plan, with the step number and the state of the chain
+    typedef std::function<void(int step, const EfficiencyGapScorer& state)> PlanCallback;
+
+    /* Creates a chain starting from a valid plan, whose districts must stay within margin of
+     * the mean population, and whose proposals are drawn from a generator with the given seed
+     */
+    EnsembleSampler(const Plan& start, double margin);
+    EnsembleSampler(const Plan& start, double margin, uint64_t seed);
+
+    // Sets how likely every step is to be a ReCom (rather than a Flip) proposal, 0.5 by default
+    void setRecomProbability(double probability);
+
+    // Runs the chain for a number of steps, streaming every accepted plan, and returns how many were accepted
+    int run(int steps, PlanCallback callback);
+
+    // Runs a single proposal of each kind, and returns whether it was accepted
+    bool flipStep();
+    bool recomStep();
+
+    // Returns the current plan and its score
+    const Plan& plan() const;
+    const EfficiencyGapScorer& state() const;
+    // Returns the borders of the current plan (and how many there are, a measure of compactness)
+    const BoundaryIndex& boundaryIndex() const;
+    // Returns the seed of the chain (the same seed and start always produce the same chain)
+    uint64_t seed() const;
+    // Returns the number of proposals accepted/rejected so far
+    int acceptedCount() const;
+    int rejectedCount() const;
+
+private:
+    // The current plan, which keeps the Efficiency Gap up to date
+    EfficiencyGapScorer scorer;
+    // The borders between the districts of the current plan, which the proposals are drawn from
+    BoundaryIndex boundary;
+    // Draws every random choice of the chain
+    Rng rng;
+    // The population bounds of every district
+    double minPop;
+    double maxPop;
+    double recomProbability;
+    int accepted;
+    int rejected;
+
+    /* Scratch space for ReCom, reused across steps (the vectors keep their capacity, so
+     * a step doesn't allocate once the chain has seen its largest merged area)
+     *
+     * local => position of a precinct in the merged area (-1 if it is outside of it)
+     * members => position => dense index of every precinct in the merged area
+     * edges => the edges within the merged area (as positions), and the ones in the spanning tree
+     * parent => the union-find forest of Kruskal's algorithm
+     * treeOffsets, treeNeighbors => the spanning tree in compressed-sparse-row form (treeFill fills it in)
+     * order, up => the tree rooted at position 0 (BFS order, and the parent of every position)
+     * subtreePop => the population of the subtree below every position
+     * cutNodes => the positions whose edge to their parent can be cut
+     * inSubtree => whether a position is below the chosen cut
+     */
+    std::vector<int> local;
+    std::vector<int> members;
+    std::vector<std::pair<int, int>> edges;
+    std::vector<std::pair<int, int>> treeEdges;
+    std::vector<int> parent;
+    std::vector<int> treeOffsets;
+    std::vector<int> treeNeighbors;
+    std::vector<int> treeFill;
+    std::vector<int> order;
+    std::vector<int> up;
+    std::vector<int> subtreePop;
+    std::vector<int> cutNodes;
+    std::vector<char> inSubtree;
+
+    // Returns whether a district population is within the bounds
+    bool withinBounds(int districtPop) const;
+};
+
+#endif // ENSEMBLE_H
@@ -15,10 +15,22 @@
 
 #include "gerrymander.h"
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "contiguity.h"
+#include "partition.h"
 #include "random.h"
 #include "testing/SimpleTest.h"
+#include "testmaps.h"
 
 #include <cstdlib>
 
@@ -28,81 +40,205 @@
 const double POPULATION_MARGIN = 0.2;
 // Varibale that denotes that the method can not run properly for some given reason
 const int NONE = -1;
+// The fewest precincts a plan needs for "isValidPlanParallel" to use threads (below it, starting them costs more than the search)
+const int PARALLEL_VALIDATION_SIZE = 20000;
 
 // Default constructor
 Gerrymander::Gerrymander() {}
 
 // Calls the same function on its VotingMap
+void Gerrymander::addArea(Area newArea) {
+    map.addArea(std::move(newArea));
+}
+
+// Calls the same function on its VotingMap (which deletes newArea)
 void Gerrymander::addArea(Area* newArea) {
     map.addArea(newArea);
 }
 
 // Adds an Area by explicitly inputing its variables
 void Gerrymander::addArea(int id, int dem, int rep, int pop, Set<int> adjacency) {
-    Area* loc = new Area(id, dem, rep, pop, adjacency);
-    addArea(loc);
+    addArea(Area(id, dem, rep, pop, std::move(adjacency)));
+}
+
+// Calls the same function on its VotingMap (and forgets the plans cached over the old one)
+void Gerrymander::loadFromFiles(const std::string& demographicsPath, const std::string& adjacencyPath) {
+    map.loadFromFiles(demographicsPath, adjacencyPath);
+    cache.clear();
+}
+
+// Calls the same function on its VotingMap (and forgets the plans cached over the old one)
+void Gerrymander::loadFromStreams(std::istream& demographics, std::istream& adjacency) {
+    map.loadFromStreams(demographics, adjacency);
+    cache.clear();
+}
+
+// Calls the same function on its VotingMap
+void Gerrymander::saveSnapshot(const std::string& path) const {
+    map.saveSnapshot(path);
+}
+
+// Calls the same function on its VotingMap (and forgets the plans cached over the old one)
+void Gerrymander::openSnapshot(const std::string& path) {
+    map.openSnapshot(path);
+    cache.clear();
 }
 
 /*
  *  This method checks whether a plan of district is valid
  *
- *  First, it checks if the district is continuous,
- *  then it checks if the population of the district as a whole
- *  is within the mean population plus-minus margin
+ *  The districts are converted into a Plan (which checks that every precinct
+ *  is used exactly once), and then validated by "isValidPlan(Plan, double)"
  */
 bool Gerrymander::isValidPlan(Set<Set<int>>& districts, double margin) const {
-    Set<int> allIDs = map.precinctSet();
-    const int mean = map.totalPop() / districts.size();
+    return isValidPlan(Plan::fromDistricts(map, districts), margin);
+}
 
-    for (Set<int> district: districts) {    // O(n)
-        // Checks continuity
-        if (!isContinuous(district)) {  // O(n)
-            return false;
-        }
+/*
+ * Returns the remembered validity of the plan, or checks it (and remembers it)
+ */
+bool Gerrymander::isValidPlan(const Plan& plan, double margin) const {
+    bool valid = false;
+    if (!cache.findValidity(plan, margin, valid)) {
+        valid = checkPlan(plan, margin);
+        cache.storeValidity(plan, margin, valid);
+    }
+    return valid;
+}
 
-        // Aggregates population data
-        int districtPop = 0;
-        for (int precinct : district) {
-            districtPop += map.getDemographic(precinct).pop;    // O(log n)
-            allIDs.remove(precinct);                            // O(log n)
-        }
+/*
+ *  This method checks whether a plan of district is valid
+ *
+ *  The cheapest checks are made first, so that most invalid plans are turned down
+ *  before the search: first, it checks that every precinct is used once, then it checks
+ *  if the population of each district is within the mean population plus-minus margin
+ *  (which the plan keeps, so it is O(districts)), and only then it checks if the districts
+ *  are continuous (all of them in a single search)
+ */
+bool Gerrymander::checkPlan(const Plan& plan, double margin) const {
+    TRACE_SPAN("checkPlan");
+    StatTimer timer(VALIDATE_NS);
+    ThreadStats& stats = threadStats();
+    stats.add(VALIDATIONS);
+
+    int failedDistrict;
+    if (checkCoverageAndPopulation(plan, margin, failedDistrict, &stats) != NO_FAILURE) {    // O(districts)
+        return false;
+    }
 
-        if (districtPop > mean * (1 + margin) || districtPop < mean * (1 - margin)) {
-            return false;
+    // Checks continuity
+    if (!isContinuousPlan(plan)) {  // O(V + E)
+        stats.add(CONTIGUITY_REJECTIONS);
+        return false;
+    }
+    stats.add(VALID_PLANS);
+    return true;
+}
+
+/*
+ * Checks that every precinct is used once, then that every district has precincts and a
+ * population within the mean population plus-minus margin (which the plan keeps, so it
+ * doesn't look at the precincts)
+ */
+ValidationFailure Gerrymander::checkCoverageAndPopulation(const Plan& plan, double margin, int& failedDistrict, ThreadStats* stats) const {
+    failedDistrict = -1;
+    ValidationFailure failure = NO_FAILURE;
+
+    // Checks if the plan uses all precicnts (once)
+    if (plan.districtCount() == 0) {
+        failure = NO_DISTRICTS;
+    } else if (plan.unassignedCount() > 0) {
+        failure = UNASSIGNED_PRECINCTS;
+    } else if (plan.conflictCount() > 0) {
+        failure = CONFLICTING_PRECINCTS;
+    } else {
+        const int mean = map.totalPop() / plan.districtCount();
+        for (int district = 0; district < plan.districtCount() && failure == NO_FAILURE; district++) {
+            // Population data is kept up to date by the plan
+            int districtPop = plan.districtPop(district);   // O(1)
+            if (plan.districtSize(district) == 0) {
+                failure = EMPTY_DISTRICT;
+            } else if (districtPop > mean * (1 + margin) || districtPop < mean * (1 - margin)) {
+                failure = POPULATION_OUTSIDE_MARGIN;
+            }
+            if (failure != NO_FAILURE) {
+                failedDistrict = district;
+            }
         }
     }
 
-    return allIDs.isEmpty();    // Checks if the plan uses all precicnts
+    if (stats && failure != NO_FAILURE) {
+        stats->add(failure == POPULATION_OUTSIDE_MARGIN ? POPULATION_REJECTIONS : COVERAGE_REJECTIONS);
+    }
+    return failure;
 }
 
 /*
- * Helper function that returns true of the district is continuous
+ * Returns the report of "validatePlan(Plan, double)" on the districts (see "isValidPlan(Set<Set<int>>, double)")
  */
-bool Gerrymander::isContinuous(Set<int> district) const{
-    isContinuousHelper(district, district.first());
-    return district.isEmpty();
+ValidationReport Gerrymander::validatePlan(Set<Set<int>>& districts, double margin) const {
+    return validatePlan(Plan::fromDistricts(map, districts), margin);
 }
 
 /*
- * Helper function that varifies continuity by starting at an arbitrary point of
- * the district then attempting to draw a path through every connected node wihtin the
- * district (uses DFS).
- *
- * It returns true if it covered all the precicnts in the district
+ * Makes the same checks as "checkPlan(Plan, double)", in the same order, but keeps going after
+ * a failure to fill in the whole report. The validity is remembered, like "isValidPlan".
  */
-void Gerrymander::isContinuousHelper(Set<int>& district, int start) const {
-    if (!district.contains(start)) {
-        return;
+ValidationReport Gerrymander::validatePlan(const Plan& plan, double margin) const {
+    ValidationReport report{true, NO_FAILURE, -1, plan.unassignedCount(), plan.conflictCount(), 0, {}, {}};
+
+    // Records a failure, unless an earlier check already failed
+    auto fail = [&report](ValidationFailure failure, int district) {
+        if (report.valid) {
+            report.valid = false;
+            report.failure = failure;
+            report.failedDistrict = district;
+        }
+    };
+
+    int failedDistrict;
+    const ValidationFailure failure = checkCoverageAndPopulation(plan, margin, failedDistrict, nullptr);
+    if (failure != NO_FAILURE) {
+        fail(failure, failedDistrict);
     }
 
-    district.remove(start);
+    if (plan.districtCount() > 0) {
+        report.mean = map.totalPop() / plan.districtCount();
+    }
+    for (int district = 0; district < plan.districtCount(); district++) {
+        int districtPop = plan.districtPop(district);
+        report.deviations.push_back(report.mean == 0 ? 0 : double(districtPop - report.mean) / report.mean);
+    }
 
-    Set<int> next = map.getAdjacentPrecincts(start);
+    report.pieces = districtPieces(plan);   // O(V + E)
+    for (int district = 0; district < plan.districtCount(); district++) {
+        if (report.pieces[district] > 1) {
+            fail(NOT_CONTINUOUS, district);
+        }
+    }
 
+    cache.storeValidity(plan, margin, report.valid);
+    return report;
+}
 
-    for (int id : next) {
-        isContinuousHelper(district, id);
+/*
+ * Returns the remembered score of the plan, or scores it (and remembers it)
+ */
+int Gerrymander::howGerrymandered(const Plan& plan) const {
+    int score = NONE;
+    if (!cache.findScore(plan, score)) {
+        score = scorePlan(plan);
+        cache.storeScore(plan, score);
     }
+    return score;
+}
+
+/*
+ * Method that returns the degree of disproportionate voting using the
+ * Efficiency Gap.
+ */
+int Gerrymander::howGerrymandered(Set<Set<int>>& districts) const {
+    return howGerrymandered(Plan::fromDistricts(map, districts));
 }
 
 /*
@@ -121,32 +257,47 @@ void Gerrymander::isContinuousHelper(Set<int>& district, int start) const {
  *
  * To produce a quantifiable number for gerrymandering
  */
-int Gerrymander::howGerrymandered(Set<Set<int>>& districts) const {
-    if (!isValidPlan(districts, POPULATION_MARGIN)) {
+int Gerrymander::scorePlan(const Plan& plan) const {
+    if (!isValidPlan(plan, POPULATION_MARGIN)) {
         return NONE;
     }
 
+    // Timed after the validation, which is counted on its own
+    TRACE_SPAN("scorePlan");
+    StatTimer timer(SCORE_NS);
+    threadStats().add(SCORES);
+
     int demWaste = 0;
     int repWaste = 0;
     int totalVotes = 0;
-    for (Set<int> district: districts) {    // O(n)
-        Demographic districtInfo = Demographic(0, 0, 0);
-
-        for (int precinct : district) {
-            Demographic loc = map.getDemographic(precinct); // O(log n)
-            districtInfo.dem += loc.dem;
-            districtInfo.rep += loc.rep;
-        }
-
-        demWaste += demWasted(districtInfo.dem, districtInfo.rep);
-        repWaste += repWasted(districtInfo.dem, districtInfo.rep);
+    for (int district = 0; district < plan.districtCount(); district++) {    // O(districts)
+        int dem = plan.districtDem(district);
+        int rep = plan.districtRep(district);
 
-        totalVotes += districtInfo.dem + districtInfo.rep;
+        demWaste += demWasted(dem, rep);
+        repWaste += repWasted(dem, rep);
 
+        totalVotes += dem + rep;
     }
     return 100 * abs(demWaste - repWaste) / totalVotes;
 }
 
+/*
+ * Scores every plan at once, then marks the ones that aren't valid
+ */
+void Gerrymander::scoreBatch(const Plan* plans, size_t count, Score* out, bool validate) const {
+    ::scoreBatch(plans, count, out);
+
+    if (validate) {
+        for (size_t i = 0; i < count; i++) {
+            if (!isValidPlan(plans[i], POPULATION_MARGIN)) {
+                out[i].valid = false;
+                out[i].percent = NONE;
+            }
+        }
+    }
+}
+
 /*
  * Returns if a certain plan is more gerrymandered than a given Efficiency Gap
  */
@@ -154,43 +305,144 @@ bool Gerrymander::isGerrymandered(Set<Set<int>>& districts, int margin) const {
     return howGerrymandered(districts) > margin;
 }
 
+/*
+ * Returns if a certain plan is more gerrymandered than a given Efficiency Gap
+ */
+bool Gerrymander::isGerrymandered(const Plan& plan, int margin) const {
+    return howGerrymandered(plan) > margin;
+}
+
+/*
+ * Returns the result of "gerrymanderPlan(int, bool)" as a Set of districts
+ */
+Set<Set<int>> Gerrymander::gerrymander(int totalDistricts, bool favorRep) const {
+    return gerrymanderPlan(totalDistricts, favorRep).toDistricts();
+}
+
 /*
  * A function that returns a gerrymandered plan by repeatedly looking at different
  * skewed plans and seeing if they are valid plans.
  */
-Set<Set<int>> Gerrymander::gerrymander(int totalDistricts, bool favorRep) const {
-    Set<Set<int>> districts;
+Plan Gerrymander::gerrymanderPlan(int totalDistricts, bool favorRep) const {
+    Rng rng(freshSeed());
+    return gerrymanderPlan(totalDistricts, favorRep, rng);
+}
+
+/*
+ * The same as "gerrymanderPlan(int, bool)", drawing from the given generator
+ */
+template <typename Random>
+Plan Gerrymander::gerrymanderPlan(int totalDistricts, bool favorRep, Random& rng) const {
+    return gerrymanderPlan(totalDistricts, favorRep, JobControl(), rng).plan;
+}
+
+/*
+ * Makes attempts until one is done, or the job is cancelled or past its deadline (which are
+ * checked before every attempt), reporting the progress as it goes and once at the end.
+ *
+ * attempt(best, bestScore) makes a single attempt, keeping the plan to return in best (and
+ * the best score seen, for the progress), and returns whether the job is done.
+ */
+template <typename Attempt>
+static GenerationResult runAttempts(const JobControl& control, uint64_t seed, Attempt attempt) {
+    GenerationResult result{Plan(), VALID_PLAN, 0};
+    int bestScore = NONE;
+
+    while (true) {
+        if (control.isCancelled()) {
+            result.status = CANCELLED;
+            break;
+        }
+        if (control.isPastDeadline()) {
+            result.status = DEADLINE_EXCEEDED;
+            break;
+        }
 
-    while (!isValidPlan(districts, POPULATION_MARGIN)) {
+        result.iterations++;
+        if (attempt(result.plan, bestScore)) {
+            break;
+        }
+        control.reportEvery(result.iterations, bestScore);
+    }
+
+    if (control.progress) {
+        control.progress({result.iterations, bestScore});
+    }
+    result.plan.setGeneratorSeed(seed);
+    return result;
+}
 
-        Set<int> ids = map.precinctSet();                       // O(n)
-        districts.clear();
+/*
+ * The same as "gerrymanderPlan(int, bool, Random)", checking the control before every attempt
+ */
+template <typename Random>
+GenerationResult Gerrymander::gerrymanderPlan(int totalDistricts, bool favorRep, const JobControl& control, Random& rng) const {
+    return runAttempts(control, rng.seed(), [&](Plan& plan, int& bestScore) {
+        if (!tryGerrymander(plan, totalDistricts, favorRep, rng)) {
+            return false;
+        }
+        // Only scored for the progress, so that the plan is scored the first time the caller asks for it otherwise
+        if (control.progress) {
+            bestScore = howGerrymandered(plan);
+        }
+        return true;
+    });
+}
 
-        gerrymanderHelper(districts, totalDistricts, favorRep, ids);    // O(n)
+/*
+ * A single attempt at a gerrymandered plan, returns whether the plan is valid
+ */
+template <typename Random>
+bool Gerrymander::tryGerrymander(Plan& plan, int totalDistricts, bool favorRep, Random& rng) const {
+    threadStats().add(ATTEMPTS);
+    {
+        TRACE_SPAN("gerrymanderHelper");
+        StatTimer timer(GENERATE_NS);
+        plan.reset(map);
+
+        gerrymanderHelper(plan, totalDistricts, favorRep, rng);    // O(n)
     }
+    return isValidPlan(plan, POPULATION_MARGIN);
+}
 
-    return districts;
+/*
+ * Each thread gets its own scratch space the first time it generates a plan
+ */
+static GenerationScratch& generationScratch() {
+    thread_local GenerationScratch scratch;
+    return scratch;
 }
 
 /*
- * A helper function that individually builds districts for a plan
+ * Picks the objective for the favored party once, so that the generator is compiled
+ * separately for each party
  */
-void Gerrymander::gerrymanderHelper(Set<Set<int>>& districts, int totalDistricts, bool favorRep, Set<int>& ids) const {
-    const int maxPop = map.totalPop() / totalDistricts;
+template <typename Random>
+void Gerrymander::gerrymanderHelper(Plan& plan, int totalDistricts, bool favorRep, Random& rng) const {
+    if (favorRep) {
+        gerrymanderHelper<WastedVoteAdvantage<REPUBLICANS>>(plan, totalDistricts, rng);
+    } else {
+        gerrymanderHelper<WastedVoteAdvantage<DEMOCRATS>>(plan, totalDistricts, rng);
+    }
+}
 
-    Vector<int> all = setToVector(ids);
+/*
+ * A helper function that individually builds districts for a plan, until every
+ * precinct belongs to one
+ */
+template <typename Objective, typename Random>
+void Gerrymander::gerrymanderHelper(Plan& plan, int totalDistricts, Random& rng) const {
+    const int maxPop = map.totalPop() / totalDistricts;
 
-    while (!ids.isEmpty()) {                            // O(n log n)
-        int index = randomInteger(0, all.size() - 1);
-        if (ids.contains(all.get(index))) {
-            Set<int> curDistrict;
-            Set<int> adj;
-            Demographic demo = Demographic(0, 0, 0);
-            createGerrymanderedDistrict(curDistrict, demo, all.get(index), maxPop, favorRep, adj, ids);
+    GenerationScratch& scratch = generationScratch();
+    scratch.reset(plan.size());
+    scratch.rankByMargin<Objective>(map);               // O(n log n)
 
-            districts.add(curDistrict);
+    while (!scratch.starts.empty()) {                   // O(n)
+        int start = scratch.takeStart(rng);
+        if (scratch.open[start]) {
+            createGerrymanderedDistrict<Objective>(plan, plan.addDistrict(), start, maxPop, scratch, rng);
         }
-        all.remove(index);
     }
 }
 
@@ -201,193 +453,804 @@ void Gerrymander::gerrymanderHelper(Set<Set<int>>& districts, int totalDistricts
  * maximize wasted votes (not caring about the validity of the plan as a whole), which
  * it then grows the district, and repeats the process for every adjacent precinct.
  *
+ * The open precincts bordering the district (the frontier) are marked in the bitmap so that each
+ * is only added once, and kept in the segment tree of the scratch space (by waste) and in a binary
+ * heap (by index, for when nothing raises the waste, where taken precincts are dropped lazily as
+ * they reach the top).
+ *
+ * The waste of a candidate depends on the running totals of the district, but only through which
+ * party the district would vote for: on either side, candidates rank the same whatever the totals
+ * are. So every step takes the best candidate on each side of the current totals (split by margin),
+ * and the one that wastes more is the exact maximum over the whole frontier, in O(log V). Growth is
+ * O(E log V) overall.
+ *
  * When it reaches the mean population of the region, then it finishes building the district.
  *
- * @param distirct the set of precincts (by reference) that the method adds to
- * @param demo the demographics (democrat voters, republican voters, total population) of the current district
- * @param curID the id of the precinct that the method is reviewing
+ * @param plan the plan (by reference) that the method assigns precincts in
+ * @param district the number of the district being built, whose running demographics
+ *          (democrat voters, republican voters, total population) are kept by the plan
+ * @param start the dense index of the precinct the district starts from
  * @param maxPop the mean populatin of the entire region, which the district may go above,
  *          but may not add precincts to it when it does
- * @param favorRep boolean that determines whether it attempts to gerrymander for a Democrat or Republican advantage
- *          true - Republican, false - democrat
- * @param adj every adjacent precinct to the current district
- * @param ids the collection of all ids that are not already reserved for a district (open/free districts)
+ * @param Objective the amount of wasted votes that is maximized (which determines whether it attempts to gerrymander
+ *          for a Democrat or Republican advantage), see "WastedVoteAdvantage" in "scorer.h"
+ * @param scratch the scratch space of the attempt, whose open bitmap has all indices that are not already
+ *          reserved for a district (open/free districts), and whose frontier tree and heap the district reuses
+ * @param rng the random number generator that breaks ties
  *
  */
-void Gerrymander::createGerrymanderedDistrict(Set<int>& district, Demographic& demo, int curID, const int& maxPop, bool favorRep, Set<int>& adj, Set<int>& ids) const {
-    // Base Case => when the population of the district exceeds the maximum given for creation
-    if (demo.pop > maxPop) {
-        return;
-    }
+template <typename Objective, typename Random>
+void Gerrymander::createGerrymanderedDistrict(Plan& plan, int district, int start, int maxPop, GenerationScratch& scratch, Random& rng) const {
+    // open[i] is OPEN for a free precinct, and FRONTIER for a free precinct on the frontier
+    const char OPEN = 1;
+    const char FRONTIER = 2;
+
+    std::vector<char>& open = scratch.open;
+    std::vector<int>& lowest = scratch.lowest;
+    lowest.clear();
+    int cur = start;
+
+    while (true) {                                      // O(degree log V) per precinct
+        // Adding current precinct to the district (which updates its demographics)
+        plan.assign(cur, district);
+        if (open[cur] == FRONTIER) {
+            scratch.removeCandidate(cur);
+        }
+        open[cur] = false;
 
-    // Adding current district information to the respective variables
-    district.add(curID);
-    Demographic curDemo = map.getDemographic(curID);
-    demo.pop += curDemo.pop;
-    demo.dem += curDemo.dem;
-    demo.rep += curDemo.rep;
-    ids.remove(curID);
+        // Done => when the population of the district exceeds the maximum given for creation
+        if (plan.districtPop(district) > maxPop) {
+            break;
+        }
 
+        const int dem = plan.districtDem(district);
+        const int rep = plan.districtRep(district);
+        auto wasteWith = [&](int id) {
+            DemographicView tempDemo = map.demographicAt(id);   // O(1)
+            return Objective::value(dem + tempDemo.dem, rep + tempDemo.rep);
+        };
+
+        // Expanding the frontier (only the open precincts are added, once)
+        for (int next : map.neighborsOf(cur)) {
+            if (open[next] == OPEN) {
+                open[next] = FRONTIER;
+                // if there are >1 equal priority precicnts, the tie-breaker randomly picks 1
+                scratch.addCandidate(next, rng.nextInt(0, INT_MAX));
+                lowest.push_back(next);
+                std::push_heap(lowest.begin(), lowest.end(), std::greater<int>());
+            }
+        }
 
-    // Expanding the adjacent ids
-    Set<int> adjSet = map.getAdjacentPrecincts(curID);  // O(log n)
-    adj += adjSet;
-    adj *= ids;         // This doesnt work for some reason
+        // Finds "highest" priority precinct (the one that maximizes EG for the party), the best on either side
+        int maxWaste = Objective::value(dem, rep);
+        int maxID = NONE;
+        for (bool demWins : {true, false}) {
+            int id = scratch.bestCandidate(rep - dem, demWins);     // O(log V)
+            if (id == NONE) {
+                continue;
+            }
+            int candidateWaste = wasteWith(id);
+            if (candidateWaste > maxWaste || (candidateWaste == maxWaste && maxID != NONE && scratch.tie[id] > scratch.tie[maxID])) {
+                maxWaste = candidateWaste;
+                maxID = id;
+            }
+        }
 
-    // Base Case => district doesnt border any open precincts
-    if (adj.isEmpty()) {
-        return;
-    }
+        // Drops precincts that were taken from the top of the index heap
+        while (!lowest.empty() && !open[lowest.front()]) {
+            std::pop_heap(lowest.begin(), lowest.end(), std::greater<int>());
+            lowest.pop_back();
+        }
 
-    int maxWaste = 0;
-    int maxID = adj.first();
+        // Done => district doesnt border any open precincts
+        if (lowest.empty()) {
+            break;
+        }
 
-    if (favorRep) {
-        maxWaste = demWasted(demo.dem, demo.rep) - repWasted(demo.dem, demo.rep);
-    } else {
-        maxWaste = repWasted(demo.dem, demo.rep) - demWasted(demo.dem, demo.rep);
+        // If nothing wastes more votes than the district already does, the lowest index is used
+        cur = (maxID != NONE) ? maxID : lowest.front();
     }
 
-    // Finds "highest" priority precinct (the one that maximizes EG for the party)
-    for (int id : adj) {
-        if (ids.contains(id)) { // adj *= ids doesnt work????
-            Demographic tempDemo = map.getDemographic(id);      // O(log n)
-            int totalDem = demo.dem + tempDemo.dem;
-            int totalRep = demo.rep + tempDemo.rep;
+    // The rest of the frontier is still free
+    for (int id : lowest) {
+        if (open[id] == FRONTIER) {
+            scratch.removeCandidate(id);
+            open[id] = OPEN;
+        }
+    }
 
-            int candidateWaste = 0;
+    ThreadStats& stats = threadStats();
+    stats.add(DISTRICTS_GROWN);
+    stats.add(GROWTH_STEPS, plan.districtSize(district));
+}
 
-            if (favorRep) {
-                candidateWaste = demWasted(totalDem, totalRep) - repWasted(totalDem, totalRep);
-            } else {
-                candidateWaste = repWasted(totalDem, totalRep) - demWasted(totalDem, totalRep);
-            }
+/*
+ * Returns the result of "naiveGerrymanderPlan(int, int)" as a Set of districts
+ */
+Set<Set<int>> Gerrymander::naiveGerrymander(int totalDistricts, int margin) const {
+    return naiveGerrymanderPlan(totalDistricts, margin).toDistricts();
+}
 
-            if (candidateWaste > maxWaste) {
-                maxWaste = candidateWaste;
-                maxID = id;
-            } else if (candidateWaste == maxWaste && randomBool()) {    // if there are >1 equal priority precicnts, it randomly picks 1
-                maxID = id;
+/*
+ * Returns a gerrymandered district that is above a certin Efficiency Gap.
+ *
+ * It repeatedly generates random plans until one turns out to be gerrymandered.
+ */
+Plan Gerrymander::naiveGerrymanderPlan(int totalDistricts, int margin) const {
+    Rng rng(freshSeed());
+    return naiveGerrymanderPlan(totalDistricts, margin, rng);
+}
+
+/*
+ * The same as "naiveGerrymanderPlan(int, int)", drawing from the given generator
+ */
+template <typename Random>
+Plan Gerrymander::naiveGerrymanderPlan(int totalDistricts, int margin, Random& rng) const {
+    return naiveGerrymanderPlan(totalDistricts, margin, JobControl(), rng).plan;
+}
+
+/*
+ * The same as "naiveGerrymanderPlan(int, int, Random)", checking the control before every
+ * attempt at a random plan (the most gerrymandered valid plan is kept, in case it is stopped)
+ */
+template <typename Random>
+GenerationResult Gerrymander::naiveGerrymanderPlan(int totalDistricts, int margin, const JobControl& control, Random& rng) const {
+    Plan candidate;
+
+    return runAttempts(control, rng.seed(), [&](Plan& best, int& bestScore) {
+        if (!tryRandomPlan(candidate, totalDistricts, rng)) {
+            return false;
+        }
+
+        int score = howGerrymandered(candidate);
+        if (score > bestScore) {
+            best = candidate;
+            bestScore = score;
+        }
+        return score > margin;
+    });
+}
+
+/*
+ * Runs work(worker) on a number of threads (0 => one per core) and waits for all of them.
+ *
+ * If a worker raises an error, stop is set (so the others can give up), and the error
+ * is rethrown on the calling thread once every worker has finished.
+ */
+static void runWorkers(int workers, std::atomic<bool>& stop, const std::function<void(int)>& work) {
+    if (workers <= 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::vector<std::exception_ptr> errors(workers);
+    std::vector<std::thread> threads;
+    for (int worker = 0; worker < workers; worker++) {
+        threads.emplace_back([&, worker]() {
+            try {
+                work(worker);
+            } catch (...) {
+                errors[worker] = std::current_exception();
+                stop = true;
             }
+        });
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (const std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
         }
     }
+}
+
+/*
+ * The same search as "naiveGerrymanderPlan(int, int)", but every worker generates random
+ * plans from its own stream, and they all stop once any of them finds a gerrymandered plan.
+ *
+ * The workers only read the map, so its compact layout is built before any of them start.
+ */
+template <typename Random>
+Plan Gerrymander::parallelNaiveGerrymander(int totalDistricts, int margin, int workers, uint64_t seed) const {
+    map.freeze();
+
+    std::atomic<bool> found(false);
+    std::mutex resultLock;
+    Plan result;
+
+    runWorkers(workers, found, [&](int worker) {
+        Random rng(streamSeed(seed, worker));
+        Plan plan;
+
+        while (!found) {    // cancelled as soon as a plan is found
+            if (tryRandomPlan(plan, totalDistricts, rng) && isGerrymandered(plan, margin)) {
+                std::lock_guard<std::mutex> guard(resultLock);
+                if (!found) {
+                    result = plan;
+                    result.setGeneratorSeed(rng.seed());
+                    found = true;
+                }
+            }
+        }
+    });
 
-    // Recursive Call
-    createGerrymanderedDistrict(district, demo, maxID, maxPop, favorRep, adj, ids);
+    return result;
 }
 
 /*
- * Returns a gerrymandered district that is above a certin Efficiency Gap.
+ * Generates a batch of random valid plans, where the workers take the next plan that
+ * hasn't been started yet. Plan i is always drawn from stream i of the seed, so the batch
+ * is the same no matter how many workers there are.
+ */
+template <typename Random>
+Vector<Plan> Gerrymander::parallelRandomPlans(int totalDistricts, int count, int workers, uint64_t seed) const {
+    map.freeze();
+
+    Vector<Plan> plans(count);
+    std::atomic<int> next(0);
+    std::atomic<bool> failed(false);
+
+    runWorkers(workers, failed, [&](int) {
+        for (int i = next++; i < count && !failed; i = next++) {
+            Random rng(streamSeed(seed, i));
+            while (!tryRandomPlan(plans[i], totalDistricts, rng) && !failed) {}
+            plans[i].setGeneratorSeed(rng.seed());
+        }
+    });
+
+    return plans;
+}
+
+/*
+ * Returns the remembered validity of the plan, or checks it (and remembers it), using threads
+ * only if the plan is large enough
+ */
+bool Gerrymander::isValidPlanParallel(const Plan& plan, double margin, int workers) const {
+    bool valid = false;
+    if (!cache.findValidity(plan, margin, valid)) {
+        valid = (plan.size() < PARALLEL_VALIDATION_SIZE) ? checkPlan(plan, margin) : checkPlanParallel(plan, margin, workers);
+        cache.storeValidity(plan, margin, valid);
+    }
+    return valid;
+}
+
+/*
+ * The same checks as "checkPlan(Plan, double)", where the continuity searches are split
+ * between the workers.
  *
- * It repeatedly generates random plans until one turns out to be gerrymandered.
+ * The coverage and population of every district are kept by the plan, so those are checked
+ * first (on the calling thread). Then each worker takes the next district that hasn't been
+ * searched, and searches it from its first precinct. The districts don't overlap, so each
+ * worker clears its visited bits once for all of its districts, and as soon as any district
+ * is split the workers stop taking districts.
  */
-Set<Set<int>> Gerrymander::naiveGerrymander(int totalDistricts, int margin) const {
-    Set<Set<int>> districts;
-    while (!isGerrymandered(districts, margin)) {
-        districts = createRandomPlan(totalDistricts);
+bool Gerrymander::checkPlanParallel(const Plan& plan, double margin, int workers) const {
+    // Counted on the calling thread, which waits out the whole check
+    TRACE_SPAN("checkPlanParallel");
+    StatTimer timer(VALIDATE_NS);
+    ThreadStats& stats = threadStats();
+    stats.add(VALIDATIONS);
+
+    int failedDistrict;
+    if (checkCoverageAndPopulation(plan, margin, failedDistrict, &stats) != NO_FAILURE) {    // O(districts)
+        return false;
+    }
+
+    // The first precinct of every district, where its search starts
+    std::vector<int> firsts(plan.districtCount());
+    for (int index = plan.size() - 1; index >= 0; index--) {
+        firsts[plan.districtOf(index)] = index;
     }
-    return districts;
+
+    std::atomic<int> next(0);
+    std::atomic<bool> split(false);
+
+    runWorkers(workers, split, [&](int) {
+        ContiguityScratch& scratch = contiguityScratch();
+        scratch.clearVisited(plan.size());
+
+        for (int district = next++; district < plan.districtCount() && !split; district = next++) {
+            if (!isContinuousFrom(plan, firsts[district], scratch)) {     // O(|district|)
+                split = true;
+            }
+        }
+    });
+
+    stats.add(split ? CONTIGUITY_REJECTIONS : VALID_PLANS);
+    return !split;
+}
+
+/*
+ * Returns the result of "randomPlan(int)" as a Set of districts
+ */
+Set<Set<int>> Gerrymander::createRandomPlan(int totalDistricts) const {
+    return randomPlan(totalDistricts).toDistricts();
 }
 
 /*
  * Creates a random plan by making different plans and checking if they are
  * valid plans
  */
-Set<Set<int>> Gerrymander::createRandomPlan(int totalDistricts) const {
-    Set<Set<int>> districts;
+Plan Gerrymander::randomPlan(int totalDistricts) const {
+    Rng rng(freshSeed());
+    return randomPlan(totalDistricts, rng);
+}
 
-    while (!isValidPlan(districts, POPULATION_MARGIN)) {
-        Set<int> ids = map.precinctSet();
-        districts.clear();
+/*
+ * The same as "randomPlan(int)", drawing from the given generator
+ */
+template <typename Random>
+Plan Gerrymander::randomPlan(int totalDistricts, Random& rng) const {
+    return randomPlan(totalDistricts, JobControl(), rng).plan;
+}
 
+/*
+ * The same as "randomPlan(int, Random)", checking the control before every attempt
+ */
+template <typename Random>
+GenerationResult Gerrymander::randomPlan(int totalDistricts, const JobControl& control, Random& rng) const {
+    return runAttempts(control, rng.seed(), [&](Plan& plan, int& bestScore) {
+        if (!tryRandomPlan(plan, totalDistricts, rng)) {
+            return false;
+        }
+        if (control.progress) {
+            bestScore = howGerrymandered(plan);
+        }
+        return true;
+    });
+}
 
-        createRandomPlanHelper(districts, totalDistricts, ids);
+/*
+ * A single attempt at a random plan, returns whether the plan is valid
+ */
+template <typename Random>
+bool Gerrymander::tryRandomPlan(Plan& plan, int totalDistricts, Random& rng) const {
+    threadStats().add(ATTEMPTS);
+    {
+        TRACE_SPAN("createRandomPlanHelper");
+        StatTimer timer(GENERATE_NS);
+        plan.reset(map);
+
+        createRandomPlanHelper(plan, totalDistricts, rng);
     }
-
-    return districts;
+    return isValidPlan(plan, POPULATION_MARGIN);
 }
 
 /*
  * Creates a random plan by starting the districts in random areas.
  */
-void Gerrymander::createRandomPlanHelper(Set<Set<int>>& districts, int totalDistricts, Set<int>& ids) const {
+template <typename Random>
+void Gerrymander::createRandomPlanHelper(Plan& plan, int totalDistricts, Random& rng) const {
     const int max = (map.totalPop() / totalDistricts);
 
-    Vector<int> all = setToVector(ids);
-
-    while (!ids.isEmpty()) {                    // O(n)
-        // Randomly picks an element from the Vector, if it is invalid, it removes it from the vector anyways
-        int index = randomInteger(0, all.size() - 1);
-        if (ids.contains(all.get(index))) {
-            Set<int> curDistrict;
-            int districtPop = 0;
-            createRandomDistrict(curDistrict, all.get(index), districtPop, max, ids);
+    GenerationScratch& scratch = generationScratch();
+    scratch.reset(plan.size());
 
-            districts.add(curDistrict);
+    while (!scratch.starts.empty()) {           // O(n)
+        // Randomly picks a start, if it is already taken, it is removed from the starts anyways
+        int start = scratch.takeStart(rng);
+        if (scratch.open[start]) {
+            createRandomDistrict(plan, plan.addDistrict(), start, max, scratch, rng);
         }
-        all.remove(index);
     }
 }
 
 /*
- * It recursively creates a district, first by adding the current precinct, then choosing a random
+ * It creates a district with a DFS, first by adding the current precinct, then choosing a random
  * adjacent precinct then repeating the process on that precinct until the mean population is reached.
  *
  * Since it utilizes DFS, it tends to create more snakey districts which are more likely to produce
  * gerrymandered districts.
  *
- * @param distirct the set of precincts (by reference) that the method adds to
- * @param curID the id of the precinct that the method is reviewing
- * @param districtPop the number (by reference) of people that reside within the current districts
+ * The DFS keeps its own stack, where each entry is a precinct of the district and how far through
+ * its neighbors the search has got, so the district can be any size. The neighbors of every precinct
+ * on the stack are copied into the scratch space, and each one visited is picked at random from the
+ * ones left (a Fisher-Yates shuffle, done as it goes), so they are visited in a uniformly random order.
+ *
+ * @param plan the plan (by reference) that the method assigns precincts in
+ * @param district the number of the district being built (the plan keeps its population)
+ * @param start the dense index of the precinct the district starts from
  * @param maxPop the mean populatin of the entire region, which the district may go above,
  *          but may not add precincts to it when it does
- * @param ids the collection of all ids that are not already reserved for a district (open/free districts)
+ * @param scratch the scratch space of the attempt, whose open bitmap has all indices that are not already
+ *          reserved for a district (open/free districts), and whose stack buffer the DFS reuses
+ * @param rng the random number generator that picks the neighbors
+ */
+template <typename Random>
+void Gerrymander::createRandomDistrict(Plan& plan, int district, int start, int maxPop, GenerationScratch& scratch, Random& rng) const {
+    typedef GenerationScratch::Frame Frame;
+
+    std::vector<char>& open = scratch.open;
+    std::vector<Frame>& stack = scratch.stack;
+    std::vector<int>& shuffled = scratch.shuffled;
+    stack.clear();
+    shuffled.clear();
+
+    // Adds a precinct to the district, and to the top of the stack (with a copy of its neighbors)
+    auto visit = [&](int precinct) {
+        plan.assign(precinct, district);       // O(1)
+        open[precinct] = false;
+
+        stack.push_back({precinct, int(shuffled.size()), 0});
+        for (int next : map.neighborsOf(precinct)) {
+            shuffled.push_back(next);
+        }
+    };
+
+    visit(start);
+
+    // Stops as soon as the mean population is reached
+    while (!stack.empty() && plan.districtPop(district) < maxPop) {     // O(deg) per precinct
+        Frame& top = stack.back();
+        const int degree = int(shuffled.size()) - top.offset;
+
+        // The neighbors of the precinct on top are the last ones in the buffer
+        if (top.visited == degree) {
+            shuffled.resize(top.offset);
+            stack.pop_back();
+            continue;
+        }
+
+        // Picks one of the neighbors left at random, and swaps it in front of them
+        const int first = top.offset + top.visited;
+        std::swap(shuffled[first], shuffled[rng.nextInt(first, top.offset + degree - 1)]);
+        int next = shuffled[first];
+        top.visited++;
+        if (open[next]) {
+            visit(next);
+        }
+    }
+
+    ThreadStats& stats = threadStats();
+    stats.add(DISTRICTS_GROWN);
+    stats.add(GROWTH_STEPS, plan.districtSize(district));
+}
+
+/*
+ * Returns a random plan built by "repairedPlan(...)"
  */
-void Gerrymander::createRandomDistrict(Set<int>& district, int curID, int& districtPop, const int& maxPop, Set<int>& ids) const {
-    // Base Case
-    if (districtPop >= maxPop) {
-        return;
+GenerationResult Gerrymander::repairedRandomPlan(int totalDistricts, double margin, int maxIterations) const {
+    Rng rng(freshSeed());
+    return repairedRandomPlan(totalDistricts, margin, maxIterations, rng);
+}
+
+template <typename Random>
+GenerationResult Gerrymander::repairedRandomPlan(int totalDistricts, double margin, int maxIterations, Random& rng) const {
+    return repairedPlan(totalDistricts, margin, maxIterations, rng, [&](Plan& plan) {
+        plan.reset(map);
+        createRandomPlanHelper(plan, totalDistricts, rng);
+    });
+}
+
+/*
+ * Returns a gerrymandered plan (grown greedily for a party) built by "repairedPlan(...)"
+ */
+GenerationResult Gerrymander::repairedGerrymander(int totalDistricts, bool favorRep, double margin, int maxIterations) const {
+    Rng rng(freshSeed());
+    return repairedGerrymander(totalDistricts, favorRep, margin, maxIterations, rng);
+}
+
+template <typename Random>
+GenerationResult Gerrymander::repairedGerrymander(int totalDistricts, bool favorRep, double margin, int maxIterations, Random& rng) const {
+    return repairedPlan(totalDistricts, margin, maxIterations, rng, [&](Plan& plan) {
+        plan.reset(map);
+        gerrymanderHelper(plan, totalDistricts, favorRep, rng);
+    });
+}
+
+/*
+ * Returns a compact plan built by "MultilevelPartitioner" and repaired by "repairedPlan(...)"
+ */
+GenerationResult Gerrymander::partitionedPlan(int totalDistricts, double margin, int maxIterations) const {
+    Rng rng(freshSeed());
+    return partitionedPlan(totalDistricts, margin, maxIterations, rng);
+}
+
+/*
+ * The partitioner is seeded from the given generator, and kept for every rebuild (each
+ * rebuild coarsens the map differently). It balances the districts to within half the
+ * margin where it can, which leaves the repair steps little to do.
+ */
+template <typename Random>
+GenerationResult Gerrymander::partitionedPlan(int totalDistricts, double margin, int maxIterations, Random& rng) const {
+    MultilevelPartitioner partitioner(map, Random::streamSeed(rng.seed(), rng.nextInt(0, INT_MAX)));
+
+    return repairedPlan(totalDistricts, margin, maxIterations, rng, [&](Plan& plan) {
+        plan = partitioner.partition(totalDistricts, margin / 2);
+    });
+}
+
+/*
+ * Returns a plan gerrymandered by "AnnealingOptimizer"
+ */
+GenerationResult Gerrymander::annealedGerrymander(int totalDistricts, bool favorRep, double margin, int maxIterations,
+                                                  const AnnealingSchedule& schedule,
+                                                  AnnealingOptimizer::CheckpointCallback checkpoint) const {
+    Rng rng(freshSeed());
+    return annealedGerrymander(totalDistricts, favorRep, margin, maxIterations, schedule, checkpoint, rng);
+}
+
+/*
+ * The greedy generator already skews the districts for the party, so the annealing starts
+ * from there. If no valid plan can be built within maxIterations, that result is returned
+ * as it is. The steps of the schedule that were run are added to the iterations.
+ */
+template <typename Random>
+GenerationResult Gerrymander::annealedGerrymander(int totalDistricts, bool favorRep, double margin, int maxIterations,
+                                                  const AnnealingSchedule& schedule,
+                                                  AnnealingOptimizer::CheckpointCallback checkpoint, Random& rng) const {
+    GenerationResult result = repairedGerrymander(totalDistricts, favorRep, margin, maxIterations, rng);
+    if (result.status != VALID_PLAN) {
+        return result;
+    }
+
+    AnnealingOptimizer optimizer(result.plan, margin, favorRep ? REPUBLICANS : DEMOCRATS,
+                                 Random::streamSeed(rng.seed(), rng.nextInt(0, INT_MAX)));
+    result.iterations += optimizer.run(schedule, checkpoint);
+    result.plan = optimizer.best();
+    result.plan.setGeneratorSeed(rng.seed());
+    return result;
+}
+
+/*
+ * Squared deviation of a district's population from the mean, which the repair steps minimize
+ */
+static double squaredDeviation(int districtPop, double mean) {
+    return (districtPop - mean) * (districtPop - mean);
+}
+
+/*
+ * Builds a plan with build(plan) (the usual growers, or the partitioner), merges it into exactly
+ * totalDistricts districts, then repairs the population of the districts one boundary precinct at a time.
+ *
+ * Every precinct added or moved borders the district it joins, and moves that would split
+ * the district they leave are never made, so the districts stay continuous throughout and
+ * only the population needs repairing. Each step strictly lowers the total squared deviation
+ * from the mean, so if the plan gets stuck, it is rebuilt from scratch instead.
+ *
+ * Every step and every rebuild counts towards maxIterations. If it runs out, the plan
+ * closest to valid that was seen is returned along with BUDGET_EXHAUSTED.
+ */
+template <typename Build, typename Random>
+GenerationResult Gerrymander::repairedPlan(int totalDistricts, double margin, int maxIterations, Random& rng, Build build) const {
+    GenerationResult result{Plan(), NO_STARTING_PLAN, 0};
+    double bestDeviation = -1;
+
+    if (totalDistricts <= 0 || totalDistricts > map.size()) {
+        return result;
     }
 
-    // Adds the current precinct to the district
-    district.add(curID);
-    districtPop += map.getDemographic(curID).pop;       // O(log n)
-    ids.remove(curID);
+    Plan plan;
+    while (result.iterations < maxIterations) {
+        // Builds a starting plan (which is rebuilt if it can't be merged into the districts)
+        threadStats().add(ATTEMPTS);
+        bool merged = false;
+        {
+            TRACE_SPAN("buildPlan");
+            StatTimer timer(GENERATE_NS);
+            build(plan);
+            merged = mergeIntoDistricts(plan, totalDistricts);
+        }
+        result.iterations++;
 
-    Set<int> adjSet = map.getAdjacentPrecincts(curID);  // O(log n)
-    Vector<int> adj = setToVector(adjSet);
+        if (!merged) {
+            continue;
+        }
 
-    // Recursive Case => DFS with random valid adjacent IDs
-    while (!adj.isEmpty()) {
-        int index = randomInteger(0, adj.size() - 1);
-        if (ids.contains(adj.get(index))) {
-            createRandomDistrict(district, adj.get(index), districtPop, maxPop, ids);
+        /* Repairs the plan until its populations are within the margin, it gets stuck, or the budget runs out.
+         * The moves keep the districts continuous, so only the populations are checked between steps.
+         */
+        BoundaryIndex boundary(plan);      // O(V + E), once per build
+        bool stuck = false;
+        int failedDistrict;
+        while (checkCoverageAndPopulation(plan, margin, failedDistrict, nullptr) != NO_FAILURE
+               && !stuck && result.iterations < maxIterations) {
+            TRACE_SPAN("repairStep");
+            StatTimer timer(GENERATE_NS);
+            stuck = !repairStep(plan, boundary, margin);
+            result.iterations++;
         }
-        adj.remove(index);
 
+        if (isValidPlan(plan, margin)) {
+            result.plan = plan;
+            result.plan.setGeneratorSeed(rng.seed());
+            result.status = VALID_PLAN;
+            return result;
+        }
+
+        // Keeps the plan closest to valid, in case the budget runs out
+        const double mean = double(map.totalPop()) / totalDistricts;
+        double deviation = 0;
+        for (int district = 0; district < plan.districtCount(); district++) {
+            deviation += squaredDeviation(plan.districtPop(district), mean);
+        }
+        if (bestDeviation < 0 || deviation < bestDeviation) {
+            bestDeviation = deviation;
+            result.plan = plan;
+            result.plan.setGeneratorSeed(rng.seed());
+            result.status = BUDGET_EXHAUSTED;
+        }
     }
+
+    return result;
 }
 
 /*
- * Calculates wasted votes for the Republican Party (US)
+ * Turns a plan with any number of districts into one with exactly totalDistricts districts.
+ *
+ * The most populous districts are kept, and the precincts of every other district (and the
+ * precincts that aren't in a district at all) are flooded (BFS) into the kept districts they
+ * are connected to.
+ *
+ * Returns false if the plan has too few districts, or if some precincts can't reach
+ * any of the kept districts.
  */
-int Gerrymander::repWasted(int dem, int rep) const {
-    if (dem > rep) {
-        return rep;
+bool Gerrymander::mergeIntoDistricts(Plan& plan, int totalDistricts) const {
+    if (plan.districtCount() < totalDistricts) {
+        return false;
     }
 
-    return rep - dem - 1;
+    // Ranks the districts by population
+    std::vector<int> ranked;
+    for (int district = 0; district < plan.districtCount(); district++) {
+        ranked.push_back(district);
+    }
+    std::sort(ranked.begin(), ranked.end(), [&plan](int a, int b) {
+        return plan.districtPop(a) > plan.districtPop(b);
+    });
+
+    std::vector<int> renumber(plan.districtCount(), Plan::UNASSIGNED);
+    for (int rank = 0; rank < totalDistricts; rank++) {
+        renumber[ranked[rank]] = rank;
+    }
+
+    // Copies the kept districts, which are the sources of the flood
+    Plan merged(map, totalDistricts);
+    std::vector<int> queue;
+    for (int index = 0; index < plan.size(); index++) {
+        if (plan.districtOf(index) == Plan::UNASSIGNED) {       // left for the flood to reach
+            continue;
+        }
+        int district = renumber[plan.districtOf(index)];
+        if (district != Plan::UNASSIGNED) {
+            merged.assign(index, district);
+            queue.push_back(index);
+        }
+    }
+
+    for (size_t head = 0; head < queue.size(); head++) {    // O(n + e)
+        int cur = queue[head];
+        for (int next : map.neighborsOf(cur)) {
+            if (merged.districtOf(next) == Plan::UNASSIGNED) {
+                merged.assign(next, merged.districtOf(cur));
+                queue.push_back(next);
+            }
+        }
+    }
+
+    if (merged.unassignedCount() > 0) {
+        return false;
+    }
+
+    plan = merged;
+    return true;
+}
+
+// A boundary move considered by "repairStep", and how much it lowers the total squared deviation
+struct RepairCandidate {
+    int precinct;
+    int to;
+    double gain;
+};
+
+// The buffers of the repair steps, which each thread keeps from one step to the next
+struct RepairScratch {
+    std::vector<int> outside;
+    std::vector<RepairCandidate> candidates;
+};
+
+static RepairScratch& repairScratch() {
+    thread_local RepairScratch scratch;
+    return scratch;
 }
 
 /*
- * Calculates wasted votes for the Democratic Party (US)
+ * Makes a single boundary transfer that lowers the total squared deviation of the
+ * district populations.
+ *
+ * Starting with the district furthest outside the margin, it considers moving its
+ * boundary precincts out (if it is over-populated) or pulling in the precincts that
+ * border it (if it is under-populated), and makes the best move that doesn't leave
+ * a district empty or split. The moves are the cut edges leaving the district, read
+ * from the boundary index (which is kept up to date), so a step only looks at the
+ * borders of the districts outside the margin.
+ *
+ * Returns false if there is no such move.
  */
-int Gerrymander::demWasted(int dem, int rep) const {
-    if (dem > rep) {
-        return dem - rep - 1;
+bool Gerrymander::repairStep(Plan& plan, BoundaryIndex& boundary, double margin) const {
+    const int mean = map.totalPop() / plan.districtCount();
+    const double exactMean = double(map.totalPop()) / plan.districtCount();
+    RepairScratch& scratch = repairScratch();
+
+    // Districts outside the margin, furthest first
+    std::vector<int>& outside = scratch.outside;
+    outside.clear();
+    for (int district = 0; district < plan.districtCount(); district++) {
+        int districtPop = plan.districtPop(district);
+        if (districtPop > mean * (1 + margin) || districtPop < mean * (1 - margin)) {
+            outside.push_back(district);
+        }
+    }
+    std::sort(outside.begin(), outside.end(), [&](int a, int b) {
+        return squaredDeviation(plan.districtPop(a), exactMean) > squaredDeviation(plan.districtPop(b), exactMean);
+    });
+
+    std::vector<RepairCandidate>& candidates = scratch.candidates;
+    for (int target : outside) {
+        const bool over = plan.districtPop(target) > mean;
+
+        // Every boundary move into or out of the target district that improves the plan
+        candidates.clear();
+        for (int position = 0; position < boundary.cutEdgeCount(target); position++) {     // O(perimeter of the district)
+            int inside;
+            int across;
+            boundary.cutEdgeAt(target, position, inside, across);
+
+            // Over => the precinct inside moves across, under => the precinct across moves in
+            const int index = over ? inside : across;
+            const int from = plan.districtOf(index);
+            const int to = over ? plan.districtOf(across) : target;
+
+            int pop = map.popAt(index);
+            double gain = squaredDeviation(plan.districtPop(from), exactMean)
+                        + squaredDeviation(plan.districtPop(to), exactMean)
+                        - squaredDeviation(plan.districtPop(from) - pop, exactMean)
+                        - squaredDeviation(plan.districtPop(to) + pop, exactMean);
+            if (gain > 0 && plan.districtSize(from) > 1) {
+                candidates.push_back(RepairCandidate{index, to, gain});
+            }
+        }
+
+        std::sort(candidates.begin(), candidates.end(), [](const RepairCandidate& a, const RepairCandidate& b) {
+            return a.gain > b.gain;
+        });
+
+        // Makes the best move that keeps the district it leaves continuous
+        for (const RepairCandidate& move : candidates) {
+            if (staysContinuousLocal(plan, move.precinct)) {
+                const int from = plan.districtOf(move.precinct);
+                plan.assign(move.precinct, move.to);
+                boundary.applyMove(move.precinct, from, move.to);
+                return true;
+            }
+        }
     }
 
-    return dem;
+    return false;
+}
+
+/*
+ * Returns the VotingMap that plans are built over
+ */
+const VotingMap& Gerrymander::votingMap() const {
+    return map;
+}
+
+const PlanCache& Gerrymander::planCache() const {
+    return cache;
+}
+
+void Gerrymander::clearPlanCache() {
+    cache.clear();
+}
+
+GeneratorStats Gerrymander::stats() {
+    return collectGeneratorStats();
+}
+
+void Gerrymander::resetStats() {
+    resetGeneratorStats();
 }
 
 /*
@@ -401,6 +1264,28 @@ Vector<int>Gerrymander::setToVector(Set<int>& intSet) const {
     return vec;
 }
 
+/*
+ * The generators are templates defined in this file, so they are compiled here for
+ * every generator in "rng.h" (add a line for any other policy)
+ */
+#define INSTANTIATE_GENERATORS(Random) \
+    template Plan Gerrymander::gerrymanderPlan<Random>(int, bool, Random&) const; \
+    template Plan Gerrymander::naiveGerrymanderPlan<Random>(int, int, Random&) const; \
+    template Plan Gerrymander::randomPlan<Random>(int, Random&) const; \
+    template GenerationResult Gerrymander::gerrymanderPlan<Random>(int, bool, const JobControl&, Random&) const; \
+    template GenerationResult Gerrymander::naiveGerrymanderPlan<Random>(int, int, const JobControl&, Random&) const; \
+    template GenerationResult Gerrymander::randomPlan<Random>(int, const JobControl&, Random&) const; \
+    template GenerationResult Gerrymander::repairedRandomPlan<Random>(int, double, int, Random&) const; \
+    template GenerationResult Gerrymander::repairedGerrymander<Random>(int, bool, double, int, Random&) const; \
+    template GenerationResult Gerrymander::partitionedPlan<Random>(int, double, int, Random&) const; \
+    template GenerationResult Gerrymander::annealedGerrymander<Random>(int, bool, double, int, const AnnealingSchedule&, \
+                                                                       AnnealingOptimizer::CheckpointCallback, Random&) const; \
+    template Plan Gerrymander::parallelNaiveGerrymander<Random>(int, int, int, uint64_t) const; \
+    template Vector<Plan> Gerrymander::parallelRandomPlans<Random>(int, int, int, uint64_t) const
+
+INSTANTIATE_GENERATORS(Rng);
+INSTANTIATE_GENERATORS(PcgRng);
+
 /*-------- Testing and functions related to testing--------*/
 
 Set<int> adjacentWithinDefaultJerry(int id) {
@@ -574,6 +1459,404 @@ PROVIDED_TEST("Time Generating randomly gerrymandered maps") {
     TIME_OPERATION(5, map.naiveGerrymander(5, 25));
 }
 
+STUDENT_TEST("Validating and scoring dense plans") {
+    Set<Area*> areas = defaultMapJerry();
+
+    Gerrymander map;
+    for (Area* loc : areas) {
+        map.addArea(loc);
+    }
+
+    // Cracking (the same plan as the Set of Sets test)
+    Plan plan(map.votingMap(), 5);
+    for (int index = 0; index < 50; index++) {
+        plan.assign(index, index / 10);
+    }
+
+    EXPECT(map.isValidPlan(plan, 0.1));
+    EXPECT_EQUAL(map.howGerrymandered(plan), 30);
+
+    // Swapping 2 precincts keeps the population, but splits a district
+    plan.assign(0, 4);
+    plan.assign(49, 0);
+    EXPECT(!map.isValidPlan(plan, 0.1));
+
+    Plan generated = map.randomPlan(5);
+    EXPECT(map.isValidPlan(generated, POPULATION_MARGIN));
+    Set<Set<int>> districts = generated.toDistricts();
+    EXPECT(map.isValidPlan(districts, POPULATION_MARGIN));
+}
 
+STUDENT_TEST("Repairing plans at a tight population margin") {
+    Set<Area*> areas = defaultMapJerry();
 
+    Gerrymander map;
+    for (Area* loc : areas) {
+        map.addArea(loc);
+    }
 
+    // At 0% every district needs exactly 10 precincts
+    GenerationResult result = map.repairedRandomPlan(5, 0, 1000);
+    EXPECT_EQUAL(result.status, VALID_PLAN);
+    EXPECT(map.isValidPlan(result.plan, 0));
+    EXPECT(result.iterations <= 1000);
+
+    result = map.repairedGerrymander(5, true, 0.05, 1000);
+    EXPECT_EQUAL(result.status, VALID_PLAN);
+    EXPECT(map.isValidPlan(result.plan, 0.05));
+
+    // No budget, and a request that can't be met at all
+    EXPECT_EQUAL(map.repairedRandomPlan(5, 0, 0).status, NO_STARTING_PLAN);
+    EXPECT_EQUAL(map.repairedRandomPlan(51, 0.2, 100).status, NO_STARTING_PLAN);
+}
+
+STUDENT_TEST("Repairing plans for the custom precincts (Vaguely based off of a small area in TX)") {
+    Gerrymander map;
+    map.addArea(new Area(50001, 121, 162, 636, {50002, 50007}));
+    map.addArea(new Area(50002, 1011, 351, 2837, {50001, 50003, 50004}));
+    map.addArea(new Area(50003, 234, 1141, 2527, {50002, 50005}));
+    map.addArea(new Area(50004, 366, 452, 1223, {50002, 50005}));
+    map.addArea(new Area(50005, 468, 611, 2168, {50002, 50004, 50003, 50006}));
+    map.addArea(new Area(50006, 51, 275, 619, {50002, 50005, 50007}));
+    map.addArea(new Area(50007, 121, 909, 2918, {50001, 50006}));
+
+    GenerationResult result = map.repairedRandomPlan(3, POPULATION_MARGIN, 500);
+    EXPECT_EQUAL(result.status, VALID_PLAN);
+    EXPECT_EQUAL(result.plan.districtCount(), 3);
+
+    // The precincts are too lumpy for 5 districts within 1%, so it runs out of budget
+    result = map.repairedRandomPlan(5, 0.01, 200);
+    EXPECT_EQUAL(result.status, BUDGET_EXHAUSTED);
+    EXPECT_EQUAL(result.iterations, 200);
+    EXPECT_EQUAL(result.plan.districtCount(), 5);
+}
+
+STUDENT_TEST("Repairing partitioned plans of a large map") {
+    // A 100x100 grid with uneven populations
+    Gerrymander map;
+    addGridMap(map, 100, 100, [](int id) { return Demographic(id % 2, 1 - id % 2, 1 + id % 3); });
+
+    Rng rng(8);
+    GenerationResult result = map.partitionedPlan(10, 0.05, 2000, rng);
+    EXPECT_EQUAL(result.status, VALID_PLAN);
+    EXPECT_EQUAL(result.plan.districtCount(), 10);
+    EXPECT(map.isValidPlan(result.plan, 0.05));
+
+    // The same generator state gives the same plan
+    Rng replay(8);
+    EXPECT(map.partitionedPlan(10, 0.05, 2000, replay).plan == result.plan);
+    EXPECT_EQUAL(map.partitionedPlan(0, 0.05, 100).status, NO_STARTING_PLAN);
+}
+
+STUDENT_TEST("Repairing partitioned plans of a map in pieces") {
+    // A 10x10 grid cut between rows 7 and 8, so an island of 80 precincts and one of 20
+    Gerrymander map;
+    for (int id = 0; id < 100; id++) {
+        Set<int> adj;
+        for (int next : gridNeighbors(id, 10, 10)) {
+            if ((next < 80) == (id < 80)) {
+                adj.add(next);
+            }
+        }
+        map.addArea(Area(id, oneVote(id % 2 == 0), adj));
+    }
+
+    // A single district can't reach both islands, so the partitioner always leaves one unassigned
+    Rng rng(3);
+    GenerationResult result = map.partitionedPlan(1, POPULATION_MARGIN, 50, rng);
+    EXPECT_EQUAL(result.status, NO_STARTING_PLAN);
+    EXPECT_EQUAL(result.iterations, 50);
+
+    // The smaller island can't hold half the population, so no plan is valid
+    result = map.partitionedPlan(2, 0.1, 200, rng);
+    EXPECT(result.status != VALID_PLAN);
+    if (result.status == BUDGET_EXHAUSTED) {
+        EXPECT_EQUAL(result.plan.unassignedCount(), 0);
+    }
+}
+
+STUDENT_TEST("Gerrymandering by annealing") {
+    Set<Area*> areas = defaultMapJerry();
+
+    Gerrymander map;
+    for (Area* loc : areas) {
+        map.addArea(loc);
+    }
+
+    AnnealingSchedule schedule;
+    schedule.maxSteps = 5000;
+    schedule.tabuTenure = 5;
+
+    for (bool favorRep : {true, false}) {
+        Rng rng(4);
+        GenerationResult greedy = map.repairedGerrymander(5, favorRep, POPULATION_MARGIN, 1000, rng);
+
+        Rng replay(4);
+        bool allValid = true;
+        GenerationResult annealed = map.annealedGerrymander(5, favorRep, POPULATION_MARGIN, 1000, schedule,
+                                                            [&](int, const Plan& best, double) {
+            allValid = allValid && map.isValidPlan(best, POPULATION_MARGIN);
+        }, replay);
+
+        // Annealing starts from the greedy plan, and never ends up worse for the party
+        EXPECT_EQUAL(annealed.status, VALID_PLAN);
+        EXPECT(map.isValidPlan(annealed.plan, POPULATION_MARGIN));
+        EXPECT(allValid);
+        EXPECT_EQUAL(annealed.iterations, greedy.iterations + schedule.maxSteps);
+        double before = EfficiencyGapScorer(greedy.plan).efficiencyGap();
+        double after = EfficiencyGapScorer(annealed.plan).efficiencyGap();
+        EXPECT(favorRep ? after >= before : after <= before);
+    }
+
+    EXPECT_EQUAL(map.annealedGerrymander(51, true, POPULATION_MARGIN, 100, schedule).status, NO_STARTING_PLAN);
+}
+
+STUDENT_TEST("Generating plans on multiple threads") {
+    Set<Area*> areas = defaultMapJerry();
+
+    Gerrymander map;
+    for (Area* loc : areas) {
+        map.addArea(loc);
+    }
+
+    Plan jerrys = map.parallelNaiveGerrymander(5, 15, 4, 7);
+    EXPECT(map.isGerrymandered(jerrys, 15));
+
+    Vector<Plan> plans = map.parallelRandomPlans(5, 8, 3, 42);
+    EXPECT_EQUAL(plans.size(), 8);
+    for (const Plan& plan : plans) {
+        EXPECT(map.isValidPlan(plan, POPULATION_MARGIN));
+    }
+
+    // The batch only depends on the seed, not the number of workers
+    Vector<Plan> again = map.parallelRandomPlans(5, 8, 1, 42);
+    for (int i = 0; i < plans.size(); i++) {
+        EXPECT(plans[i] == again[i]);
+    }
+}
+
+STUDENT_TEST("Seeded generators are reproducible") {
+    Set<Area*> areas = defaultMapJerry();
+
+    Gerrymander map;
+    for (Area* loc : areas) {
+        map.addArea(loc);
+    }
+
+    Rng first(2022);
+    Rng second(2022);
+    Plan plan = map.randomPlan(5, first);
+    EXPECT(plan == map.randomPlan(5, second));
+    EXPECT_EQUAL(plan.generatorSeed(), 2022);
+
+    // Regenerating from the recorded seed gives the same plan
+    Rng replay(plan.generatorSeed());
+    EXPECT(plan == map.randomPlan(5, replay));
+
+    PcgRng pcg(7);
+    PcgRng pcgAgain(7);
+    EXPECT(map.gerrymanderPlan(5, true, pcg) == map.gerrymanderPlan(5, true, pcgAgain));
+
+    // Every plan of a parallel batch can be replayed on its own
+    Vector<Plan> plans = map.parallelRandomPlans<PcgRng>(5, 4, 2, 99);
+    PcgRng third(plans[2].generatorSeed());
+    EXPECT(plans[2] == map.randomPlan(5, third));
+}
+
+STUDENT_TEST("Scoring plans in batches") {
+    Set<Area*> areas = defaultMapJerry();
+
+    Gerrymander map;
+    for (Area* loc : areas) {
+        map.addArea(loc);
+    }
+
+    Vector<Plan> plans = map.parallelRandomPlans(5, 20, 2, 11);
+    // An invalid plan (a district of 1 precinct, and one of the rest)
+    Set<int> rest = map.votingMap().precinctSet();
+    rest.remove(0);
+    plans.add(Plan::fromDistricts(map.votingMap(), {rest, {0}}));
+    const int last = plans.size() - 1;
+
+    std::vector<Score> scores(plans.size());
+    map.scoreBatch(&plans[0], plans.size(), scores.data());
+    for (int i = 0; i < plans.size(); i++) {
+        EXPECT_EQUAL(scores[i].percent, map.howGerrymandered(plans[i]));
+        EXPECT_EQUAL(scores[i].efficiencyGap, EfficiencyGapScorer(plans[i]).efficiencyGap());
+    }
+    EXPECT(!scores[last].valid);
+
+    // Without validation every plan is scored
+    map.scoreBatch(&plans[0], plans.size(), scores.data(), false);
+    EXPECT(scores[last].valid);
+    EXPECT_EQUAL(scores[last].percent, EfficiencyGapScorer(plans[last]).score());
+}
+
+STUDENT_TEST("Validating and scoring the same plan only once") {
+    Set<Area*> areas = defaultMapJerry();
+
+    Gerrymander map;
+    for (Area* loc : areas) {
+        map.addArea(loc);
+    }
+
+    Rng rng(3);
+    Plan plan = map.randomPlan(5, rng);
+    long misses = map.planCache().misses();
+
+    // The generator already validated the plan, so only the score is worked out
+    int score = map.howGerrymandered(plan);
+    EXPECT(map.isValidPlan(plan, POPULATION_MARGIN));
+    EXPECT_EQUAL(map.isGerrymandered(plan, score - 1), true);
+    EXPECT_EQUAL(map.planCache().misses(), misses + 1);
+    EXPECT(map.planCache().hits() >= 3);
+
+    map.clearPlanCache();
+    EXPECT_EQUAL(map.howGerrymandered(plan), score);
+    EXPECT_EQUAL(map.planCache().hits(), 0);
+}
+
+STUDENT_TEST("Counting what the generators did") {
+    Set<Area*> areas = defaultMapJerry();
+
+    Gerrymander map;
+    for (Area* loc : areas) {
+        map.addArea(loc);
+    }
+
+    Gerrymander::resetStats();
+    Rng rng(5);
+    Plan plan = map.randomPlan(5, rng);
+    GeneratorStats stats = Gerrymander::stats();
+
+    // Every attempt grows districts until every precinct is taken, and is checked once (the last one is the valid plan)
+    EXPECT(stats.attempts >= 1);
+    EXPECT(stats.districtsGrown >= stats.attempts);
+    EXPECT_EQUAL(stats.growthSteps, stats.attempts * map.votingMap().size());
+    EXPECT(stats.validations <= stats.attempts);
+    EXPECT_EQUAL(stats.validPlans, 1);
+    EXPECT_EQUAL(stats.validations, stats.validPlans + stats.coverageRejections
+                 + stats.populationRejections + stats.contiguityRejections);
+    EXPECT(stats.meanGrowthSteps() > 0 && stats.meanGrowthSteps() <= map.votingMap().size());
+    EXPECT(stats.generateNs > 0 && stats.validateNs > 0);
+
+    // A cached result isn't counted again, but a new score is
+    map.howGerrymandered(plan);
+    map.isValidPlan(plan, POPULATION_MARGIN);
+    EXPECT_EQUAL(Gerrymander::stats().validations, stats.validations);
+    EXPECT_EQUAL(Gerrymander::stats().scores, 1);
+
+    Gerrymander::resetStats();
+    EXPECT_EQUAL(Gerrymander::stats().attempts, 0);
+}
+
+STUDENT_TEST("Reporting why a plan isn't valid") {
+    // A line of 4 precincts: 1 - 2 - 3 - 4
+    Gerrymander map;
+    map.addArea(1, 1, 0, 100, {2});
+    map.addArea(2, 1, 0, 100, {1, 3});
+    map.addArea(3, 0, 1, 100, {2, 4});
+    map.addArea(4, 0, 1, 100, {3});
+
+    Set<Set<int>> districts = {{1, 2}, {3, 4}};
+    ValidationReport report = map.validatePlan(districts, POPULATION_MARGIN);
+    EXPECT(report.valid);
+    EXPECT_EQUAL(report.failure, NO_FAILURE);
+    EXPECT_EQUAL(report.mean, 200);
+    EXPECT_EQUAL(report.deviations[0], 0.0);
+    EXPECT_EQUAL(report.pieces[1], 1);
+
+    // {1, 3} is split and {2, 4} too, but the populations are fine
+    districts = {{1, 3}, {2, 4}};
+    report = map.validatePlan(districts, POPULATION_MARGIN);
+    EXPECT(!report.valid);
+    EXPECT_EQUAL(report.failure, NOT_CONTINUOUS);
+    EXPECT_EQUAL(report.failedDistrict, 0);
+    EXPECT_EQUAL(report.pieces[0], 2);
+    EXPECT_EQUAL(report.pieces[1], 2);
+    EXPECT_EQUAL(map.isValidPlan(districts, POPULATION_MARGIN), false);
+
+    // The population is checked before continuity
+    districts = {{1}, {2, 4}, {3}};
+    report = map.validatePlan(districts, POPULATION_MARGIN);
+    EXPECT_EQUAL(report.failure, POPULATION_OUTSIDE_MARGIN);
+    EXPECT_EQUAL(report.failedDistrict, 0);
+    EXPECT(report.deviations[0] < -POPULATION_MARGIN && report.deviations[1] > POPULATION_MARGIN);
+    EXPECT_EQUAL(report.pieces[1], 2);
+
+    // And coverage before both
+    districts = {{1, 2}, {2, 3}, {5}};
+    report = map.validatePlan(districts, POPULATION_MARGIN);
+    EXPECT_EQUAL(report.failure, UNASSIGNED_PRECINCTS);
+    EXPECT_EQUAL(report.unassigned, 1);
+    EXPECT_EQUAL(report.conflicts, 2);
+}
+
+STUDENT_TEST("Validating large plans on multiple threads") {
+    // A line of precincts, cut into 8 equal districts
+    const int size = 2 * PARALLEL_VALIDATION_SIZE;
+    Gerrymander map;
+    addGridMap(map, size, 1, [](int) { return oneVote(true); });
+
+    Plan plan(map.votingMap(), 8);
+    for (int index = 0; index < size; index++) {
+        plan.assign(index, index / (size / 8));
+    }
+    EXPECT(map.isValidPlanParallel(plan, POPULATION_MARGIN, 4));
+
+    // Swapping 2 precincts splits 2 districts without changing their populations
+    plan.assign(size / 2, 0);
+    plan.assign(0, 4);
+    EXPECT(!map.isValidPlanParallel(plan, POPULATION_MARGIN, 4));
+    map.clearPlanCache();
+    EXPECT(!map.isValidPlan(plan, POPULATION_MARGIN));
+
+    // A plan that is outside the margin is caught before any thread starts
+    plan.assign(0, 0);
+    plan.assign(size / 2, 4);
+    plan.assign(size / 8, 0);
+    EXPECT(map.isValidPlanParallel(plan, POPULATION_MARGIN));
+    EXPECT(!map.isValidPlanParallel(plan, 0.00001));
+}
+
+STUDENT_TEST("Growing districts larger than the call stack") {
+    // A line of 100000 precincts, where each district used to be one stack frame per precinct
+    Gerrymander map;
+    addGridMap(map, 100000, 1, [](int id) { return oneVote(id % 2 == 1); });
+
+    Rng rng(5);
+    Plan plan = map.randomPlan(1, rng);
+    EXPECT_EQUAL(plan.districtSize(0), 100000);
+
+    plan = map.gerrymanderPlan(1, true, rng);
+    EXPECT(map.isValidPlan(plan, POPULATION_MARGIN));
+}
+
+STUDENT_TEST("Bounded random integers stay in range") {
+    Rng rng(1);
+    PcgRng pcg(1);
+    bool inRange = true;
+    Vector<int> counts(6, 0);
+    for (int i = 0; i < 6000; i++) {
+        int a = rng.nextInt(-2, 3);
+        int b = pcg.nextInt(10, 10);
+        inRange = inRange && a >= -2 && a <= 3 && b == 10;
+        counts[a + 2]++;
+    }
+    EXPECT(inRange);
+    for (int count : counts) {
+        EXPECT(count > 800 && count < 1200);
+    }
+
+    // The whole range of an int (whose size wraps around to 0), and empty ranges
+    bool negative = false;
+    bool positive = false;
+    for (int i = 0; i < 100; i++) {
+        int value = rng.nextInt(INT_MIN, INT_MAX);
+        negative = negative || value < 0;
+        positive = positive || value > 0;
+    }
+    EXPECT(negative && positive);
+    EXPECT_EQUAL(pcg.nextInt(INT_MAX, INT_MAX), INT_MAX);
+    EXPECT_ERROR(rng.nextInt(3, 2));
+}
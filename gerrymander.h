@@ -15,11 +15,247 @@
 #ifndef GERRYMANDER_H
 #define GERRYMANDER_H
 
+#include <algorithm>
+#include <vector>
+
+#include "annealer.h"
+#include "boundary.h"
+#include "jobs.h"
 #include "votingmap.h"
+#include "plan.h"
+#include "plancache.h"
+#include "rng.h"
+#include "scorer.h"
 #include "set.h"
+#include "stats.h"
 #include "priorityqueue.h"
 
 
+// How a generator with a bounded budget finished
+enum GenerationStatus {
+    // The plan is valid
+    VALID_PLAN,
+    // The budget ran out before the plan could be made valid (the closest plan is returned)
+    BUDGET_EXHAUSTED,
+    // A plan with the requested number of districts could never be built
+    NO_STARTING_PLAN,
+    // The job was cancelled, or ran past its deadline, before it finished (see "JobControl" in "jobs.h")
+    CANCELLED,
+    DEADLINE_EXCEEDED
+};
+
+// The outcome of a generator that runs with a bounded budget
+struct GenerationResult {
+    // The plan closest to valid that was found (only valid if status is VALID_PLAN)
+    Plan plan;
+    GenerationStatus status;
+    // How many repair steps (and restarts) were used
+    int iterations;
+};
+
+// The first check that a plan failed, see "Gerrymander::validatePlan(Plan, double)"
+enum ValidationFailure {
+    // The plan is valid
+    NO_FAILURE,
+    // The plan has no districts
+    NO_DISTRICTS,
+    // Some precincts are not in any district
+    UNASSIGNED_PRECINCTS,
+    // Some ids are not on the map, or are in more than one district
+    CONFLICTING_PRECINCTS,
+    // A district has no precincts
+    EMPTY_DISTRICT,
+    // The population of a district is outside the margin
+    POPULATION_OUTSIDE_MARGIN,
+    // A district is in more than one piece
+    NOT_CONTINUOUS
+};
+
+// Everything that was checked about a plan, so that a failure can be diagnosed without checking it again
+struct ValidationReport {
+    bool valid;
+    // The first check that failed (in the order "isValidPlan" makes them), and the district it failed on (-1 if none)
+    ValidationFailure failure;
+    int failedDistrict;
+    // How many precincts are in no district
+    int unassigned;
+    // How many ids are not on the map, or were already in another district ("Plan::conflictCount()")
+    int conflicts;
+    // The mean population that the districts are held to
+    int mean;
+    // district number => (population - mean) / mean
+    std::vector<double> deviations;
+    // district number => how many disconnected pieces it is in (1 if continuous, 0 if empty)
+    std::vector<int> pieces;
+};
+
+/* The scratch space of a single generation attempt (one per thread, see "generationScratch()"
+ * in "gerrymander.cpp").
+ *
+ * Every attempt resets it instead of allocating its own buffers, and the vectors are only
+ * ever cleared, never shrunk, so once they have grown to the size of the map the retry
+ * loops of the generators don't allocate.
+ */
+struct GenerationScratch {
+    /* A precinct of a district being grown by DFS, where its neighbors start in the shuffled buffer,
+     * and how many of them the search has visited
+     */
+    struct Frame {
+        int precinct;
+        int offset;
+        int visited;
+    };
+
+    // open[i] => the precinct at dense index i is not in a district yet
+    std::vector<char> open;
+    // The dense indices that haven't been picked as the start of a district yet (in no order)
+    std::vector<int> starts;
+    /* The open precincts bordering the district being grown greedily (the candidates), as a
+     * segment tree over every precinct sorted by margin (dem - rep votes).
+     *
+     * A candidate joins a district that the Democrats win if its margin is above (rep - dem)
+     * of the district, and the objective is linear in the votes on either side of that line,
+     * so on each side the candidates are ranked by a key that doesn't depend on the district.
+     */
+    // position => dense index (sorted by margin), and its margin
+    std::vector<int> byMargin;
+    std::vector<int> margins;
+    // dense index => its position, its keys if the Democrats/Republicans win the district it joins, and its random tie-breaker
+    std::vector<int> positionOf;
+    std::vector<int> demWinsKey;
+    std::vector<int> repWinsKey;
+    std::vector<int> tie;
+    // node => the best candidate below it on either side (NO_CANDIDATE if none), where the leaves are size + position
+    std::vector<int> bestDemWins;
+    std::vector<int> bestRepWins;
+    // The candidates as a min-heap by index (for when nothing raises the waste)
+    std::vector<int> lowest;
+    // The stack of the district being grown by DFS, and the neighbors of every precinct on it (shuffled as they are visited)
+    std::vector<Frame> stack;
+    std::vector<int> shuffled;
+
+    // Opens every precinct of a map of the given size, for a new attempt
+    void reset(int size) {
+        open.assign(size, true);
+        starts.resize(size);
+        for (int index = 0; index < size; index++) {
+            starts[index] = index;
+        }
+    }
+
+    /* Sorts the precincts by margin and keys them by the objective, for a new attempt at a
+     * greedy plan, O(n log n)
+     */
+    template <typename Objective>
+    void rankByMargin(const VotingMap& map) {
+        const int size = map.size();
+
+        // More votes than the whole map, so that the party they are added to wins whatever else is in the district
+        int votes = 1;
+        for (int index = 0; index < size; index++) {
+            DemographicView demo = map.demographicAt(index);
+            votes += demo.dem + demo.rep;
+        }
+
+        byMargin.resize(size);
+        margins.resize(size);
+        positionOf.resize(size);
+        demWinsKey.resize(size);
+        repWinsKey.resize(size);
+        tie.resize(size);
+        for (int index = 0; index < size; index++) {
+            DemographicView demo = map.demographicAt(index);
+            byMargin[index] = index;
+            demWinsKey[index] = Objective::value(votes + demo.dem, demo.rep);
+            repWinsKey[index] = Objective::value(demo.dem, votes + demo.rep);
+        }
+        auto margin = [&map](int index) {
+            DemographicView demo = map.demographicAt(index);
+            return demo.dem - demo.rep;
+        };
+        std::sort(byMargin.begin(), byMargin.end(), [&margin](int a, int b) {
+            return margin(a) < margin(b);
+        });
+        for (int position = 0; position < size; position++) {
+            positionOf[byMargin[position]] = position;
+            margins[position] = margin(byMargin[position]);
+        }
+
+        bestDemWins.assign(2 * size, NO_CANDIDATE);
+        bestRepWins.assign(2 * size, NO_CANDIDATE);
+    }
+
+    // Adds a precinct to the candidates (with the given tie-breaker), or removes it, O(log n)
+    void addCandidate(int index, int tieBreaker) {
+        tie[index] = tieBreaker;
+        updateCandidate(index, index);
+    }
+
+    void removeCandidate(int index) {
+        updateCandidate(index, NO_CANDIDATE);
+    }
+
+    /* Returns the best candidate that would join a district with the given (rep - dem) on the side
+     * of the Democrats (demWins) or of the Republicans, or NO_CANDIDATE if there is none, O(log n)
+     */
+    int bestCandidate(int repLead, bool demWins) const {
+        const int size = byMargin.size();
+        const int split = std::upper_bound(margins.begin(), margins.end(), repLead) - margins.begin();
+        const std::vector<int>& best = demWins ? bestDemWins : bestRepWins;
+
+        int result = NO_CANDIDATE;
+        int left = (demWins ? split : 0) + size;
+        int right = (demWins ? size : split) + size;
+        for (; left < right; left /= 2, right /= 2) {
+            if (left % 2 == 1) {
+                result = better(result, best[left++], demWins);
+            }
+            if (right % 2 == 1) {
+                result = better(result, best[--right], demWins);
+            }
+        }
+        return result;
+    }
+
+    // Removes a random index from the starts and returns it, O(1) (the last start is swapped into its place)
+    template <typename Random>
+    int takeStart(Random& rng) {
+        int pick = rng.nextInt(0, int(starts.size()) - 1);
+        int start = starts[pick];
+        starts[pick] = starts.back();
+        starts.pop_back();
+        return start;
+    }
+
+private:
+    static constexpr int NO_CANDIDATE = -1;
+
+    // Returns the better of 2 candidates on one side (by key, then tie-breaker, then index)
+    int better(int a, int b, bool demWins) const {
+        if (a == NO_CANDIDATE || b == NO_CANDIDATE) {
+            return (a == NO_CANDIDATE) ? b : a;
+        }
+        const std::vector<int>& key = demWins ? demWinsKey : repWinsKey;
+        if (key[a] != key[b]) {
+            return key[a] > key[b] ? a : b;
+        }
+        if (tie[a] != tie[b]) {
+            return tie[a] > tie[b] ? a : b;
+        }
+        return std::max(a, b);
+    }
+
+    // Sets the leaf of a precinct to the given candidate, and updates the nodes above it
+    void updateCandidate(int index, int candidate) {
+        int node = positionOf[index] + int(byMargin.size());
+        bestDemWins[node] = candidate;
+        bestRepWins[node] = candidate;
+        for (node /= 2; node >= 1; node /= 2) {
+            bestDemWins[node] = better(bestDemWins[2 * node], bestDemWins[2 * node + 1], true);
+            bestRepWins[node] = better(bestRepWins[2 * node], bestRepWins[2 * node + 1], false);
+        }
+    }
+};
 
 class Gerrymander
 {
@@ -27,9 +263,16 @@ public:
     // Default constructor that implicitly initializes the VotingMap;
     Gerrymander();
 
-    // Adding an Area to the VotingMap
+    // Adding an Area to the VotingMap (which owns it, see "VotingMap::addArea")
+    void addArea(Area newArea);
     void addArea(Area* newArea);
     void addArea(int id, int dem, int rep, int pop, Set<int> adjacency);
+    // Bulk loads the precincts from files or streams (see "VotingMap::loadFromStreams(istream, istream)")
+    void loadFromFiles(const std::string& demographicsPath, const std::string& adjacencyPath);
+    void loadFromStreams(std::istream& demographics, std::istream& adjacency);
+    // Saves the precincts to, or opens them from, a binary snapshot (see "VotingMap::openSnapshot(string)")
+    void saveSnapshot(const std::string& path) const;
+    void openSnapshot(const std::string& path);
 
 
     // Determines if the proposed plan qualifies demographic constraints (contunious and similar population)
@@ -52,27 +295,152 @@ public:
     // Generates a random valid plan for a given number of districts
     Set<Set<int>> createRandomPlan(int totalDistricts) const;
 
+
+    /* The same operations over the dense Plan representation (the Set<Set<int>>
+     * versions above convert to and from these)
+     */
+    bool isValidPlan(const Plan& plan, double margin) const;
+    int howGerrymandered(const Plan& plan) const;
+    bool isGerrymandered(const Plan& plan, int margin) const;
+    Plan gerrymanderPlan(int totalDistricts, bool favorRep) const;
+    Plan naiveGerrymanderPlan(int totalDistricts, int margin) const;
+    Plan randomPlan(int totalDistricts) const;
+
+    /* Seeded versions of the generators, templated on the random number generator (any policy
+     * with the interface of RandomSource in "rng.h"), which makes every random choice.
+     *
+     * The same generator state always produces the same plan, and the seed of the generator
+     * is recorded in the plan. The versions without a generator seed an Rng from "random.h".
+     */
+    template <typename Random> Plan gerrymanderPlan(int totalDistricts, bool favorRep, Random& rng) const;
+    template <typename Random> Plan naiveGerrymanderPlan(int totalDistricts, int margin, Random& rng) const;
+    template <typename Random> Plan randomPlan(int totalDistricts, Random& rng) const;
+
+    /* Versions of the seeded generators that can be stopped: before every attempt they check
+     * whether the job was cancelled or is past its deadline (and stop with CANCELLED or
+     * DEADLINE_EXCEEDED), and they report their progress to the callback of the control.
+     * If stopped, the plan is the last attempt (or for "naiveGerrymanderPlan", the most
+     * gerrymandered valid plan seen, if any). The iterations are the attempts made.
+     */
+    template <typename Random> GenerationResult gerrymanderPlan(int totalDistricts, bool favorRep, const JobControl& control, Random& rng) const;
+    template <typename Random> GenerationResult naiveGerrymanderPlan(int totalDistricts, int margin, const JobControl& control, Random& rng) const;
+    template <typename Random> GenerationResult randomPlan(int totalDistricts, const JobControl& control, Random& rng) const;
+
+    /* Makes every check of "isValidPlan" (without stopping at the first failure) and reports
+     * which one failed first, along with the population deviation and number of pieces of every district
+     */
+    ValidationReport validatePlan(Set<Set<int>>& districts, double margin) const;
+    ValidationReport validatePlan(const Plan& plan, double margin) const;
+
+    /* Checks the same as "isValidPlan(Plan, double)", but the districts are searched on a number
+     * of threads (0 => one per core). Plans smaller than PARALLEL_VALIDATION_SIZE precincts are
+     * checked on the calling thread.
+     */
+    bool isValidPlanParallel(const Plan& plan, double margin, int workers = 0) const;
+
+    /* Scores count plans into out, with "scoreBatch(const Plan*, size_t, Score*)", which is
+     * the same as calling "howGerrymandered(Plan)" on each one. The validation can be skipped
+     * for plans that are known to be valid (e.g. the output of a generator).
+     */
+    void scoreBatch(const Plan* plans, size_t count, Score* out, bool validate = true) const;
+
+    /* Generators that build a near-valid plan (with exactly totalDistricts districts), then
+     * repair it by moving boundary precincts from over- to under-populated districts, using at
+     * most maxIterations steps, instead of retrying until a valid plan comes out.
+     */
+    GenerationResult repairedRandomPlan(int totalDistricts, double margin, int maxIterations) const;
+    GenerationResult repairedGerrymander(int totalDistricts, bool favorRep, double margin, int maxIterations) const;
+    template <typename Random> GenerationResult repairedRandomPlan(int totalDistricts, double margin, int maxIterations, Random& rng) const;
+    template <typename Random> GenerationResult repairedGerrymander(int totalDistricts, bool favorRep, double margin, int maxIterations, Random& rng) const;
+
+    /* The same, but the starting plans are compact plans built by multilevel graph partitioning
+     * (see "partition.h"), which are usually valid (or nearly) from the start, even on large maps
+     */
+    GenerationResult partitionedPlan(int totalDistricts, double margin, int maxIterations) const;
+    template <typename Random> GenerationResult partitionedPlan(int totalDistricts, double margin, int maxIterations, Random& rng) const;
+
+    /* Gerrymanders by simulated annealing (see "annealer.h"): a valid plan is built by
+     * "repairedGerrymander" (within maxIterations), then skewed for the party by boundary
+     * flips for as long as the schedule (and its time budget) allows. The best plan seen
+     * is returned, and handed to checkpoint (if given) whenever it improves.
+     */
+    GenerationResult annealedGerrymander(int totalDistricts, bool favorRep, double margin, int maxIterations,
+                                         const AnnealingSchedule& schedule,
+                                         AnnealingOptimizer::CheckpointCallback checkpoint = nullptr) const;
+    template <typename Random> GenerationResult annealedGerrymander(int totalDistricts, bool favorRep, double margin, int maxIterations,
+                                                                    const AnnealingSchedule& schedule,
+                                                                    AnnealingOptimizer::CheckpointCallback checkpoint, Random& rng) const;
+
+    /* Parallel generation, where each of the workers (0 => one per core) draws from its own
+     * stream of the given seed (a generator of type Random), and only reads the (shared) VotingMap
+     */
+    // Returns the first plan found by any worker whose Efficiency Gap is above margin (the others are cancelled)
+    template <typename Random = Rng>
+    Plan parallelNaiveGerrymander(int totalDistricts, int margin, int workers, uint64_t seed) const;
+    // Returns count random valid plans, plan i is always generated from stream i (regardless of the workers)
+    template <typename Random = Rng>
+    Vector<Plan> parallelRandomPlans(int totalDistricts, int count, int workers, uint64_t seed) const;
+
+    // Returns the VotingMap that plans are built over
+    const VotingMap& votingMap() const;
+
+    /* Returns the cache that isValidPlan(Plan, double) and howGerrymandered(Plan) remember
+     * their results in (for its hit and miss counters)
+     */
+    const PlanCache& planCache() const;
+    // Forgets every cached result
+    void clearPlanCache();
+
+    /* Returns what the generators and checks did since the last reset (attempts, why plans were
+     * turned down, how far districts grew, and the time spent generating, validating and scoring).
+     * The counts are kept per thread but shared by every Gerrymander in the process.
+     */
+    static GeneratorStats stats();
+    static void resetStats();
+
 private:
     // The only member variable, which holds a VotingMap (basically an adjacency graph)
     VotingMap map;
+    // The validity and score of recently seen plans (mutable, since checking a plan doesn't change the Gerrymander)
+    mutable PlanCache cache;
 
-    // Checks whether a given district is continuous, used in ""isValidPlan(Set, double)"
-    bool isContinuous(Set<int> district) const;
-    void isContinuousHelper(Set<int>& district, int start) const;
+    // The uncached versions of "isValidPlan(Plan, double)" and "howGerrymandered(Plan)"
+    bool checkPlan(const Plan& plan, double margin) const;
+    int scorePlan(const Plan& plan) const;
+    // The uncached version of "isValidPlanParallel(Plan, double, int)"
+    bool checkPlanParallel(const Plan& plan, double margin, int workers) const;
+    /* The checks that come before continuity (coverage, then the size and population of every district,
+     * in order), shared by every validation path. Returns the first failure and sets failedDistrict to
+     * the district it failed on (-1 if none), counting the rejection in stats (if it isn't null), O(districts)
+     */
+    ValidationFailure checkCoverageAndPopulation(const Plan& plan, double margin, int& failedDistrict, ThreadStats* stats) const;
 
     // Intermediate steps that are used for the "gerrymander(int, bool)" method
-    void gerrymanderHelper(Set<Set<int>>& districts, int totalDistricts, bool favorRep, Set<int>& ids) const;
-    void createGerrymanderedDistrict(Set<int>& district,  Demographic& demo, int curID, const int& maxPop, bool favorRep, Set<int>& adj, Set<int>& ids) const;
+    template <typename Random> bool tryGerrymander(Plan& plan, int totalDistricts, bool favorRep, Random& rng) const;
+    template <typename Random> void gerrymanderHelper(Plan& plan, int totalDistricts, bool favorRep, Random& rng) const;
+    template <typename Objective, typename Random> void gerrymanderHelper(Plan& plan, int totalDistricts, Random& rng) const;
+    template <typename Objective, typename Random> void createGerrymanderedDistrict(Plan& plan, int district, int start, int maxPop, GenerationScratch& scratch, Random& rng) const;
 
 
     // Intermediate steps that are used for the "createRandomPlan(int)" method
-    void createRandomPlanHelper(Set<Set<int>>& districts, int totalDistricts, Set<int>& ids) const;
-    void createRandomDistrict(Set<int>& district, int curID, int& districtPop, const int& maxPop, Set<int>& ids) const;
+    template <typename Random> bool tryRandomPlan(Plan& plan, int totalDistricts, Random& rng) const;
+    template <typename Random> void createRandomPlanHelper(Plan& plan, int totalDistricts, Random& rng) const;
+    template <typename Random> void createRandomDistrict(Plan& plan, int district, int start, int maxPop, GenerationScratch& scratch, Random& rng) const;
+
+
+    // Intermediate steps that are used for the "repaired" generators
+    template <typename Build, typename Random> GenerationResult repairedPlan(int totalDistricts, double margin, int maxIterations, Random& rng, Build build) const;
+    bool mergeIntoDistricts(Plan& plan, int totalDistricts) const;
+    bool repairStep(Plan& plan, BoundaryIndex& boundary, double margin) const;
 
 
     // 2 utility functions that calculate "waste" for the Efficiency Gap
-    int repWasted(int dem, int rep) const;
-    int demWasted(int dem, int rep) const;
+    static constexpr int repWasted(int dem, int rep) {
+        return wastedRepVotes(dem, rep);
+    }
+    static constexpr int demWasted(int dem, int rep) {
+        return wastedDemVotes(dem, rep);
+    }
 
     // A utility function that transforms a given set into a vector (to randomize selection)
     Vector<int> setToVector(Set<int>& intSet) const;
@@ -0,0 +1,158 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the cancellation tokens and the job pool.
+ */
+
+#include "jobs.h"
+
+#include <algorithm>
+
+#include "error.h"
+#include "testing/SimpleTest.h"
+
+CancellationToken::CancellationToken() : state(std::make_shared<State>()) {}
+
+void CancellationToken::cancel() const {
+    state->cancelled.store(true, std::memory_order_release);
+}
+
+bool CancellationToken::isCancelled() const {
+    return isCancelled(*state);
+}
+
+bool CancellationToken::isCancelled(const State& state) {
+    if (state.cancelled.load(std::memory_order_acquire)) {
+        return true;
+    }
+    for (const std::shared_ptr<const State>& link : state.links) {
+        if (isCancelled(*link)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+CancellationToken CancellationToken::linkedWith(const CancellationToken& other) const {
+    CancellationToken linked;
+    linked.state->links.push_back(state);
+    linked.state->links.push_back(other.state);
+    return linked;
+}
+
+JobPool::JobPool(int workers) : stopping(false) {
+    if (workers <= 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int worker = 0; worker < workers; worker++) {
+        threads.emplace_back([this]() {
+            work();
+        });
+    }
+}
+
+JobPool::~JobPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+int JobPool::workerCount() const {
+    return threads.size();
+}
+
+int JobPool::pendingCount() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return queue.size();
+}
+
+void JobPool::enqueue(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(std::move(job));
+    }
+    ready.notify_one();
+}
+
+void JobPool::work() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [this]() {
+                return stopping || !queue.empty();
+            });
+            if (queue.empty()) {
+                return;
+            }
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        // The packaged task keeps any exception for the future
+        job();
+    }
+}
+
+
+/************** TESTS **************/
+
+STUDENT_TEST("Cancelling linked tokens") {
+    CancellationToken first;
+    CancellationToken second;
+    CancellationToken linked = first.linkedWith(second);
+    CancellationToken copy = linked;
+    EXPECT(!linked.isCancelled());
+
+    // Cancelling a linked token doesn't reach the tokens it was linked with
+    copy.cancel();
+    EXPECT(linked.isCancelled());
+    EXPECT(!first.isCancelled() && !second.isCancelled());
+
+    CancellationToken again = first.linkedWith(second);
+    second.cancel();
+    EXPECT(again.isCancelled());
+    EXPECT(!first.isCancelled());
+}
+
+STUDENT_TEST("Running jobs on a pool") {
+    JobPool pool(2);
+    EXPECT_EQUAL(pool.workerCount(), 2);
+
+    std::vector<std::future<int>> futures;
+    for (int i = 0; i < 10; i++) {
+        futures.push_back(pool.submit([i]() {
+            return i * i;
+        }));
+    }
+    int total = 0;
+    for (std::future<int>& future : futures) {
+        total += future.get();
+    }
+    EXPECT_EQUAL(total, 285);
+
+    // Exceptions reach the caller through the future
+    std::future<int> failing = pool.submit([]() -> int {
+        error("failed");
+        return 0;
+    });
+    EXPECT_ERROR(failing.get());
+
+    // A handle can be waited on, and its token cancels the job
+    CancellationToken token;
+    JobHandle<int> handle(pool.submit([token]() {
+        int spins = 0;
+        while (!token.isCancelled()) {
+            spins++;
+            std::this_thread::yield();
+        }
+        return spins >= 0 ? 1 : 0;
+    }), token);
+    EXPECT(!handle.waitFor(10));
+    handle.cancel();
+    EXPECT_EQUAL(handle.get(), 1);
+    EXPECT(handle.isDone());
+}
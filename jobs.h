@@ -0,0 +1,180 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the pieces that let a generator run as a job: a
+ * CancellationToken, the JobControl that the generation loops check
+ * before every attempt (cancellation, a deadline, and a progress
+ * callback), and the JobPool of threads that the jobs are run on.
+ *
+ * The asynchronous front-end of the Gerrymander class is in "async.h".
+ */
+
+#pragma once
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A flag that can be raised from any thread, to ask the jobs holding it to stop.
+ *
+ * Copies share the same flag, and a linked token is also cancelled by the tokens it was
+ * linked with (but cancelling it doesn't cancel them).
+ */
+class CancellationToken
+{
+public:
+    // Creates a token that isn't cancelled
+    CancellationToken();
+
+    // Asks every job holding the token (or a token linked with it) to stop
+    void cancel() const;
+    // Returns whether the token, or any token it was linked with, was cancelled, O(links)
+    bool isCancelled() const;
+
+    // Returns a new token that is cancelled along with this one and other
+    CancellationToken linkedWith(const CancellationToken& other) const;
+
+private:
+    struct State {
+        std::atomic<bool> cancelled{false};
+        // Never changed after the token is created, so they can be read without a lock
+        std::vector<std::shared_ptr<const State>> links;
+    };
+
+    std::shared_ptr<State> state;
+
+    static bool isCancelled(const State& state);
+};
+
+// How far a job has got, handed to its progress callback
+struct JobProgress {
+    // The attempts (plans generated) made so far
+    int attempts;
+    // The highest Efficiency Gap percentage of the valid plans seen so far (-1 if none)
+    int bestScore;
+};
+
+// What a generation job checks before every attempt
+struct JobControl {
+    // Called every progressInterval attempts, and once when the job finishes (on the thread of the job)
+    typedef std::function<void(const JobProgress& progress)> ProgressCallback;
+    typedef std::chrono::steady_clock Clock;
+
+    CancellationToken token;
+    // The job stops at its first check after the deadline (the latest time point => no deadline)
+    Clock::time_point deadline = Clock::time_point::max();
+    ProgressCallback progress = nullptr;
+    int progressInterval = 100;
+
+    // Sets the deadline to the given number of milliseconds from now
+    void setTimeLimit(int milliseconds) {
+        deadline = Clock::now() + std::chrono::milliseconds(milliseconds);
+    }
+
+    bool isCancelled() const {
+        return token.isCancelled();
+    }
+
+    // Only reads the clock if there is a deadline
+    bool isPastDeadline() const {
+        return deadline != Clock::time_point::max() && Clock::now() >= deadline;
+    }
+
+    // Reports the progress if it is due (every progressInterval attempts)
+    void reportEvery(int attempts, int bestScore) const {
+        if (progress && progressInterval > 0 && attempts % progressInterval == 0) {
+            progress({attempts, bestScore});
+        }
+    }
+};
+
+/* A fixed number of threads that take jobs off a queue, in the order they were submitted.
+ *
+ * The destructor lets the jobs that were already submitted finish (cancel them first to
+ * shut down quickly), then waits for the threads.
+ */
+class JobPool
+{
+public:
+    // Starts the threads (0 => one per core)
+    explicit JobPool(int workers = 0);
+    ~JobPool();
+
+    JobPool(const JobPool&) = delete;
+    JobPool& operator=(const JobPool&) = delete;
+
+    // Queues work(), and returns the future of its result (or of the exception it threw)
+    template <typename Work>
+    auto submit(Work work) -> std::future<decltype(work())> {
+        typedef decltype(work()) Result;
+        std::shared_ptr<std::packaged_task<Result()>> task = std::make_shared<std::packaged_task<Result()>>(std::move(work));
+        std::future<Result> future = task->get_future();
+        enqueue([task]() {
+            (*task)();
+        });
+        return future;
+    }
+
+    int workerCount() const;
+    // Returns how many jobs are waiting for a thread
+    int pendingCount() const;
+
+private:
+    mutable std::mutex lock;
+    std::condition_variable ready;
+    std::deque<std::function<void()>> queue;
+    std::vector<std::thread> threads;
+    bool stopping;
+
+    void enqueue(std::function<void()> job);
+    // Runs jobs until the pool is stopping and the queue is empty
+    void work();
+};
+
+/* The handle of a job submitted to a JobPool, whose result can be waited for (by any
+ * number of threads), and which can be asked to stop through its token
+ */
+template <typename Result>
+class JobHandle
+{
+public:
+    JobHandle(std::future<Result> future, CancellationToken token) : future(future.share()), cancellation(token) {}
+
+    // Asks the job to stop at its next check (it still finishes with a result)
+    void cancel() const {
+        cancellation.cancel();
+    }
+
+    bool isDone() const {
+        return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    // Waits for the job for at most the given number of milliseconds, and returns whether it is done
+    bool waitFor(int milliseconds) const {
+        return future.wait_for(std::chrono::milliseconds(milliseconds)) == std::future_status::ready;
+    }
+
+    // Waits for the job, and returns its result (or throws the exception the job threw)
+    const Result& get() const {
+        return future.get();
+    }
+
+    const CancellationToken& token() const {
+        return cancellation;
+    }
+
+private:
+    std::shared_future<Result> future;
+    CancellationToken cancellation;
+};
+
+#endif // JOBS_H
@@ -4,15 +4,34 @@
  * Sample QT project
  */
 
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
 #include "console.h"
+#include "benchmark.h"
+#include "error.h"
 #include "testing/SimpleTest.h"
 using namespace std;
 
 /*
  * This sample main brings up testing menu.
+ *
+ * With the "--benchmark" argument, it runs the benchmark suite instead
+ * (see "benchmark.h"), printing one line of JSON per result. The arguments
+ * after it pick the maps, sizes, samples and time budget.
  */
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+        try {
+            runBenchmarks(parseBenchmarkOptions(vector<string>(argv + 2, argv + argc)), cout);
+        } catch (const ErrorException& e) {
+            cerr << e.getMessage() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
     if (runSimpleTests(SELECTED_TESTS)) {
         return 0;
     }
@@ -0,0 +1,191 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the fairness metrics.
+ *
+ * tallyPlan() is the only function that looks at the plan, every
+ * metric only reads the tallies (in O(1) or O(log districts)).
+ */
+
+#include "metrics.h"
+
+#include <algorithm>
+
+#include "scorer.h"
+#include "strlib.h"
+#include "testing/SimpleTest.h"
+#include "testmaps.h"
+
+/*
+ * One pass over the districts (for the votes, waste, seats and vote shares), one sort
+ * of the vote shares (for the median and the seats-votes curve), and one pass over the
+ * borders (for the cut edges, where each border is seen from both sides).
+ */
+PlanTallies tallyPlan(const Plan& plan) {
+    PlanTallies tallies{{}, 0.5, 0, 0, 0, 0, 0, 0};
+    tallies.demShares.reserve(plan.districtCount());
+
+    for (int district = 0; district < plan.districtCount(); district++) {    // O(districts)
+        int dem = plan.districtDem(district);
+        int rep = plan.districtRep(district);
+
+        tallies.demVotes += dem;
+        tallies.repVotes += rep;
+        tallies.demWaste += wastedDemVotes(dem, rep);
+        tallies.repWaste += wastedRepVotes(dem, rep);
+        tallies.demSeats += dem > rep;
+        tallies.demShares.push_back((dem + rep == 0) ? 0.5 : double(dem) / (dem + rep));
+    }
+    std::sort(tallies.demShares.begin(), tallies.demShares.end());      // O(districts log districts)
+
+    if (tallies.demVotes + tallies.repVotes > 0) {
+        tallies.statewideShare = double(tallies.demVotes) / (tallies.demVotes + tallies.repVotes);
+    }
+
+    // Every border is counted from its lower index, unless only the higher one lists it
+    const VotingMap& map = plan.votingMap();
+    int crossings = 0;
+    for (int index = 0; index < plan.size(); index++) {     // O(E), and O(log degree) per cut border listed from above
+        for (int next : map.neighborsOf(index)) {
+            if (plan.districtOf(index) == plan.districtOf(next)) {
+                continue;
+            }
+            NeighborView back = map.neighborsOf(next);
+            crossings += index < next || !std::binary_search(back.begin(), back.end(), index);
+        }
+    }
+    tallies.cutEdges = crossings;
+
+    return tallies;
+}
+
+/*
+ * Swinging every district by the same amount moves the statewide share to voteShare, so
+ * the Democrats win every district whose share is above 0.5 - (voteShare - statewideShare),
+ * which is found with a binary search of the sorted shares
+ */
+double seatsAtVoteShare(const PlanTallies& tallies, double voteShare) {
+    if (tallies.demShares.empty()) {
+        return 0;
+    }
+
+    double threshold = 0.5 - (voteShare - tallies.statewideShare);
+    auto firstWon = std::upper_bound(tallies.demShares.begin(), tallies.demShares.end(), threshold);
+    return double(tallies.demShares.end() - firstWon) / tallies.demShares.size();
+}
+
+Metric efficiencyGapMetric() {
+    return Metric{"efficiency gap", [](const PlanTallies& tallies) {
+        int votes = tallies.demVotes + tallies.repVotes;
+        return (votes == 0) ? 0.0 : double(tallies.demWaste - tallies.repWaste) / votes;
+    }};
+}
+
+/*
+ * If the Democrats are packed into a few districts, their median district share
+ * is below their mean one
+ */
+Metric meanMedianMetric() {
+    return Metric{"mean-median", [](const PlanTallies& tallies) {
+        const std::vector<double>& shares = tallies.demShares;
+        if (shares.empty()) {
+            return 0.0;
+        }
+
+        double mean = 0;
+        for (double share : shares) {
+            mean += share;
+        }
+        mean /= shares.size();
+
+        size_t middle = shares.size() / 2;
+        double median = (shares.size() % 2 == 1) ? shares[middle] : (shares[middle - 1] + shares[middle]) / 2;
+        return mean - median;
+    }};
+}
+
+Metric partisanBiasMetric() {
+    return Metric{"partisan bias", [](const PlanTallies& tallies) {
+        return 0.5 - seatsAtVoteShare(tallies, 0.5);
+    }};
+}
+
+Metric seatsVotesMetric(double voteShare) {
+    return Metric{"seats at " + realToString(voteShare) + " of the vote", [voteShare](const PlanTallies& tallies) {
+        return seatsAtVoteShare(tallies, voteShare);
+    }};
+}
+
+Metric cutEdgesMetric() {
+    return Metric{"cut edges", [](const PlanTallies& tallies) {
+        return double(tallies.cutEdges);
+    }};
+}
+
+Vector<Metric> standardMetrics() {
+    Vector<Metric> metrics = {efficiencyGapMetric(), meanMedianMetric(), partisanBiasMetric(), cutEdgesMetric()};
+    for (int percent = 30; percent <= 70; percent += 5) {
+        metrics.add(seatsVotesMetric(percent / 100.0));
+    }
+    return metrics;
+}
+
+std::vector<double> computeMetrics(const Plan& plan, const Vector<Metric>& metrics) {
+    std::vector<double> values(metrics.size());
+    computeMetrics(&plan, 1, metrics, values.data());
+    return values;
+}
+
+void computeMetrics(const Plan* plans, size_t count, const Vector<Metric>& metrics, double* out) {
+    for (size_t i = 0; i < count; i++) {
+        PlanTallies tallies = tallyPlan(plans[i]);
+        for (const Metric& metric : metrics) {
+            *out++ = metric.compute(tallies);
+        }
+    }
+}
+
+
+/************** TESTS **************/
+
+STUDENT_TEST("Computing fairness metrics in one pass") {
+    // 10x5 grid where the 2 left columns vote Democrat
+    VotingMap map;
+    addGridMap(map, 5, 10, [](int id) { return oneVote(id % 5 < 2); });
+
+    // Cracking => rows of 2, so every district is 40% Democrat
+    Plan cracked(map, 5);
+    for (int index = 0; index < 50; index++) {
+        cracked.assign(index, index / 10);
+    }
+
+    PlanTallies tallies = tallyPlan(cracked);
+    EXPECT_EQUAL(tallies.demSeats, 0);
+    EXPECT_EQUAL(tallies.statewideShare, 0.4);
+    EXPECT_EQUAL(tallies.cutEdges, 4 * 5);
+
+    std::vector<double> values = computeMetrics(cracked, standardMetrics());
+    EXPECT_EQUAL(values[0], EfficiencyGapScorer(cracked).efficiencyGap());
+    EXPECT_EQUAL(values[1], 0.0);
+    // With half the vote, every (identical) district swings to exactly 50%, which is a tie
+    EXPECT_EQUAL(values[2], 0.5);
+    EXPECT_EQUAL(seatsAtVoteShare(tallies, 0.55), 1.0);
+    EXPECT_EQUAL(seatsAtVoteShare(tallies, 0.4), 0.0);
+
+    // Packing => the Democratic columns are 2 districts of their own
+    Plan packed(map, 5);
+    for (int index = 0; index < 50; index++) {
+        packed.assign(index, index % 5);
+    }
+
+    Vector<Metric> metrics = {meanMedianMetric(), cutEdgesMetric(), seatsVotesMetric(0.4)};
+    double batch[6];
+    Plan plans[] = {cracked, packed};
+    computeMetrics(plans, 2, metrics, batch);
+    EXPECT_EQUAL(batch[3], 0.4 - 0.0);
+    EXPECT_EQUAL(batch[4], 4.0 * 10);
+    EXPECT_EQUAL(batch[5], 0.4);
+
+    // Metrics can be added next to the standard ones
+    Vector<Metric> custom = {Metric{"seats", [](const PlanTallies& t) { return double(t.demSeats); }}};
+    EXPECT_EQUAL(computeMetrics(packed, custom)[0], 2.0);
+}
@@ -0,0 +1,83 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the fairness metrics (besides the Efficiency Gap's
+ * truncated percentage in "Gerrymander::howGerrymandered").
+ *
+ * Every metric is computed from the PlanTallies of a plan, which are
+ * gathered in a single pass over its districts (and its borders), so
+ * asking for more metrics doesn't mean more passes over the plan:
+ *
+ * Efficiency Gap => (demWaste - repWaste) / votes
+ * Mean-median => the mean Democratic vote share of the districts, minus the median one
+ * Partisan bias => half the seats, minus the seats the Democrats would win with half the votes
+ * Seats-votes => the share of seats the Democrats would win with a given share of the votes
+ * Cut edges => the number of borders between 2 districts (fewer means more compact districts)
+ *
+ * The vote share of a district is its share of the 2 party vote, and the seats for any
+ * other share of the vote come from swinging every district by the same amount (uniform swing).
+ * Apart from the cut edges, a positive number means the plan favors Republicans, like the
+ * signed Efficiency Gap of "EfficiencyGapScorer".
+ */
+
+#pragma once
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "plan.h"
+#include "vector.h"
+
+// Everything the metrics are computed from
+struct PlanTallies {
+    // The Democratic share of the 2 party vote in every district, sorted
+    std::vector<double> demShares;
+    // The Democratic share of the 2 party vote over the whole plan
+    double statewideShare;
+    // Votes over every district
+    int demVotes;
+    int repVotes;
+    // Wasted votes summed over every district
+    int demWaste;
+    int repWaste;
+    // Districts won by the Democrats
+    int demSeats;
+    // Borders between precincts in different districts
+    int cutEdges;
+};
+
+// Gathers the tallies of a (fully assigned) plan, O(districts log districts + E)
+PlanTallies tallyPlan(const Plan& plan);
+
+// Returns the share of the seats the Democrats win with the given share of the vote (with uniform swing), O(log districts)
+double seatsAtVoteShare(const PlanTallies& tallies, double voteShare);
+
+/* A metric is a name and a function of the tallies, so any other metric can be plugged
+ * in next to the ones below
+ */
+struct Metric {
+    std::string name;
+    std::function<double(const PlanTallies&)> compute;
+};
+
+Metric efficiencyGapMetric();
+Metric meanMedianMetric();
+Metric partisanBiasMetric();
+Metric seatsVotesMetric(double voteShare);
+Metric cutEdgesMetric();
+
+// Every metric above, with the seats-votes curve sampled from 30% to 70% of the vote (in steps of 5%)
+Vector<Metric> standardMetrics();
+
+// Returns the value of every metric for the plan, in order, from a single tally
+std::vector<double> computeMetrics(const Plan& plan, const Vector<Metric>& metrics);
+
+/* Computes the metrics of count plans into out (metrics.size() values per plan, one
+ * plan after the other), tallying each plan once
+ */
+void computeMetrics(const Plan* plans, size_t count, const Vector<Metric>& metrics, double* out);
+
+#endif // METRICS_H
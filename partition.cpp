@@ -0,0 +1,514 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the MultilevelPartitioner class.
+ *
+ * Parts are numbered like the districts of a Plan, and nodes that
+ * aren't in any part yet are NO_PART.
+ */
+
+#include "partition.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "contiguity.h"
+#include "error.h"
+#include "strlib.h"
+#include "testing/SimpleTest.h"
+#include "testmaps.h"
+
+// The part of a node that isn't in any part
+const int NO_PART = -1;
+// The coarsening stops once the graph has at most this many nodes per district
+const int COARSEST_NODES_PER_DISTRICT = 20;
+// ... or once a level is less than this fraction smaller than the one before (the matching has stalled)
+const double MIN_SHRINK = 0.05;
+// A coarse node can hold at most this fraction of a district's population (so that the districts can still be balanced)
+const double MAX_NODE_SHARE = 0.1;
+// How many times the refinement goes over the nodes of each level
+const int REFINE_PASSES = 8;
+// How many nodes the connectivity check of a move looks at before it turns the move down
+const int MOVE_SEARCH_LIMIT = 64;
+
+MultilevelPartitioner::MultilevelPartitioner(const VotingMap& map, uint64_t seed)
+    : map(&map), rng(seed), stamp(0) {}
+
+/*
+ * Coarsens the precinct graph level by level, partitions the coarsest graph, and then
+ * projects the parts back down one level at a time, refining them at every level
+ */
+Plan MultilevelPartitioner::partition(int totalDistricts, double tolerance) {
+    if (totalDistricts <= 0 || totalDistricts > map->size()) {
+        error("MultilevelPartitioner: can't partition " + integerToString(map->size())
+              + " precincts into " + integerToString(totalDistricts) + " districts");
+    }
+    map->freeze();
+
+    levels.clear();
+    coarser.clear();
+    levels.push_back(precinctGraph());
+
+    const int coarsestSize = COARSEST_NODES_PER_DISTRICT * totalDistricts;
+    const int maxWeight = std::max(1, int(MAX_NODE_SHARE * map->totalPop() / totalDistricts));
+    while (levels.back().size() > coarsestSize) {       // O(n + e) per level
+        std::vector<int> parent;
+        Graph coarse = coarsen(levels.back(), maxWeight, parent);
+        if (coarse.size() > levels.back().size() * (1 - MIN_SHRINK)) {
+            break;
+        }
+
+        coarser.push_back(std::move(parent));
+        levels.push_back(std::move(coarse));
+    }
+
+    std::vector<int> parts = growParts(levels.back(), totalDistricts);
+    reconnect(levels.back(), parts);
+    refine(levels.back(), parts, totalDistricts, tolerance);
+
+    for (int level = int(levels.size()) - 2; level >= 0; level--) {
+        std::vector<int> finer(levels[level].size());
+        for (int node = 0; node < levels[level].size(); node++) {
+            finer[node] = parts[coarser[level][node]];
+        }
+        parts.swap(finer);
+        refine(levels[level], parts, totalDistricts, tolerance);
+    }
+
+    Plan plan(*map, totalDistricts);
+    for (int index = 0; index < plan.size(); index++) {
+        if (parts[index] != NO_PART) {
+            plan.assign(index, parts[index]);
+        }
+    }
+    return plan;
+}
+
+int MultilevelPartitioner::levelCount() const {
+    return levels.size();
+}
+
+/*
+ * The finest level, which is the map's own compact layout with every border weighing 1
+ */
+MultilevelPartitioner::Graph MultilevelPartitioner::precinctGraph() const {
+    Graph graph;
+    graph.offsets.push_back(0);
+
+    for (int index = 0; index < map->size(); index++) {
+        graph.weight.push_back(map->popAt(index));
+        for (int next : map->neighborsOf(index)) {
+            graph.neighbors.push_back(next);
+        }
+        graph.offsets.push_back(graph.neighbors.size());
+    }
+    graph.edgeWeights.assign(graph.neighbors.size(), 1);
+
+    return graph;
+}
+
+/*
+ * Heavy-edge matching: the nodes are visited in a random order, and every node that
+ * isn't matched yet is matched with the unmatched neighbor it shares the heaviest edge
+ * with (the lightest one, if there is a tie), unless the pair would weigh more than
+ * maxWeight. Nodes without a match carry on alone.
+ *
+ * Every pair becomes a node of the coarse graph, and the edges of both halves are
+ * added up into the edges of the pair (edges between the halves are dropped).
+ */
+MultilevelPartitioner::Graph MultilevelPartitioner::coarsen(const Graph& fine, int maxWeight, std::vector<int>& parent) {
+    const int n = fine.size();
+
+    std::vector<int> order(n);
+    for (int node = 0; node < n; node++) {
+        order[node] = node;
+    }
+    for (int i = n - 1; i > 0; i--) {
+        std::swap(order[i], order[rng.nextInt(0, i)]);
+    }
+
+    std::vector<int> match(n, NO_PART);
+    for (int node : order) {                            // O(n + e)
+        if (match[node] != NO_PART) {
+            continue;
+        }
+
+        int best = node;
+        int bestEdge = 0;
+        for (int i = fine.offsets[node]; i < fine.offsets[node + 1]; i++) {
+            int next = fine.neighbors[i];
+            int edge = fine.edgeWeights[i];
+            if (match[next] != NO_PART || fine.weight[node] + fine.weight[next] > maxWeight) {
+                continue;
+            }
+            if (edge > bestEdge || (edge == bestEdge && fine.weight[next] < fine.weight[best])) {
+                best = next;
+                bestEdge = edge;
+            }
+        }
+
+        match[node] = best;
+        match[best] = node;
+    }
+
+    // Numbers the pairs in the order of their first node
+    Graph coarse;
+    std::vector<int> firsts;
+    parent.assign(n, NO_PART);
+    for (int node = 0; node < n; node++) {
+        if (parent[node] == NO_PART) {
+            parent[node] = parent[match[node]] = coarse.size();
+            firsts.push_back(node);
+            coarse.weight.push_back(fine.weight[node] + (match[node] != node ? fine.weight[match[node]] : 0));
+        }
+    }
+
+    // slot[c] => where the edge to c is in the row being built (before the row's start if there is none)
+    std::vector<int> slot(coarse.size(), -1);
+    coarse.offsets.push_back(0);
+    for (int pair = 0; pair < coarse.size(); pair++) {  // O(n + e)
+        const int rowStart = coarse.neighbors.size();
+        const int halves[2] = {firsts[pair], match[firsts[pair]]};
+
+        for (int half = 0; half < ((halves[0] == halves[1]) ? 1 : 2); half++) {
+            int node = halves[half];
+            for (int i = fine.offsets[node]; i < fine.offsets[node + 1]; i++) {
+                int next = parent[fine.neighbors[i]];
+                if (next == pair) {
+                    continue;
+                }
+
+                if (slot[next] < rowStart) {
+                    slot[next] = coarse.neighbors.size();
+                    coarse.neighbors.push_back(next);
+                    coarse.edgeWeights.push_back(fine.edgeWeights[i]);
+                } else {
+                    coarse.edgeWeights[slot[next]] += fine.edgeWeights[i];
+                }
+            }
+        }
+        coarse.offsets.push_back(coarse.neighbors.size());
+    }
+
+    return coarse;
+}
+
+/*
+ * Grows the parts one at a time by BFS, each one until it holds its share of the
+ * population that is left (the last part takes everything it can reach).
+ *
+ * The seed of every part is the first free node of a BFS sweep over the whole graph
+ * from a random node, so each part starts next to the ones before it, and the nodes
+ * that are left over stay in one piece.
+ */
+std::vector<int> MultilevelPartitioner::growParts(const Graph& graph, int totalDistricts) {
+    const int n = graph.size();
+    std::vector<int> parts(n, NO_PART);
+
+    // The sweep (nodes that the BFS can't reach are added in index order)
+    std::vector<int> sweep;
+    std::vector<char> swept(n, false);
+    int unswept = 0;
+    int start = rng.nextInt(0, n - 1);
+    while (int(sweep.size()) < n) {
+        swept[start] = true;
+        sweep.push_back(start);
+        for (size_t head = sweep.size() - 1; head < sweep.size(); head++) {
+            int cur = sweep[head];
+            for (int i = graph.offsets[cur]; i < graph.offsets[cur + 1]; i++) {
+                if (!swept[graph.neighbors[i]]) {
+                    swept[graph.neighbors[i]] = true;
+                    sweep.push_back(graph.neighbors[i]);
+                }
+            }
+        }
+        while (unswept < n && swept[unswept]) {
+            unswept++;
+        }
+        start = unswept;
+    }
+
+    double remaining = 0;
+    for (int node = 0; node < n; node++) {
+        remaining += graph.weight[node];
+    }
+
+    int next = 0;
+    for (int part = 0; part < totalDistricts; part++) {
+        while (next < n && parts[sweep[next]] != NO_PART) {
+            next++;
+        }
+        if (next == n) {
+            break;
+        }
+
+        const bool last = (part == totalDistricts - 1);
+        const double share = remaining / (totalDistricts - part);
+        double weight = graph.weight[sweep[next]];
+        parts[sweep[next]] = part;
+
+        // BFS, adding every free neighbor that fits (nodes are added if they are at least half inside the share)
+        std::vector<int>& grown = queue;
+        grown.assign(1, sweep[next]);
+        for (size_t head = 0; head < grown.size() && (last || weight < share); head++) {
+            int cur = grown[head];
+            for (int i = graph.offsets[cur]; i < graph.offsets[cur + 1]; i++) {
+                int neighbor = graph.neighbors[i];
+                if (parts[neighbor] == NO_PART && (last || weight + graph.weight[neighbor] / 2.0 <= share)) {
+                    parts[neighbor] = part;
+                    weight += graph.weight[neighbor];
+                    grown.push_back(neighbor);
+                }
+            }
+        }
+
+        remaining -= weight;
+    }
+
+    return parts;
+}
+
+/*
+ * Keeps the largest piece (by nodes) of every part, and floods the other pieces, and the
+ * nodes that aren't in a part, from the pieces that were kept (BFS from all of them at once).
+ *
+ * Every node joins a part that it borders, so every part stays in one piece.
+ */
+void MultilevelPartitioner::reconnect(const Graph& graph, std::vector<int>& parts) const {
+    const int n = graph.size();
+
+    // piece[node] => the piece it is in, and the largest piece of every part
+    std::vector<int> piece(n, NO_PART);
+    std::vector<int> pieceSizes;
+    std::vector<int> largest;
+    std::vector<int> search;
+
+    for (int node = 0; node < n; node++) {              // O(n + e)
+        int part = parts[node];
+        if (part == NO_PART || piece[node] != NO_PART) {
+            continue;
+        }
+
+        const int id = pieceSizes.size();
+        piece[node] = id;
+        search.assign(1, node);
+        for (size_t head = 0; head < search.size(); head++) {
+            int cur = search[head];
+            for (int i = graph.offsets[cur]; i < graph.offsets[cur + 1]; i++) {
+                int next = graph.neighbors[i];
+                if (parts[next] == part && piece[next] == NO_PART) {
+                    piece[next] = id;
+                    search.push_back(next);
+                }
+            }
+        }
+        pieceSizes.push_back(search.size());
+
+        if (part >= int(largest.size())) {
+            largest.resize(part + 1, NO_PART);
+        }
+        if (largest[part] == NO_PART || pieceSizes[largest[part]] < pieceSizes[id]) {
+            largest[part] = id;
+        }
+    }
+
+    search.clear();
+    for (int node = 0; node < n; node++) {
+        if (parts[node] != NO_PART && piece[node] != largest[parts[node]]) {
+            parts[node] = NO_PART;
+        }
+        if (parts[node] != NO_PART) {
+            search.push_back(node);
+        }
+    }
+
+    for (size_t head = 0; head < search.size(); head++) {   // O(n + e)
+        int cur = search[head];
+        for (int i = graph.offsets[cur]; i < graph.offsets[cur + 1]; i++) {
+            int next = graph.neighbors[i];
+            if (parts[next] == NO_PART) {
+                parts[next] = parts[cur];
+                search.push_back(next);
+            }
+        }
+    }
+}
+
+static double squared(double x) {
+    return x * x;
+}
+
+/*
+ * Moves nodes on the border of 2 parts, a pass at a time, until a pass makes no moves:
+ *
+ * While a part is outside the tolerance, a node may move out of it (or into it) if that
+ * lowers the squared deviation of the 2 parts from the mean. Otherwise, a node may move
+ * if it borders the other part more than its own (shortening the border), as long as
+ * both parts stay within the tolerance. Of the moves a node could make, balancing moves
+ * come first, then the ones that shorten the border the most.
+ *
+ * No move leaves a part empty, or splits it (see "canRemove").
+ */
+void MultilevelPartitioner::refine(const Graph& graph, std::vector<int>& parts, int totalDistricts, double tolerance) {
+    const int n = graph.size();
+    const double mean = double(map->totalPop()) / totalDistricts;
+    const double upper = mean * (1 + tolerance);
+    const double lower = mean * (1 - tolerance);
+
+    std::vector<double> partWeight(totalDistricts, 0);
+    std::vector<int> partSize(totalDistricts, 0);
+    for (int node = 0; node < n; node++) {
+        if (parts[node] != NO_PART) {
+            partWeight[parts[node]] += graph.weight[node];
+            partSize[parts[node]]++;
+        }
+    }
+
+    visitStamp.assign(n, 0);
+    neighborStamp.assign(n, 0);
+    stamp = 0;
+
+    // connection[part] => the weight of the edges between the current node and the part
+    std::vector<int> connection(totalDistricts, 0);
+    std::vector<int> touched;
+
+    for (int pass = 0; pass < REFINE_PASSES; pass++) {
+        int moves = 0;
+
+        for (int node = 0; node < n; node++) {          // O(n + e) per pass
+            const int from = parts[node];
+            if (from == NO_PART) {
+                continue;
+            }
+
+            touched.clear();
+            for (int i = graph.offsets[node]; i < graph.offsets[node + 1]; i++) {
+                int part = parts[graph.neighbors[i]];
+                if (part == NO_PART) {
+                    continue;
+                }
+                if (connection[part] == 0) {
+                    touched.push_back(part);
+                }
+                connection[part] += graph.edgeWeights[i];
+            }
+
+            const double weight = graph.weight[node];
+            int best = NO_PART;
+            bool bestBalances = false;
+            int bestCut = 0;
+            for (int to : touched) {
+                if (to == from) {
+                    continue;
+                }
+
+                double balanceGain = squared(partWeight[from] - mean) + squared(partWeight[to] - mean)
+                                   - squared(partWeight[from] - weight - mean) - squared(partWeight[to] + weight - mean);
+                int cutGain = connection[to] - connection[from];
+
+                bool balances = balanceGain > 0 && (partWeight[from] > upper || partWeight[to] < lower);
+                bool shortens = cutGain > 0 && partWeight[from] - weight >= lower && partWeight[to] + weight <= upper;
+                if (!balances && !shortens) {
+                    continue;
+                }
+                if (best == NO_PART || (balances && !bestBalances) || (balances == bestBalances && cutGain > bestCut)) {
+                    best = to;
+                    bestBalances = balances;
+                    bestCut = cutGain;
+                }
+            }
+
+            for (int part : touched) {
+                connection[part] = 0;
+            }
+
+            if (best != NO_PART && partSize[from] > 1 && canRemove(graph, parts, node)) {
+                parts[node] = best;
+                partWeight[from] -= weight;
+                partWeight[best] += weight;
+                partSize[from]--;
+                partSize[best]++;
+                moves++;
+            }
+        }
+
+        if (moves == 0) {
+            break;
+        }
+    }
+}
+
+/*
+ * Searches the part of the node (BFS, with the node itself as a wall) from one of its
+ * neighbors in the part, until every one of its neighbors in the part is reached.
+ *
+ * If they are all reached, any path through the node can go around it instead, so the
+ * part stays continuous. The search gives up after MOVE_SEARCH_LIMIT nodes, so it can
+ * turn down a move that would have been fine, but it never allows one that splits a part,
+ * and it costs O(1) per move.
+ */
+bool MultilevelPartitioner::canRemove(const Graph& graph, const std::vector<int>& parts, int node) {
+    const int part = parts[node];
+    stamp++;
+
+    int targets = 0;
+    int start = NO_PART;
+    for (int i = graph.offsets[node]; i < graph.offsets[node + 1]; i++) {
+        int next = graph.neighbors[i];
+        if (parts[next] == part) {
+            neighborStamp[next] = stamp;
+            targets++;
+            start = next;
+        }
+    }
+    if (targets <= 1) {
+        return targets == 1;
+    }
+
+    visitStamp[node] = stamp;
+    visitStamp[start] = stamp;
+    queue.assign(1, start);
+    int reached = 1;
+
+    for (size_t head = 0; head < queue.size() && int(queue.size()) < MOVE_SEARCH_LIMIT; head++) {
+        int cur = queue[head];
+        for (int i = graph.offsets[cur]; i < graph.offsets[cur + 1]; i++) {
+            int next = graph.neighbors[i];
+            if (parts[next] != part || visitStamp[next] == stamp) {
+                continue;
+            }
+
+            visitStamp[next] = stamp;
+            queue.push_back(next);
+            if (neighborStamp[next] == stamp && ++reached == targets) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+
+/************** TESTS **************/
+
+STUDENT_TEST("Partitioning a grid into compact districts") {
+    // A 60x60 grid of equal precincts
+    VotingMap map;
+    addGridMap(map, 60, 60, [](int id) { return oneVote(id % 2 == 1); });
+
+    MultilevelPartitioner partitioner(map, 3);
+    Plan plan = partitioner.partition(6, 0.05);
+    EXPECT(partitioner.levelCount() > 1);
+
+    EXPECT_EQUAL(plan.districtCount(), 6);
+    EXPECT_EQUAL(plan.unassignedCount(), 0);
+    EXPECT(isContinuousPlan(plan));
+    for (int district = 0; district < plan.districtCount(); district++) {
+        EXPECT(plan.districtSize(district) > 0);
+    }
+
+    // The same seed gives the same plan
+    MultilevelPartitioner again(map, 3);
+    EXPECT(again.partition(6, 0.05) == plan);
+    EXPECT_ERROR(partitioner.partition(0, 0.05));
+}
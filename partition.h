@@ -0,0 +1,89 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the MultilevelPartitioner class, which builds
+ * compact starting plans for large maps (instead of growing snakey
+ * districts from random starts) by multilevel graph partitioning:
+ *
+ * Coarsening => every node is matched with the neighbor it shares the
+ *          heaviest border with (preferring light neighbors, so no node holds
+ *          too much population), and every pair becomes one node of a graph
+ *          about half the size, until the graph is small
+ * Partitioning => the districts are grown by BFS on the coarsest graph, each
+ *          one up to its share of the population
+ * Refinement => on the way back to the precincts, the nodes on the border of
+ *          2 districts are moved to balance the populations and shorten the
+ *          borders, as long as no district is split
+ *
+ * Both halves of a matched pair border each other, so a continuous district
+ * of a coarse graph is continuous in every finer graph too. Every level is
+ * linear in its size, so the whole partition is near-linear.
+ */
+
+#pragma once
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <cstdint>
+#include <vector>
+
+#include "plan.h"
+#include "rng.h"
+#include "votingmap.h"
+
+class MultilevelPartitioner
+{
+public:
+    // Creates a partitioner over the map, whose random choices are drawn from a generator with the given seed
+    MultilevelPartitioner(const VotingMap& map, uint64_t seed);
+
+    /* Returns a plan with totalDistricts continuous districts, whose populations are balanced
+     * to within tolerance of the mean where the refinement manages it (precincts that can't be
+     * reached from any district are left unassigned)
+     */
+    Plan partition(int totalDistricts, double tolerance);
+
+    // Returns how many graphs the last partition went through (the precincts included)
+    int levelCount() const;
+
+private:
+    // A graph in compressed-sparse-row form, whose nodes are groups of precincts
+    struct Graph {
+        // node => combined population
+        std::vector<int> weight;
+        // node => [offsets[node], offsets[node + 1]) range in neighbors
+        std::vector<int> offsets;
+        std::vector<int> neighbors;
+        // How many precinct borders each edge stands for
+        std::vector<int> edgeWeights;
+
+        int size() const {
+            return weight.size();
+        }
+    };
+
+    const VotingMap* map;
+    // Draws every random choice of the partitioner
+    Rng rng;
+    // levels[0] is the precincts, and every level after it is coarser
+    std::vector<Graph> levels;
+    // coarser[level][node] => the node of the next level that it was merged into
+    std::vector<std::vector<int>> coarser;
+
+    // Scratch space of the connectivity check, stamped instead of cleared
+    std::vector<int> visitStamp;
+    std::vector<int> neighborStamp;
+    std::vector<int> queue;
+    int stamp;
+
+    // The steps of "partition(int, double)"
+    Graph precinctGraph() const;
+    Graph coarsen(const Graph& fine, int maxWeight, std::vector<int>& parent);
+    std::vector<int> growParts(const Graph& graph, int totalDistricts);
+    void reconnect(const Graph& graph, std::vector<int>& parts) const;
+    void refine(const Graph& graph, std::vector<int>& parts, int totalDistricts, double tolerance);
+    // Returns true if the part of node is known to stay continuous without it
+    bool canRemove(const Graph& graph, const std::vector<int>& parts, int node);
+};
+
+#endif // PARTITION_H
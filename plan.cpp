@@ -0,0 +1,342 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the Plan class.
+ *
+ * Every change to the assignment goes through assign(), which
+ * keeps the per-district totals up to date, so reading the
+ * population or votes of a district is O(1).
+ */
+
+#include "plan.h"
+
+#include <functional>
+
+#include "error.h"
+#include "rng.h"
+#include "strlib.h"
+#include "testing/SimpleTest.h"
+
+const uint16_t Plan::UNASSIGNED;
+
+/*
+ * The Zobrist key of a precinct in a district, which is mixed from the pair instead of
+ * being looked up in a (precincts x districts) table. Unassigned precincts have no key,
+ * so the hash of a new plan is 0.
+ */
+static uint64_t zobristKey(int index, int district) {
+    if (district == Plan::UNASSIGNED) {
+        return 0;
+    }
+    return streamSeed(uint64_t(index) << 16, district);
+}
+
+// Default constructor
+Plan::Plan() {
+    map = nullptr;
+    unassigned = 0;
+    conflicts = 0;
+    seed = 0;
+    zobrist = 0;
+}
+
+/*
+ * Creates a plan over every precinct of the map, with a given number of
+ * (initially empty) districts
+ */
+Plan::Plan(const VotingMap& map, int totalDistricts) {
+    reset(map, totalDistricts);
+}
+
+/*
+ * Turns the plan back into a new plan over the map (the same as "Plan(map, totalDistricts)"),
+ * but keeps its buffers, so a retry loop doesn't reallocate them for every attempt
+ */
+void Plan::reset(const VotingMap& map, int totalDistricts) {
+    map.freeze();
+
+    this->map = &map;
+    districts.assign(map.size(), UNASSIGNED);
+    sizes.clear();
+    pops.clear();
+    dems.clear();
+    reps.clear();
+    unassigned = map.size();
+    conflicts = 0;
+    seed = 0;
+    zobrist = 0;
+
+    for (int i = 0; i < totalDistricts; i++) {
+        addDistrict();
+    }
+}
+
+/*
+ * Converts a Set of districts into a Plan, where the districts are numbered
+ * in the order the Set iterates them.
+ *
+ * Ids that are not on the map, or that already belong to another district,
+ * can't be represented and are counted as conflicts instead.
+ */
+Plan Plan::fromDistricts(const VotingMap& map, const Set<Set<int>>& districts) {
+    Plan plan(map);
+
+    for (const Set<int>& district : districts) {    // O(n log n)
+        int number = plan.addDistrict();
+        for (int precinct : district) {
+            if (!map.contains(precinct)) {
+                plan.conflicts++;
+                continue;
+            }
+
+            int index = map.indexOf(precinct);
+            if (plan.districtOf(index) != UNASSIGNED) {
+                plan.conflicts++;
+                continue;
+            }
+            plan.assign(index, number);
+        }
+    }
+
+    return plan;
+}
+
+/*
+ * Converts the Plan back into a Set of districts of precinct ids
+ * (unassigned precincts are left out)
+ */
+Set<Set<int>> Plan::toDistricts() const {
+    Vector<Set<int>> byDistrict(districtCount());
+    for (int index = 0; index < size(); index++) {  // O(n log n)
+        if (districts[index] != UNASSIGNED) {
+            byDistrict[districts[index]].add(map->idAt(index));
+        }
+    }
+
+    Set<Set<int>> result;
+    for (const Set<int>& district : byDistrict) {
+        result.add(district);
+    }
+    return result;
+}
+
+/*
+ * Adds an empty district to the end of the plan and returns its number
+ */
+int Plan::addDistrict() {
+    if (districtCount() >= UNASSIGNED) {
+        error("A plan can have at most " + integerToString(UNASSIGNED) + " districts");
+    }
+
+    sizes.push_back(0);
+    pops.push_back(0);
+    dems.push_back(0);
+    reps.push_back(0);
+    return districtCount() - 1;
+}
+
+/*
+ * Moves a precinct into a district (or out of every district, if the given district
+ * is UNASSIGNED), updating the totals of the district it left and the one it joined.
+ */
+void Plan::assign(int index, int district) {
+    int from = districts[index];
+    if (from == district) {
+        return;
+    }
+
+    DemographicView demo = map->demographicAt(index);
+    if (from == UNASSIGNED) {
+        unassigned--;
+    } else {
+        sizes[from]--;
+        pops[from] -= demo.pop;
+        dems[from] -= demo.dem;
+        reps[from] -= demo.rep;
+    }
+
+    if (district == UNASSIGNED) {
+        unassigned++;
+    } else {
+        sizes[district]++;
+        pops[district] += demo.pop;
+        dems[district] += demo.dem;
+        reps[district] += demo.rep;
+    }
+
+    districts[index] = district;
+    zobrist ^= zobristKey(index, from) ^ zobristKey(index, district);
+}
+
+int Plan::districtOf(int index) const {
+    return districts[index];
+}
+
+int Plan::size() const {
+    return districts.size();
+}
+
+int Plan::districtCount() const {
+    return pops.size();
+}
+
+int Plan::districtSize(int district) const {
+    return sizes[district];
+}
+
+int Plan::districtPop(int district) const {
+    return pops[district];
+}
+
+int Plan::districtDem(int district) const {
+    return dems[district];
+}
+
+int Plan::districtRep(int district) const {
+    return reps[district];
+}
+
+const std::vector<int>& Plan::demTotals() const {
+    return dems;
+}
+
+const std::vector<int>& Plan::repTotals() const {
+    return reps;
+}
+
+int Plan::unassignedCount() const {
+    return unassigned;
+}
+
+int Plan::conflictCount() const {
+    return conflicts;
+}
+
+const std::vector<uint16_t>& Plan::assignment() const {
+    return districts;
+}
+
+/*
+ * Returns the map of the plan, throws an error for a default constructed plan
+ */
+const VotingMap& Plan::votingMap() const {
+    if (!map) {
+        error("Plan is not associated with a VotingMap");
+    }
+    return *map;
+}
+
+uint64_t Plan::hash() const {
+    return zobrist;
+}
+
+uint64_t Plan::generatorSeed() const {
+    return seed;
+}
+
+void Plan::setGeneratorSeed(uint64_t seed) {
+    this->seed = seed;
+}
+
+bool Plan::operator==(const Plan& other) const {
+    return map == other.map && districtCount() == other.districtCount() && districts == other.districts;
+}
+
+bool Plan::operator!=(const Plan& other) const {
+    return !(*this == other);
+}
+
+bool Plan::operator<(const Plan& other) const {
+    if (map != other.map) {
+        return std::less<const VotingMap*>()(map, other.map);
+    }
+    if (districtCount() != other.districtCount()) {
+        return districtCount() < other.districtCount();
+    }
+    return districts < other.districts;
+}
+
+
+/************** TESTS **************/
+
+STUDENT_TEST("Converting between plans and Sets of districts") {
+    VotingMap map;
+    map.addArea(new Area(50001, 121, 162, 636, {50002}));
+    map.addArea(new Area(50002, 1011, 351, 2837, {50001, 50003}));
+    map.addArea(new Area(50003, 234, 1141, 2527, {50002}));
+
+    Set<Set<int>> districts = {{50001, 50002}, {50003}};
+    Plan plan = Plan::fromDistricts(map, districts);
+
+    EXPECT_EQUAL(plan.districtCount(), 2);
+    EXPECT_EQUAL(plan.districtOf(0), plan.districtOf(1));
+    EXPECT_EQUAL(plan.districtPop(plan.districtOf(0)), 636 + 2837);
+    EXPECT_EQUAL(plan.districtRep(plan.districtOf(2)), 1141);
+    EXPECT_EQUAL(plan.unassignedCount(), 0);
+    EXPECT_EQUAL(plan.toDistricts(), districts);
+
+    // Moving a precinct updates the totals of both districts
+    plan.assign(1, plan.districtOf(2));
+    EXPECT_EQUAL(plan.districtPop(plan.districtOf(0)), 636);
+    EXPECT_EQUAL(plan.districtDem(plan.districtOf(2)), 1011 + 234);
+    EXPECT_EQUAL(plan.districtSize(plan.districtOf(2)), 2);
+    EXPECT(plan != Plan::fromDistricts(map, districts));
+}
+
+STUDENT_TEST("Comparing plans over different maps, or with different numbers of districts") {
+    VotingMap map;
+    map.addArea(new Area(1, 1, 0, 1, {2}));
+    map.addArea(new Area(2, 0, 1, 1, {1}));
+    VotingMap copy;
+    copy.addArea(new Area(1, 1, 0, 1, {2}));
+    copy.addArea(new Area(2, 0, 1, 1, {1}));
+
+    // The same assignment, but over another map, or with an extra (empty) district
+    Plan plan = Plan::fromDistricts(map, {{1, 2}});
+    Plan other = Plan::fromDistricts(copy, {{1, 2}});
+    Plan wider(map, 2);
+    wider.assign(0, 0);
+    wider.assign(1, 0);
+    EXPECT(plan.assignment() == other.assignment());
+    EXPECT(plan.assignment() == wider.assignment());
+    EXPECT(plan != other);
+    EXPECT(plan != wider);
+    EXPECT(plan == Plan::fromDistricts(map, {{1, 2}}));
+
+    // Exactly one of 2 different plans comes first
+    EXPECT((plan < other) != (other < plan));
+    EXPECT(plan < wider && !(wider < plan));
+}
+
+STUDENT_TEST("Plans built from Sets that can't be represented") {
+    VotingMap map;
+    map.addArea(new Area(1, 1, 0, 1, {2}));
+    map.addArea(new Area(2, 0, 1, 1, {1}));
+
+    // Unknown id, and a precinct that is in 2 districts
+    Set<Set<int>> districts = {{1, 3}, {1, 2}};
+    Plan plan = Plan::fromDistricts(map, districts);
+    EXPECT_EQUAL(plan.conflictCount(), 2);
+
+    Plan partial = Plan::fromDistricts(map, {{2}});
+    EXPECT_EQUAL(partial.unassignedCount(), 1);
+    EXPECT_EQUAL(partial.districtOf(0), Plan::UNASSIGNED);
+}
+
+STUDENT_TEST("Resetting a plan keeps its buffers") {
+    VotingMap map;
+    map.addArea(new Area(1, 1, 0, 1, {2}));
+    map.addArea(new Area(2, 0, 1, 1, {1}));
+
+    Plan plan = Plan::fromDistricts(map, {{1}, {2}});
+    plan.setGeneratorSeed(9);
+    const uint16_t* buffer = plan.assignment().data();
+
+    plan.reset(map, 1);
+    EXPECT(plan == Plan(map, 1));
+    EXPECT_EQUAL(plan.districtCount(), 1);
+    EXPECT_EQUAL(plan.unassignedCount(), 2);
+    EXPECT_EQUAL(plan.districtPop(0), 0);
+    EXPECT_EQUAL(plan.hash(), 0);
+    EXPECT_EQUAL(plan.generatorSeed(), 0);
+    EXPECT(plan.assignment().data() == buffer);
+}
@@ -0,0 +1,113 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the Plan class, a dense representation
+ * of a districting plan.
+ *
+ * Instead of a Set of districts (each a Set of precinct ids),
+ * a Plan stores which district every precinct belongs to, indexed
+ * by the VotingMap's dense indices, along with running population and
+ * vote totals for every district.
+ *
+ * Plans can be converted to and from the Set<Set<int>> form used
+ * by the Gerrymander interface.
+ *
+ * Every plan also keeps a Zobrist hash of its assignment: the XOR of a
+ * pseudo-random key for every (precinct, district) pair, so that moving
+ * a precinct only XORs out its old key and XORs in the new one.
+ */
+
+#pragma once
+
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <cstdint>
+#include <vector>
+
+#include "set.h"
+#include "votingmap.h"
+
+class Plan
+{
+public:
+    // The district number of a precinct that has not been assigned to a district
+    static const uint16_t UNASSIGNED = 0xFFFF;
+
+    // Default constructor, creates a plan over no map with no precincts
+    Plan();
+    // Creates a plan over the given map with every precinct unassigned
+    Plan(const VotingMap& map, int totalDistricts = 0);
+    // Unassigns every precinct and drops the districts, keeping the allocated buffers
+    void reset(const VotingMap& map, int totalDistricts = 0);
+
+    // Creates a plan from a Set of districts (Sets of precinct ids)
+    static Plan fromDistricts(const VotingMap& map, const Set<Set<int>>& districts);
+    // Returns the plan as a Set of districts (Sets of precinct ids)
+    Set<Set<int>> toDistricts() const;
+
+    // Adds a new, empty district and returns its number
+    int addDistrict();
+    // Assigns the precinct at the given dense index to a district (or UNASSIGNED)
+    void assign(int index, int district);
+
+    // Returns the number of the district the precinct at the given dense index belongs to
+    int districtOf(int index) const;
+    // Returns the number of precincts (dense indices) the plan covers
+    int size() const;
+    // Returns how many districts the plan has
+    int districtCount() const;
+    // Returns how many precincts belong to a given district
+    int districtSize(int district) const;
+    // Returns the running totals of a district
+    int districtPop(int district) const;
+    int districtDem(int district) const;
+    int districtRep(int district) const;
+    // Returns the running totals of every district (indexed by district number), for batched loops
+    const std::vector<int>& demTotals() const;
+    const std::vector<int>& repTotals() const;
+    // Returns how many precincts have not been assigned to a district
+    int unassignedCount() const;
+    /* Returns how many precincts could not be represented when converting from
+     * a Set of districts (unknown ids, or ids that were in more than one district)
+     */
+    int conflictCount() const;
+
+    // Returns the precinct => district assignment
+    const std::vector<uint16_t>& assignment() const;
+    // Returns the Zobrist hash of the assignment (equal plans have equal hashes), O(1)
+    uint64_t hash() const;
+    // Returns the VotingMap that the plan was built over
+    const VotingMap& votingMap() const;
+
+    // The seed of the random number generator that produced the plan (0 if it wasn't generated)
+    uint64_t generatorSeed() const;
+    void setGeneratorSeed(uint64_t seed);
+
+    /* Plans are equal when they are over the same VotingMap, with the same number of districts and
+     * the same assignment (and are ordered by the same fields, in that order)
+     */
+    bool operator==(const Plan& other) const;
+    bool operator!=(const Plan& other) const;
+    bool operator<(const Plan& other) const;
+
+private:
+    // The map whose dense indices the assignment refers to
+    const VotingMap* map;
+    // dense index => district number
+    std::vector<uint16_t> districts;
+    // district number => running totals
+    std::vector<int> sizes;
+    std::vector<int> pops;
+    std::vector<int> dems;
+    std::vector<int> reps;
+    // Number of precincts that are UNASSIGNED
+    int unassigned;
+    // Number of entries dropped by fromDistricts()
+    int conflicts;
+    // Metadata => the seed the plan was generated from (not part of comparisons)
+    uint64_t seed;
+    // The Zobrist hash, kept up to date by assign()
+    uint64_t zobrist;
+};
+
+#endif // PLAN_H
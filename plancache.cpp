@@ -0,0 +1,189 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the PlanCache class.
+ *
+ * Each slot remembers one plan, and the validity and score are filled
+ * in separately (a plan can be validated at one margin without being
+ * scored, or scored without being validated again).
+ */
+
+#include "plancache.h"
+
+#include "rng.h"
+#include "testing/SimpleTest.h"
+
+const int PlanCache::DEFAULT_CAPACITY;
+
+PlanCache::PlanCache(int capacity) : entries(capacity, Entry{0, false, 0, false, false, 0}) {
+    hitCount = 0;
+    missCount = 0;
+}
+
+bool PlanCache::findValidity(const Plan& plan, double margin, bool& valid) const {
+    if (entries.empty()) {
+        return false;
+    }
+
+    const uint64_t key = keyOf(plan);
+    std::lock_guard<std::mutex> guard(lock);
+
+    const Entry& entry = slotOf(key);
+    if (entry.key == key && entry.hasValidity && entry.margin == margin) {
+        valid = entry.valid;
+        hitCount++;
+        return true;
+    }
+    missCount++;
+    return false;
+}
+
+/*
+ * Replaces whatever plan was in the slot (keeping the score if it is the same plan)
+ */
+void PlanCache::storeValidity(const Plan& plan, double margin, bool valid) {
+    if (entries.empty()) {
+        return;
+    }
+
+    const uint64_t key = keyOf(plan);
+    std::lock_guard<std::mutex> guard(lock);
+
+    Entry& entry = slotOf(key);
+    if (entry.key != key) {
+        entry = Entry{key, false, 0, false, false, 0};
+    }
+    entry.hasValidity = true;
+    entry.margin = margin;
+    entry.valid = valid;
+}
+
+bool PlanCache::findScore(const Plan& plan, int& score) const {
+    if (entries.empty()) {
+        return false;
+    }
+
+    const uint64_t key = keyOf(plan);
+    std::lock_guard<std::mutex> guard(lock);
+
+    const Entry& entry = slotOf(key);
+    if (entry.key == key && entry.hasScore) {
+        score = entry.score;
+        hitCount++;
+        return true;
+    }
+    missCount++;
+    return false;
+}
+
+/*
+ * Replaces whatever plan was in the slot (keeping the validity if it is the same plan)
+ */
+void PlanCache::storeScore(const Plan& plan, int score) {
+    if (entries.empty()) {
+        return;
+    }
+
+    const uint64_t key = keyOf(plan);
+    std::lock_guard<std::mutex> guard(lock);
+
+    Entry& entry = slotOf(key);
+    if (entry.key != key) {
+        entry = Entry{key, false, 0, false, false, 0};
+    }
+    entry.hasScore = true;
+    entry.score = score;
+}
+
+long PlanCache::hits() const {
+    return hitCount;
+}
+
+long PlanCache::misses() const {
+    return missCount;
+}
+
+int PlanCache::capacity() const {
+    return entries.size();
+}
+
+void PlanCache::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (Entry& entry : entries) {
+        entry = Entry{0, false, 0, false, false, 0};
+    }
+    hitCount = 0;
+    missCount = 0;
+}
+
+/*
+ * Plans converted from a Set of districts can drop conflicting ids, which the hash doesn't
+ * see, so the conflicts are mixed in too (a plan with conflicts is never mistaken for the
+ * valid plan it would be without them).
+ *
+ * 0 marks an empty slot, so a plan whose key comes out as 0 uses 1 instead
+ */
+uint64_t PlanCache::keyOf(const Plan& plan) {
+    uint64_t shape = (uint64_t(plan.size()) << 32) ^ uint64_t(plan.conflictCount());
+    uint64_t key = plan.hash() ^ streamSeed(shape, plan.districtCount());
+    return (key == 0) ? 1 : key;
+}
+
+PlanCache::Entry& PlanCache::slotOf(uint64_t key) {
+    return entries[key % entries.size()];
+}
+
+const PlanCache::Entry& PlanCache::slotOf(uint64_t key) const {
+    return entries[key % entries.size()];
+}
+
+
+/************** TESTS **************/
+
+STUDENT_TEST("Caching plans by their hash") {
+    VotingMap map;
+    map.addArea(new Area(1, 1, 0, 1, {2}));
+    map.addArea(new Area(2, 0, 1, 1, {1, 3}));
+    map.addArea(new Area(3, 0, 1, 1, {2}));
+
+    Plan plan(map, 2);
+    plan.assign(0, 0);
+    plan.assign(1, 0);
+    plan.assign(2, 1);
+
+    // The hash only depends on the assignment, not on how it was reached
+    Plan same(map, 2);
+    same.assign(2, 1);
+    same.assign(1, 1);
+    same.assign(0, 0);
+    same.assign(1, 0);
+    EXPECT_EQUAL(plan.hash(), same.hash());
+    EXPECT(plan.hash() != Plan(map, 2).hash());
+
+    PlanCache cache(16);
+    bool valid = false;
+    int score = 0;
+    EXPECT(!cache.findValidity(plan, 0.5, valid));
+    cache.storeValidity(plan, 0.5, true);
+    EXPECT(cache.findValidity(same, 0.5, valid));
+    EXPECT(valid);
+
+    // A different margin, or a score that was never stored, is a miss
+    EXPECT(!cache.findValidity(plan, 0.1, valid));
+    EXPECT(!cache.findScore(plan, score));
+    cache.storeScore(plan, 33);
+    EXPECT(cache.findScore(same, score));
+    EXPECT_EQUAL(score, 33);
+
+    // Moving a precinct changes the hash (and moving it back restores it)
+    same.assign(1, 1);
+    EXPECT(!cache.findScore(same, score));
+    same.assign(1, 0);
+    EXPECT(cache.findScore(same, score));
+
+    EXPECT_EQUAL(cache.hits(), 3);
+    EXPECT_EQUAL(cache.misses(), 4);
+
+    cache.clear();
+    EXPECT(!cache.findScore(plan, score));
+    EXPECT_EQUAL(cache.hits(), 0);
+}
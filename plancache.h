@@ -0,0 +1,78 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the PlanCache class, which remembers whether
+ * plans were valid, and what they scored, so that the same plan isn't
+ * validated and scored over and over (e.g. "isGerrymandered" scores a
+ * plan, which validates it, after the generator already validated it).
+ *
+ * Plans are looked up by their Zobrist hash ("Plan::hash()"), which is
+ * kept up to date as precincts move, so a lookup is O(1) no matter how
+ * big the plan is. The hash is 64 bits, and only the hash is stored, so
+ * 2 different plans are treated as the same one with a probability of
+ * about 1 in 2^64.
+ *
+ * The cache has a fixed number of slots (a plan can only be in the slot
+ * its hash picks, and replaces whatever was there), so it never grows,
+ * and every method can be called from several threads at once.
+ */
+
+#pragma once
+
+#ifndef PLANCACHE_H
+#define PLANCACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "plan.h"
+
+class PlanCache
+{
+public:
+    // The default number of slots
+    static const int DEFAULT_CAPACITY = 4096;
+
+    // Creates an empty cache with the given number of slots (0 => nothing is ever cached)
+    explicit PlanCache(int capacity = DEFAULT_CAPACITY);
+
+    // If the validity of plan at margin is known, sets valid to it and returns true
+    bool findValidity(const Plan& plan, double margin, bool& valid) const;
+    void storeValidity(const Plan& plan, double margin, bool valid);
+
+    // If the score ("Gerrymander::howGerrymandered(Plan)") of plan is known, sets score to it and returns true
+    bool findScore(const Plan& plan, int& score) const;
+    void storeScore(const Plan& plan, int score);
+
+    // Lookups that found (or didn't find) their answer
+    long hits() const;
+    long misses() const;
+    int capacity() const;
+    // Empties the cache and resets the counters
+    void clear();
+
+private:
+    struct Entry {
+        // The key of the plan in the slot (0 => empty)
+        uint64_t key;
+        bool hasValidity;
+        double margin;
+        bool valid;
+        bool hasScore;
+        int score;
+    };
+
+    std::vector<Entry> entries;
+    mutable std::mutex lock;
+    mutable std::atomic<long> hitCount;
+    mutable std::atomic<long> missCount;
+
+    // The hash of the plan, mixed with its number of districts, precincts and conflicts (which the hash doesn't show)
+    static uint64_t keyOf(const Plan& plan);
+    // The slot of a key
+    Entry& slotOf(uint64_t key);
+    const Entry& slotOf(uint64_t key) const;
+};
+
+#endif // PLANCACHE_H
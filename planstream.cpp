@@ -0,0 +1,534 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the plan streams.
+ *
+ * The writer keeps the assignment of the last plan, and finds the precincts
+ * that moved by comparing the assignments a block at a time (memcmp), so the
+ * unchanged blocks, which are nearly all of them, cost a single vectorized
+ * compare. A plan where too many precincts moved is stored as a keyframe,
+ * which is smaller in that case.
+ */
+
+#include "planstream.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <sstream>
+
+#include "codec.h"
+#include "ensemble.h"
+#include "error.h"
+#include "gerrymander.h"
+#include "testing/SimpleTest.h"
+#include "testmaps.h"
+
+static const char STREAM_MAGIC[8] = {'G', 'M', 'P', 'L', 'A', 'N', 'S', '1'};
+static const char END_MAGIC[8] = {'G', 'M', 'P', 'L', 'E', 'N', 'D', '1'};
+static const uint64_t STREAM_VERSION = 1;
+static const int FOOTER_TAG = 0;
+static const int KEYFRAME_TAG = 1;
+static const int DELTA_TAG = 2;
+// The precincts compared at a time by the writer
+static const size_t COMPARE_BLOCK = 32;
+// The size of the offset and magic at the very end of a complete stream
+static const long long TRAILER_BYTES = 16;
+
+PlanStreamWriter::PlanStreamWriter(std::ostream& out, const VotingMap& map, int keyframeInterval)
+    : out(out), map(map), keyframeInterval(std::max(1, keyframeInterval)), previousDistricts(-1),
+      plans(0), bytes(0), finished(false), lastKeyframe(0) {
+    std::ostringstream header;
+    header.write(STREAM_MAGIC, sizeof(STREAM_MAGIC));
+    writeVarint(header, STREAM_VERSION);
+    writeFixed64(header, mapFingerprint(map));
+    writeVarint(header, map.size());
+    emit(header.str());
+}
+
+PlanStreamWriter::~PlanStreamWriter() {
+    if (!finished) {
+        finish();
+    }
+}
+
+void PlanStreamWriter::emit(const std::string& frame) {
+    out.write(frame.data(), frame.size());
+    bytes += frame.size();
+}
+
+/*
+ * Finds the moves from the last plan, and writes them as a delta, unless a keyframe is due
+ * (or would be smaller)
+ */
+void PlanStreamWriter::write(const Plan& plan) {
+    if (finished) {
+        error("PlanStreamWriter: the stream was already finished");
+    }
+    if (plan.size() != map.size() || plan.unassignedCount() > 0) {
+        error("PlanStreamWriter: the plan doesn't assign every precinct of the map");
+    }
+
+    const std::vector<uint16_t>& assignment = plan.assignment();
+    bool keyframe = plans == 0 || plans - lastKeyframe >= keyframeInterval || plan.districtCount() != previousDistricts;
+
+    moves.clear();
+    if (!keyframe) {
+        const size_t size = assignment.size();
+        for (size_t start = 0; start < size; start += COMPARE_BLOCK) {      // O(precincts / COMPARE_BLOCK) compares
+            const size_t length = std::min(COMPARE_BLOCK, size - start);
+            if (std::memcmp(&previous[start], &assignment[start], length * sizeof(uint16_t)) == 0) {
+                continue;
+            }
+            for (size_t index = start; index < start + length; index++) {
+                if (previous[index] != assignment[index]) {
+                    moves.push_back({int(index), assignment[index]});
+                }
+            }
+        }
+        // A move takes at least 2 bytes, and a keyframe about 2 bytes a run
+        keyframe = moves.size() > size / 4;
+    }
+
+    std::ostringstream frame;
+    if (keyframe) {
+        writeVarint(frame, KEYFRAME_TAG);
+        writeVarint(frame, plan.districtCount());
+        writeAssignmentRuns(frame, assignment);
+
+        keyframes.push_back({plans, bytes});
+        lastKeyframe = plans;
+        previous = assignment;
+        previousDistricts = plan.districtCount();
+    } else {
+        writeVarint(frame, DELTA_TAG);
+        writeVarint(frame, moves.size());
+        int last = -1;
+        for (const std::pair<int, int>& move : moves) {
+            writeVarint(frame, move.first - last - 1);
+            writeVarint(frame, move.second);
+            last = move.first;
+            previous[move.first] = move.second;
+        }
+    }
+
+    emit(frame.str());
+    plans++;
+    if (!out) {
+        error("PlanStreamWriter: failed to write to the stream");
+    }
+}
+
+void PlanStreamWriter::finish() {
+    if (finished) {
+        return;
+    }
+    finished = true;
+
+    const long long footerOffset = bytes;
+    std::ostringstream footer;
+    writeVarint(footer, FOOTER_TAG);
+    writeVarint(footer, plans);
+    writeVarint(footer, keyframes.size());
+    for (const std::pair<int, long long>& keyframe : keyframes) {
+        writeVarint(footer, keyframe.first);
+        writeVarint(footer, keyframe.second);
+    }
+    writeFixed64(footer, footerOffset);
+    footer.write(END_MAGIC, sizeof(END_MAGIC));
+    emit(footer.str());
+    out.flush();
+}
+
+int PlanStreamWriter::planCount() const {
+    return plans;
+}
+
+long long PlanStreamWriter::byteCount() const {
+    return bytes;
+}
+
+PlanStreamReader::PlanStreamReader(std::istream& in, const VotingMap& map)
+    : in(in), map(map), plans(0), complete(false), position(0), decoded(-1), districts(0) {
+    in.clear();
+    in.seekg(0, std::ios::end);
+    const long long length = in.tellg();
+    in.seekg(0);
+    if (length < 0) {
+        error("PlanStreamReader: the stream can't be seeked");
+    }
+
+    char magic[sizeof(STREAM_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, STREAM_MAGIC, sizeof(magic)) != 0) {
+        error("PlanStreamReader: not a plan stream");
+    }
+    if (readVarint(in) != STREAM_VERSION) {
+        error("PlanStreamReader: unsupported plan stream version");
+    }
+    if (readFixed64(in) != mapFingerprint(map) || readVarint(in) != uint64_t(map.size())) {
+        error("PlanStreamReader: the plans were written over a different map");
+    }
+
+    readIndex(in.tellg(), length);
+}
+
+/*
+ * Reads the index from the footer if the stream ends with the trailer, and otherwise decodes
+ * every frame from the start, up to the first one that is cut off or malformed
+ */
+void PlanStreamReader::readIndex(long long start, long long length) {
+    if (length - start >= TRAILER_BYTES) {
+        in.seekg(length - TRAILER_BYTES);
+        const long long footerOffset = readFixed64(in);
+        char magic[sizeof(END_MAGIC)];
+        in.read(magic, sizeof(magic));
+
+        if (in && std::memcmp(magic, END_MAGIC, sizeof(magic)) == 0 && footerOffset >= start && footerOffset < length) {
+            in.seekg(footerOffset);
+            if (readVarint(in) != uint64_t(FOOTER_TAG)) {
+                error("PlanStreamReader: malformed footer");
+            }
+            // The index is checked like the header: every keyframe is a plan of the stream, and a frame before the footer, in order
+            const uint64_t planField = readVarint(in);
+            const uint64_t count = readVarint(in);
+            if (planField > uint64_t(INT_MAX) || count > planField) {
+                error("PlanStreamReader: malformed footer");
+            }
+            plans = int(planField);
+            for (uint64_t i = 0; i < count; i++) {
+                const uint64_t plan = readVarint(in);
+                const uint64_t offset = readVarint(in);
+                if (plan >= planField || offset < uint64_t(start) || offset >= uint64_t(footerOffset)
+                        || (!keyframes.empty() && (int(plan) <= keyframes.back().first || (long long) offset <= keyframes.back().second))) {
+                    error("PlanStreamReader: malformed footer");
+                }
+                keyframes.push_back({int(plan), (long long) offset});
+            }
+            if (plans > 0 && (keyframes.empty() || keyframes[0].first != 0)) {
+                error("PlanStreamReader: malformed footer");
+            }
+            complete = true;
+            return;
+        }
+    }
+
+    in.clear();
+    in.seekg(start);
+    while (true) {
+        const long long offset = in.tellg();
+        int tag = FOOTER_TAG;
+        try {
+            tag = readFrame();
+        } catch (const ErrorException&) {
+            break;
+        }
+        if (tag == FOOTER_TAG || (tag == DELTA_TAG && plans == 0)) {
+            break;
+        }
+        if (tag == KEYFRAME_TAG) {
+            keyframes.push_back({plans, offset});
+        }
+        plans++;
+    }
+    in.clear();
+    decoded = -1;
+}
+
+int PlanStreamReader::readFrame() {
+    const int precincts = map.size();
+    const int tag = int(readVarint(in));
+
+    if (tag == KEYFRAME_TAG) {
+        districts = int(readVarint(in));
+        if (districts <= 0 || districts > Plan::UNASSIGNED) {
+            error("PlanStreamReader: malformed keyframe");
+        }
+        readAssignmentRuns(in, precincts, districts, current);
+    } else if (tag == DELTA_TAG) {
+        const uint64_t count = readVarint(in);
+        if (count > uint64_t(precincts)) {
+            error("PlanStreamReader: malformed delta");
+        }
+        int64_t index = -1;
+        for (uint64_t i = 0; i < count; i++) {
+            // The gap is bounded before it is added, so that a huge one can't wrap the index around
+            const uint64_t gap = readVarint(in);
+            const uint64_t district = readVarint(in);
+            if (gap >= uint64_t(precincts - (index + 1)) || district >= uint64_t(districts) || current.empty()) {
+                error("PlanStreamReader: malformed delta");
+            }
+            index += int64_t(gap) + 1;
+            current[index] = uint16_t(district);
+        }
+    } else if (tag != FOOTER_TAG) {
+        error("PlanStreamReader: malformed frame");
+    }
+    return tag;
+}
+
+/*
+ * Keeps decoding from the last plan if the plan is ahead of it (and no keyframe is nearer),
+ * and otherwise jumps to the last keyframe at or before the plan.
+ *
+ * A frame that turns out to be malformed leaves current half decoded and the stream in the
+ * middle of the frame, so nothing is left decoded, and the next read starts from a keyframe.
+ */
+void PlanStreamReader::decodeTo(int index) {
+    if (index < 0 || index >= plans) {
+        error("PlanStreamReader: there is no plan " + std::to_string(index));
+    }
+
+    std::vector<std::pair<int, long long>>::const_iterator keyframe = std::upper_bound(
+        keyframes.begin(), keyframes.end(), std::make_pair(index, (long long) INT64_MAX)) - 1;
+    bool seeked = false;
+    if (decoded < keyframe->first || decoded > index) {
+        in.clear();
+        in.seekg(keyframe->second);
+        decoded = keyframe->first - 1;
+        seeked = true;
+    }
+
+    try {
+        while (decoded < index) {
+            const int tag = readFrame();
+            if (tag == FOOTER_TAG) {
+                error("PlanStreamReader: the stream ends before plan " + std::to_string(index));
+            }
+            // The index of the footer could point anywhere, so the frame it points at has to be a keyframe
+            if (seeked && tag != KEYFRAME_TAG) {
+                error("PlanStreamReader: malformed footer (plan " + std::to_string(keyframe->first) + " is not a keyframe)");
+            }
+            seeked = false;
+            decoded++;
+        }
+    } catch (const ErrorException&) {
+        decoded = -1;
+        throw;
+    }
+}
+
+void PlanStreamReader::toPlan(Plan& plan) const {
+    plan.reset(map, districts);
+    for (int index = 0; index < int(current.size()); index++) {
+        plan.assign(index, current[index]);
+    }
+}
+
+int PlanStreamReader::size() const {
+    return plans;
+}
+
+bool PlanStreamReader::isComplete() const {
+    return complete;
+}
+
+Plan PlanStreamReader::read(int index) {
+    decodeTo(index);
+    position = index + 1;
+    Plan plan;
+    toPlan(plan);
+    return plan;
+}
+
+bool PlanStreamReader::next(Plan& plan) {
+    if (position >= plans) {
+        return false;
+    }
+    decodeTo(position);
+    toPlan(plan);
+    position++;
+    return true;
+}
+
+void PlanStreamReader::seek(int index) {
+    if (index < 0 || index > plans) {
+        error("PlanStreamReader: there is no plan " + std::to_string(index));
+    }
+    position = index;
+}
+
+
+/************** TESTS **************/
+
+// Every third precinct votes Democrat (by 3 to 1)
+static void addGrid(Gerrymander& map, int width) {
+    addGridMap(map, width, width, [](int id) { return landslide(id % 3 == 0); });
+}
+
+STUDENT_TEST("Writing and seeking plan streams") {
+    Gerrymander map;
+    addGrid(map, 20);
+
+    Rng rng(4);
+    GenerationResult start = map.partitionedPlan(4, 0.2, 1000, rng);
+    EXPECT_EQUAL(start.status, VALID_PLAN);
+
+    // Every accepted plan of a chain of flips
+    std::vector<Plan> plans;
+    EnsembleSampler sampler(start.plan, 0.2, 9);
+    sampler.setRecomProbability(0);
+    sampler.run(2000, [&](int, const EfficiencyGapScorer& state) {
+        plans.push_back(state.plan());
+    });
+    EXPECT(plans.size() > 100u);
+
+    std::stringstream stream;
+    {
+        PlanStreamWriter writer(stream, map.votingMap(), 64);
+        for (const Plan& plan : plans) {
+            writer.write(plan);
+        }
+        EXPECT_EQUAL(writer.planCount(), int(plans.size()));
+        // A flip costs a few bytes, against 2 bytes a precinct for the raw assignment
+        EXPECT(writer.byteCount() < (long long) plans.size() * 40);
+    }
+
+    PlanStreamReader reader(stream, map.votingMap());
+    EXPECT(reader.isComplete());
+    EXPECT_EQUAL(reader.size(), int(plans.size()));
+
+    // In order, backwards, and jumping around
+    Plan plan;
+    bool inOrder = true;
+    for (int index = 0; reader.next(plan); index++) {
+        inOrder = inOrder && plan == plans[index] && plan.hash() == plans[index].hash();
+    }
+    EXPECT(inOrder);
+    bool backwards = true;
+    for (int index = int(plans.size()) - 1; index >= 0; index -= 7) {
+        backwards = backwards && reader.read(index) == plans[index];
+    }
+    EXPECT(backwards);
+    EXPECT(reader.read(130) == plans[130]);
+    EXPECT(reader.read(3) == plans[3]);
+    EXPECT_EQUAL(reader.read(3).districtPop(0), plans[3].districtPop(0));
+    EXPECT_ERROR(reader.read(int(plans.size())));
+}
+
+STUDENT_TEST("Reading plan streams without a footer") {
+    Gerrymander map;
+    addGrid(map, 10);
+
+    Rng rng(5);
+    std::vector<Plan> plans;
+    for (int i = 0; i < 5; i++) {
+        plans.push_back(map.randomPlan(i % 2 == 0 ? 3 : 4, rng));
+    }
+
+    std::stringstream stream;
+    PlanStreamWriter writer(stream, map.votingMap(), 2);
+    for (const Plan& plan : plans) {
+        writer.write(plan);
+    }
+    // Cut off in the middle of the last plan, before the footer is written
+    std::string bytes = stream.str();
+    std::stringstream truncated(bytes.substr(0, bytes.size() - 2));
+    writer.finish();
+
+    PlanStreamReader reader(truncated, map.votingMap());
+    EXPECT(!reader.isComplete());
+    EXPECT_EQUAL(reader.size(), 4);
+    EXPECT(reader.read(3) == plans[3]);
+    EXPECT(reader.read(0) == plans[0]);
+    EXPECT_EQUAL(reader.read(1).districtCount(), 4);
+
+    // Streams of another map are turned down
+    Gerrymander other;
+    addGrid(other, 9);
+    std::stringstream complete(stream.str());
+    EXPECT_ERROR(PlanStreamReader(complete, other.votingMap()));
+    EXPECT_ERROR(writer.write(plans[0]));
+}
+
+STUDENT_TEST("Turning down malformed plan streams") {
+    Gerrymander map;
+    addGrid(map, 10);
+
+    // Quarters of the grid, where a few precincts change hands from one plan to the next
+    std::vector<Plan> plans;
+    Plan plan(map.votingMap(), 4);
+    for (int index = 0; index < 100; index++) {
+        plan.assign(index, index / 25);
+    }
+    for (int i = 0; i < 5; i++) {
+        plans.push_back(plan);
+        plan.assign(24 + i, 1);
+        plan.assign(50 + i, 1);
+    }
+
+    // The byte offset where every plan starts, and where the footer starts
+    std::stringstream stream;
+    std::vector<long long> offsets;
+    PlanStreamWriter writer(stream, map.votingMap(), 2);
+    for (const Plan& written : plans) {
+        offsets.push_back(writer.byteCount());
+        writer.write(written);
+    }
+    const long long footerOffset = writer.byteCount();
+    writer.finish();
+    const std::string bytes = stream.str();
+
+    // The district of the last move of plan 1 is out of range, after its first move was decoded
+    std::string corrupt = bytes;
+    corrupt[offsets[2] - 1] = 0x7F;
+    std::stringstream corrupted(corrupt);
+    PlanStreamReader reader(corrupted, map.votingMap());
+    EXPECT(reader.read(0) == plans[0]);
+    EXPECT_ERROR(reader.read(1));
+    EXPECT(reader.read(0) == plans[0]);
+    EXPECT(reader.read(3) == plans[3]);
+
+    // A footer after the given frames, whose index of keyframes (at plans 0, 2 and 4 when written) is given by hand
+    auto withIndex = [&](const std::string& frames, uint64_t planCount, const std::vector<std::pair<uint64_t, uint64_t>>& index) {
+        std::ostringstream footer;
+        writeVarint(footer, FOOTER_TAG);
+        writeVarint(footer, planCount);
+        writeVarint(footer, index.size());
+        for (const std::pair<uint64_t, uint64_t>& keyframe : index) {
+            writeVarint(footer, keyframe.first);
+            writeVarint(footer, keyframe.second);
+        }
+        writeFixed64(footer, frames.size());
+        footer.write(END_MAGIC, sizeof(END_MAGIC));
+        return frames + footer.str();
+    };
+    const std::string frames = bytes.substr(0, footerOffset);
+
+    std::stringstream valid(withIndex(frames, 5, {{0, offsets[0]}, {2, offsets[2]}, {4, offsets[4]}}));
+    PlanStreamReader rebuilt(valid, map.votingMap());
+    EXPECT(rebuilt.isComplete());
+    EXPECT(rebuilt.read(4) == plans[4]);
+
+    // An index in order and in range, but whose second keyframe is the delta of plan 3
+    std::stringstream misplaced(withIndex(frames, 5, {{0, offsets[0]}, {2, offsets[3]}}));
+    PlanStreamReader misread(misplaced, map.votingMap());
+    EXPECT(misread.read(1) == plans[1]);
+    EXPECT_ERROR(misread.read(2));
+    EXPECT(misread.read(0) == plans[0]);
+
+    // Plan 1 as a delta whose gap is so large that it would wrap the index around (read with and without the footer)
+    std::ostringstream huge;
+    writeVarint(huge, DELTA_TAG);
+    writeVarint(huge, 1);
+    writeVarint(huge, UINT64_MAX);
+    writeVarint(huge, 0);
+    const std::string wrapped = bytes.substr(0, offsets[1]) + huge.str();
+    std::stringstream unindexed(wrapped);
+    PlanStreamReader scanned(unindexed, map.votingMap());
+    EXPECT(!scanned.isComplete());
+    EXPECT_EQUAL(scanned.size(), 1);
+    std::stringstream indexed(withIndex(wrapped, 2, {{0, offsets[0]}}));
+    PlanStreamReader wrapping(indexed, map.votingMap());
+    EXPECT(wrapping.read(0) == plans[0]);
+    EXPECT_ERROR(wrapping.read(1));
+
+    // Out of order, past the last plan, past the footer, before the first frame, and more keyframes than plans
+    for (const std::string& bad : {withIndex(frames, 5, {{0, offsets[0]}, {4, offsets[4]}, {2, offsets[2]}}),
+                                   withIndex(frames, 5, {{0, offsets[0]}, {7, offsets[4]}}),
+                                   withIndex(frames, 5, {{0, offsets[0]}, {2, footerOffset + 5}}),
+                                   withIndex(frames, 5, {{0, 3}}),
+                                   withIndex(frames, 1, {{0, offsets[0]}, {2, offsets[2]}}),
+                                   withIndex(frames, uint64_t(1) << 40, {{0, offsets[0]}})}) {
+        std::stringstream malformed(bad);
+        EXPECT_ERROR(PlanStreamReader(malformed, map.votingMap()));
+    }
+}
@@ -0,0 +1,128 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the binary plan streams, which store a sequence of
+ * plans over the same map (e.g. the plans of an ensemble chain) in a
+ * small fraction of the size of their Set<Set<int>> text.
+ *
+ * Consecutive plans of a chain only differ by a few precincts, so most
+ * plans are stored as the moves from the plan before them, and every
+ * so often the whole assignment is stored as a keyframe, so that a plan
+ * can be read without replaying every plan before it.
+ *
+ * The layout of a stream (version 1, see "codec.h" for the encodings) is:
+ *
+ * header => magic "GMPLANS1", version, fingerprint of the map (fixed 64-bit), precincts
+ * keyframe => tag 1, districts, the assignment as runs of (district, length)
+ * delta => tag 2, number of moves, then (index - previous index - 1, district) for every
+ *          precinct that moved (in order of index)
+ * footer => tag 0, plans, keyframes, (plan, byte offset) of every keyframe, then the offset
+ *          of the footer (fixed 64-bit) and the magic "GMPLEND1"
+ *
+ * The offsets are counted by the writer, so it can write to a pipe or socket. A stream
+ * without a footer (e.g. whose writer was killed) can still be read up to its last
+ * complete plan: the reader finds the keyframes by reading every frame instead.
+ */
+
+#pragma once
+
+#ifndef PLANSTREAM_H
+#define PLANSTREAM_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "plan.h"
+#include "votingmap.h"
+
+class PlanStreamWriter
+{
+public:
+    /* Starts a stream of plans over the map, with a keyframe every keyframeInterval plans (and whenever
+     * the number of districts changes), writing the header to out straight away
+     */
+    PlanStreamWriter(std::ostream& out, const VotingMap& map, int keyframeInterval = 1000);
+    // Writes the footer, if finish() wasn't called
+    ~PlanStreamWriter();
+
+    PlanStreamWriter(const PlanStreamWriter&) = delete;
+    PlanStreamWriter& operator=(const PlanStreamWriter&) = delete;
+
+    // Appends a fully assigned plan over the map, O(precincts) (the moves are found by comparing blocks of the assignments)
+    void write(const Plan& plan);
+    // Writes the index of the keyframes and the footer (no more plans can be written)
+    void finish();
+
+    int planCount() const;
+    // Returns the bytes written to the stream so far
+    long long byteCount() const;
+
+private:
+    std::ostream& out;
+    const VotingMap& map;
+    int keyframeInterval;
+    // The assignment and districts of the last plan written
+    std::vector<uint16_t> previous;
+    int previousDistricts;
+    int plans;
+    long long bytes;
+    bool finished;
+    // (plan, byte offset) of every keyframe
+    std::vector<std::pair<int, long long>> keyframes;
+    // The plan of the last keyframe
+    int lastKeyframe;
+    // (index, district) of every precinct that moved since the last plan
+    std::vector<std::pair<int, int>> moves;
+
+    // Writes an encoded frame (or the header) to the stream
+    void emit(const std::string& frame);
+};
+
+class PlanStreamReader
+{
+public:
+    /* Opens a stream written by a PlanStreamWriter over the same map (the stream must be seekable).
+     * Throws an error if it isn't a plan stream of this version, or was written over another map.
+     */
+    PlanStreamReader(std::istream& in, const VotingMap& map);
+
+    // Returns how many plans can be read
+    int size() const;
+    // Returns whether the stream had a footer (otherwise the plans up to the last complete one are read)
+    bool isComplete() const;
+
+    /* Returns the plan at the given position: the plan after the last one read is read straight
+     * away, and any other plan from the nearest keyframe before it (at most keyframeInterval plans)
+     */
+    Plan read(int index);
+    // Reads the next plan into plan (reusing its buffers), and returns false after the last one
+    bool next(Plan& plan);
+    // Makes next() read the plan at the given position
+    void seek(int index);
+
+private:
+    std::istream& in;
+    const VotingMap& map;
+    int plans;
+    bool complete;
+    // (plan, byte offset) of every keyframe
+    std::vector<std::pair<int, long long>> keyframes;
+    // The plan that next() reads, and the plan that was decoded last (-1 => none), whose frame ends where the stream is
+    int position;
+    int decoded;
+    std::vector<uint16_t> current;
+    int districts;
+
+    // Reads the footer, or else every frame, to find the keyframes
+    void readIndex(long long start, long long length);
+    // Decodes the frame at the position of the stream into current, and returns its tag (0 at the footer)
+    int readFrame();
+    // Decodes frames until the plan at the given position is current
+    void decodeTo(int index);
+    void toPlan(Plan& plan) const;
+};
+
+#endif // PLANSTREAM_H
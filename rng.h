@@ -0,0 +1,177 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the random number generators that the
+ * generators draw from instead of the global functions in "random.h".
+ *
+ * Every generator owns its state, so each thread can have its own
+ * (independent) stream, and a run can be repeated from its seed.
+ *
+ * The generation methods of Gerrymander are templated on the generator
+ * (the "policy"), so any class with the same interface as RandomSource
+ * can be passed in. Two engines are provided:
+ *
+ * Xoshiro256StarStar => xoshiro256** (Blackman & Vigna), the default
+ * Pcg32 => PCG-XSH-RR with 64 bits of state (O'Neill)
+ *
+ * Both are a handful of arithmetic instructions per number, far cheaper
+ * than the library generator.
+ */
+
+#pragma once
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <climits>
+#include <cstdint>
+
+#include "error.h"
+#include "random.h"
+
+/* Returns the seed of an independent stream derived from a base seed (SplitMix64),
+ * so that workers seeded with (seed, 0), (seed, 1), ... don't overlap
+ */
+inline uint64_t streamSeed(uint64_t seed, uint64_t stream) {
+    uint64_t z = seed + (stream + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Returns a seed drawn from "random.h" (so that setRandomSeed() still applies)
+inline uint64_t freshSeed() {
+    return (uint64_t(randomInteger(0, INT_MAX)) << 32) ^ uint64_t(randomInteger(0, INT_MAX));
+}
+
+// xoshiro256**, whose 256 bits of state are filled from the seed with SplitMix64
+class Xoshiro256StarStar
+{
+public:
+    explicit Xoshiro256StarStar(uint64_t seed) {
+        for (int i = 0; i < 4; i++) {
+            state[i] = streamSeed(seed, i);
+        }
+    }
+
+    // Returns the next 32 random bits (the upper half, which are the strongest)
+    uint32_t next32() {
+        const uint64_t result = rotate(state[1] * 5, 7) * 9;
+        const uint64_t t = state[1] << 17;
+
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotate(state[3], 45);
+
+        return uint32_t(result >> 32);
+    }
+
+private:
+    uint64_t state[4];
+
+    static uint64_t rotate(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+// PCG32 (XSH-RR), where the seed picks both the starting state and the stream
+class Pcg32
+{
+public:
+    explicit Pcg32(uint64_t seed) {
+        state = 0;
+        increment = (streamSeed(seed, 0) << 1) | 1;
+        next32();
+        state += seed;
+        next32();
+    }
+
+    // Returns the next 32 random bits
+    uint32_t next32() {
+        const uint64_t old = state;
+        state = old * 6364136223846793005ULL + increment;
+
+        const uint32_t shifted = uint32_t(((old >> 18) ^ old) >> 27);
+        const uint32_t rotation = uint32_t(old >> 59);
+        return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+    }
+
+private:
+    uint64_t state;
+    uint64_t increment;
+};
+
+/* The interface the generators use, on top of any engine with a next32() method.
+ *
+ * Bounded integers use Lemire's multiply-and-shift method (unbiased, and almost
+ * never needs more than a single draw).
+ */
+template <typename Engine>
+class RandomSource
+{
+public:
+    // Creates a generator whose stream is determined by the seed
+    explicit RandomSource(uint64_t seed) : engine(seed), initialSeed(seed) {}
+
+    // Returns a random integer within [low, high] (throws an error if low > high)
+    int nextInt(int low, int high) {
+        if (low > high) {
+            error("RandomSource: the range is empty");
+        }
+
+        // The whole range of an int (2^32 values) wraps around to 0, and needs no bound
+        const uint32_t range = uint32_t(int64_t(high) - low + 1);
+        if (range == 0) {
+            return int(int64_t(low) + int64_t(engine.next32()));
+        }
+
+        uint64_t product = uint64_t(engine.next32()) * range;
+        uint32_t leftover = uint32_t(product);
+
+        if (leftover < range) {
+            const uint32_t threshold = uint32_t(-range) % range;
+            while (leftover < threshold) {
+                product = uint64_t(engine.next32()) * range;
+                leftover = uint32_t(product);
+            }
+        }
+        return int(int64_t(low) + int64_t(product >> 32));
+    }
+
+    // Returns true or false with equal probability
+    bool nextBool() {
+        return engine.next32() >> 31;
+    }
+
+    // Returns true with the given probability
+    bool nextChance(double probability) {
+        return engine.next32() * (1.0 / 4294967296.0) < probability;
+    }
+
+    // Returns the seed the generator was created with
+    uint64_t seed() const {
+        return initialSeed;
+    }
+
+    // Kept on the generator as well, so that templated code can reach them through the policy
+    static uint64_t streamSeed(uint64_t seed, uint64_t stream) {
+        return ::streamSeed(seed, stream);
+    }
+
+    static uint64_t freshSeed() {
+        return ::freshSeed();
+    }
+
+private:
+    Engine engine;
+    uint64_t initialSeed;
+};
+
+// The default generator
+typedef RandomSource<Xoshiro256StarStar> Rng;
+// The alternative generator
+typedef RandomSource<Pcg32> PcgRng;
+
+#endif // RNG_H
@@ -0,0 +1,386 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the work-stealing pool and the
+ * ensemble scheduler.
+ *
+ * A thread takes the newest task of its own queue (whose data is most likely
+ * still in its cache), and steals the oldest task of another queue. A chain
+ * that finishes a chunk is put back at the oldest end of the queue, so every
+ * newer task of the queue runs first, and the chunk is the first to be stolen
+ * by a thread that runs out of work.
+ */
+
+#include "scheduler.h"
+
+#include <algorithm>
+#include <future>
+
+#include "testing/SimpleTest.h"
+#include "testmaps.h"
+
+// The pool and queue of the calling thread, if it is a worker of a pool
+static thread_local WorkStealingPool* currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+WorkStealingPool::WorkStealingPool(int workers) : queued(0), unfinished(0), nextQueue(0), steals(0), stopping(false) {
+    if (workers <= 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int worker = 0; worker < workers; worker++) {
+        queues.emplace_back(new TaskQueue());
+    }
+    for (int worker = 0; worker < workers; worker++) {
+        threads.emplace_back([this, worker]() {
+            work(worker);
+        });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::submit(std::function<void()> task) {
+    push(std::move(task), false);
+}
+
+void WorkStealingPool::resubmit(std::function<void()> task) {
+    push(std::move(task), true);
+}
+
+WorkStealingPool::TaskQueue& WorkStealingPool::queueForSubmit() {
+    if (currentPool == this) {
+        return *queues[currentWorker];
+    }
+    return *queues[nextQueue++ % queues.size()];
+}
+
+void WorkStealingPool::push(std::function<void()> task, bool front) {
+    unfinished++;
+    TaskQueue& queue = queueForSubmit();
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (front) {
+            queue.tasks.push_front(std::move(task));
+        } else {
+            queue.tasks.push_back(std::move(task));
+        }
+    }
+
+    // Counted under the sleep lock, so that a thread about to sleep can't miss it
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+bool WorkStealingPool::take(int worker, std::function<void()>& task) {
+    {
+        TaskQueue& own = *queues[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < queues.size(); i++) {
+        TaskQueue& other = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(other.lock);
+        if (!other.tasks.empty()) {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            queued--;
+            steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::work(int worker) {
+    currentPool = this;
+    currentWorker = worker;
+
+    std::function<void()> task;
+    while (true) {
+        if (take(worker, task)) {
+            task();
+            task = nullptr;
+
+            std::lock_guard<std::mutex> guard(sleepLock);
+            if (--unfinished == 0) {
+                idle.notify_all();
+                wake.notify_all();
+            }
+            continue;
+        }
+
+        // Sleeps until a task is queued, or until the pool is stopping and every task has finished
+        std::unique_lock<std::mutex> guard(sleepLock);
+        wake.wait(guard, [this]() {
+            return queued > 0 || (stopping && unfinished == 0);
+        });
+        if (queued == 0) {
+            return;
+        }
+    }
+}
+
+void WorkStealingPool::waitIdle() {
+    std::unique_lock<std::mutex> guard(sleepLock);
+    idle.wait(guard, [this]() {
+        return unfinished == 0;
+    });
+}
+
+int WorkStealingPool::workerCount() const {
+    return threads.size();
+}
+
+long WorkStealingPool::stolenCount() const {
+    return steals;
+}
+
+struct EnsembleScheduler::Run {
+    EnsembleJob job;
+    JobControl control;
+    std::promise<EnsembleSummary> promise;
+    // Created by the first chunk
+    std::unique_ptr<EnsembleSampler> sampler;
+    EnsembleSummary summary;
+    double totalGap;
+    int bestScore;
+};
+
+EnsembleScheduler::EnsembleScheduler(int workers, int chunkSteps) : chunkSteps(std::max(1, chunkSteps)), pool(workers) {}
+
+EnsembleScheduler::~EnsembleScheduler() {
+    // Every job stops before its next chunk
+    shutdown.cancel();
+}
+
+JobHandle<EnsembleSummary> EnsembleScheduler::submit(const EnsembleJob& job, const JobControl& control) {
+    job.map->votingMap().freeze();
+
+    std::shared_ptr<Run> run = std::make_shared<Run>();
+    run->job = job;
+    run->control = control;
+    run->control.token = control.token.linkedWith(shutdown);
+    run->summary = EnsembleSummary{VALID_PLAN, 0, 0, 0, 0, 0, Plan()};
+    run->totalGap = 0;
+    run->bestScore = -1;
+
+    JobHandle<EnsembleSummary> handle(run->promise.get_future(), run->control.token);
+    pool.submit([this, run]() {
+        runChunk(run);
+    });
+    return handle;
+}
+
+/*
+ * Builds the chain on the first chunk, then runs up to chunkSteps steps of it (or stops it if it
+ * was cancelled or is past its deadline). Anything the chain throws is handed to the handle.
+ */
+void EnsembleScheduler::runChunk(const std::shared_ptr<Run>& run) {
+    const EnsembleJob& job = run->job;
+    EnsembleSummary& summary = run->summary;
+
+    try {
+        if (run->control.isCancelled()) {
+            finish(*run, CANCELLED);
+            return;
+        }
+        if (run->control.isPastDeadline()) {
+            finish(*run, DEADLINE_EXCEEDED);
+            return;
+        }
+
+        if (!run->sampler) {
+            Plan start = job.start;
+            if (start.districtCount() == 0) {
+                Rng rng(streamSeed(job.seed, 0));
+                GenerationResult built = job.map->partitionedPlan(job.totalDistricts, job.margin, job.maxIterations, rng);
+                if (built.status != VALID_PLAN) {
+                    summary.last = built.plan;
+                    finish(*run, built.status);
+                    return;
+                }
+                start = built.plan;
+            }
+            run->sampler.reset(new EnsembleSampler(start, job.margin, streamSeed(job.seed, 1)));
+            run->sampler->setRecomProbability(job.recomProbability);
+        }
+
+        const int offset = summary.steps;
+        const int steps = std::min(chunkSteps, job.steps - summary.steps);
+        run->sampler->run(steps, [&](int step, const EfficiencyGapScorer& state) {
+            const double gap = state.efficiencyGap();
+            if (summary.accepted++ == 0) {
+                summary.minEfficiencyGap = gap;
+                summary.maxEfficiencyGap = gap;
+            }
+            summary.minEfficiencyGap = std::min(summary.minEfficiencyGap, gap);
+            summary.maxEfficiencyGap = std::max(summary.maxEfficiencyGap, gap);
+            run->totalGap += gap;
+            run->bestScore = std::max(run->bestScore, state.score());
+
+            if (job.callback) {
+                job.callback(offset + step, state);
+            }
+        });
+        summary.steps += steps;
+
+        if (run->control.progress) {
+            run->control.progress({summary.steps, run->bestScore});
+        }
+
+        if (summary.steps >= job.steps) {
+            finish(*run, VALID_PLAN);
+        } else {
+            pool.resubmit([this, run]() {
+                runChunk(run);
+            });
+        }
+    } catch (...) {
+        run->promise.set_exception(std::current_exception());
+    }
+}
+
+void EnsembleScheduler::finish(Run& run, GenerationStatus status) {
+    EnsembleSummary& summary = run.summary;
+    summary.status = status;
+    if (run.sampler) {
+        summary.last = run.sampler->plan();
+    }
+    summary.meanEfficiencyGap = summary.accepted == 0 ? 0 : run.totalGap / summary.accepted;
+    run.promise.set_value(summary);
+}
+
+int EnsembleScheduler::workerCount() const {
+    return pool.workerCount();
+}
+
+long EnsembleScheduler::stolenCount() const {
+    return pool.stolenCount();
+}
+
+
+/************** TESTS **************/
+
+// Every other column votes Democrat (by 3 to 1), on a map that the jobs share
+static std::shared_ptr<Gerrymander> stripedGrid(int width, int height) {
+    std::shared_ptr<Gerrymander> map = std::make_shared<Gerrymander>();
+    addGridMap(*map, width, height, [](int id) { return landslide(id % 2 == 0); });
+    return map;
+}
+
+STUDENT_TEST("Running tasks on a work-stealing pool") {
+    WorkStealingPool pool(4);
+    std::atomic<int> ran(0);
+
+    // Every task queues more tasks on its own thread, which the idle threads steal
+    for (int i = 0; i < 4; i++) {
+        pool.submit([&]() {
+            for (int j = 0; j < 50; j++) {
+                pool.submit([&]() {
+                    ran++;
+                });
+            }
+            ran++;
+        });
+    }
+    pool.waitIdle();
+    EXPECT_EQUAL(ran.load(), 204);
+}
+
+STUDENT_TEST("Scheduling ensemble chains over several maps") {
+    std::shared_ptr<Gerrymander> small = stripedGrid(4, 4);
+    std::shared_ptr<Gerrymander> large = stripedGrid(10, 10);
+
+    EnsembleScheduler scheduler(3, 100);
+
+    EnsembleJob longJob;
+    longJob.map = large;
+    longJob.totalDistricts = 4;
+    longJob.steps = 3000;
+    longJob.seed = 7;
+
+    EnsembleJob shortJob;
+    shortJob.map = small;
+    shortJob.totalDistricts = 2;
+    shortJob.steps = 150;
+    shortJob.seed = 8;
+    int streamed = 0;
+    shortJob.callback = [&](int, const EfficiencyGapScorer&) {
+        streamed++;
+    };
+
+    std::vector<JobHandle<EnsembleSummary>> longHandles;
+    for (int i = 0; i < 4; i++) {
+        longHandles.push_back(scheduler.submit(longJob));
+    }
+    JobHandle<EnsembleSummary> shortHandle = scheduler.submit(shortJob);
+
+    const EnsembleSummary& shortSummary = shortHandle.get();
+    EXPECT_EQUAL(shortSummary.status, VALID_PLAN);
+    EXPECT_EQUAL(shortSummary.steps, 150);
+    EXPECT_EQUAL(shortSummary.accepted, streamed);
+    EXPECT(shortSummary.minEfficiencyGap <= shortSummary.meanEfficiencyGap);
+    EXPECT(shortSummary.meanEfficiencyGap <= shortSummary.maxEfficiencyGap);
+    EXPECT(small->isValidPlan(shortSummary.last, 0.2));
+
+    // The chunks don't change the chain, so every copy of the long job ends on the same plan
+    for (JobHandle<EnsembleSummary>& handle : longHandles) {
+        EXPECT_EQUAL(handle.get().status, VALID_PLAN);
+        EXPECT_EQUAL(handle.get().steps, 3000);
+        EXPECT(handle.get().last == longHandles[0].get().last);
+    }
+
+    // Which is the plan the chain ends on when it is run on its own
+    Rng rng(streamSeed(longJob.seed, 0));
+    GenerationResult start = large->partitionedPlan(4, 0.2, 1000, rng);
+    EnsembleSampler sampler(start.plan, 0.2, streamSeed(longJob.seed, 1));
+    sampler.run(3000, nullptr);
+    EXPECT(sampler.plan() == longHandles[0].get().last);
+}
+
+STUDENT_TEST("Stopping scheduled ensemble chains") {
+    std::shared_ptr<Gerrymander> map = stripedGrid(10, 10);
+    EnsembleScheduler scheduler(2, 50);
+
+    EnsembleJob job;
+    job.map = map;
+    job.totalDistricts = 4;
+    job.steps = 100000000;
+
+    int lastSteps = 0;
+    JobControl control;
+    control.progress = [&](const JobProgress& progress) {
+        lastSteps = progress.attempts;
+    };
+    JobHandle<EnsembleSummary> endless = scheduler.submit(job, control);
+    EXPECT(!endless.waitFor(20));
+    endless.cancel();
+    EXPECT_EQUAL(endless.get().status, CANCELLED);
+    EXPECT_EQUAL(endless.get().steps, lastSteps);
+    EXPECT(map->isValidPlan(endless.get().last, 0.2));
+
+    JobControl timed;
+    timed.setTimeLimit(20);
+    EXPECT_EQUAL(scheduler.submit(job, timed).get().status, DEADLINE_EXCEEDED);
+
+    // A starting plan that can't be built
+    job.totalDistricts = 1000;
+    EXPECT_EQUAL(scheduler.submit(job).get().status, NO_STARTING_PLAN);
+}
@@ -0,0 +1,165 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the EnsembleScheduler class, which runs many
+ * ensemble chains (over any number of maps and district counts) at
+ * once on a WorkStealingPool.
+ *
+ * Every chain is run in chunks of steps. After a chunk, the chain is
+ * queued again behind the work that is already waiting, so a short job
+ * submitted next to hour-long chains still finishes in milliseconds,
+ * and a thread that runs out of work takes (steals) queued chunks from
+ * the others, so every core stays busy.
+ *
+ * The maps are shared by the jobs (they are only read once the jobs
+ * start), and a chain always produces the same plans whatever the
+ * chunks or the threads, since it keeps its own generator.
+ */
+
+#pragma once
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ensemble.h"
+#include "gerrymander.h"
+#include "jobs.h"
+
+/* A pool of threads that each keep their own queue of tasks.
+ *
+ * A thread runs the newest task of its own queue first, and once its queue is empty it
+ * steals the oldest task of another queue. Tasks submitted from outside the pool are
+ * spread over the queues in turn.
+ */
+class WorkStealingPool
+{
+public:
+    // Starts the threads (0 => one per core)
+    explicit WorkStealingPool(int workers = 0);
+    // Waits for every task (including the ones they submit), then for the threads
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Queues a task, which must not throw (on the queue of the calling thread, if it is one of the pool's, to be run next)
+    void submit(std::function<void()> task);
+    // Queues a task that continues a long job, behind every other task of the queue
+    void resubmit(std::function<void()> task);
+
+    // Waits until every task has finished, and no more are queued
+    void waitIdle();
+
+    int workerCount() const;
+    // Returns how many tasks were taken from the queue of another thread
+    long stolenCount() const;
+
+private:
+    struct TaskQueue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::vector<std::thread> threads;
+
+    // The threads sleep on wake when there is nothing to take
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    // The tasks that were queued but not taken yet, and the ones that have not finished (queued or running)
+    std::atomic<int> queued;
+    std::atomic<int> unfinished;
+    std::atomic<unsigned> nextQueue;
+    std::atomic<long> steals;
+    bool stopping;
+
+    // Returns the queue of the calling thread if it belongs to the pool, or the next one in turn
+    TaskQueue& queueForSubmit();
+    void push(std::function<void()> task, bool front);
+    // Takes a task from the worker's own queue, or else from any other queue
+    bool take(int worker, std::function<void()>& task);
+    void work(int worker);
+};
+
+// An ensemble chain to run
+struct EnsembleJob {
+    // The map the chain is run over, which is shared with the other jobs
+    std::shared_ptr<const Gerrymander> map;
+    int totalDistricts = 0;
+    double margin = 0.2;
+    // The proposals the chain makes
+    int steps = 0;
+    // The seed of the chain (and of its starting plan, if it is built)
+    uint64_t seed = 1;
+    double recomProbability = 0.5;
+    // The valid plan to start from (no districts => one is built by "Gerrymander::partitionedPlan", within maxIterations)
+    Plan start;
+    int maxIterations = 1000;
+    // Called for every accepted plan, on the thread running the chunk (the step counts from the start of the chain)
+    EnsembleSampler::PlanCallback callback = nullptr;
+};
+
+// What a chain did
+struct EnsembleSummary {
+    /* VALID_PLAN => every step was run; CANCELLED or DEADLINE_EXCEEDED => it stopped before;
+     * NO_STARTING_PLAN or BUDGET_EXHAUSTED => no valid starting plan could be built
+     */
+    GenerationStatus status;
+    int steps;
+    int accepted;
+    // The signed Efficiency Gap over every accepted plan (0 if there were none)
+    double minEfficiencyGap;
+    double maxEfficiencyGap;
+    double meanEfficiencyGap;
+    // The plan the chain ended on
+    Plan last;
+};
+
+class EnsembleScheduler
+{
+public:
+    // Starts the threads (0 => one per core), which run every chain chunkSteps steps at a time
+    explicit EnsembleScheduler(int workers = 0, int chunkSteps = 1000);
+    // Cancels every job that hasn't finished, and waits for the threads
+    ~EnsembleScheduler();
+
+    EnsembleScheduler(const EnsembleScheduler&) = delete;
+    EnsembleScheduler& operator=(const EnsembleScheduler&) = delete;
+
+    /* Queues a job. It is checked for cancellation and its deadline between chunks, and its
+     * progress is reported after every chunk (the attempts are the steps run so far, and the
+     * best score is the highest Efficiency Gap percentage of the accepted plans).
+     */
+    JobHandle<EnsembleSummary> submit(const EnsembleJob& job, const JobControl& control = JobControl());
+
+    int workerCount() const;
+    // Returns how many chunks were stolen by an idle thread
+    long stolenCount() const;
+
+private:
+    // A job on its way through the pool
+    struct Run;
+
+    int chunkSteps;
+    // Cancelled when the scheduler is destroyed, and linked with the token of every job
+    CancellationToken shutdown;
+    // Declared last, so that its threads are joined before anything they use is destroyed
+    WorkStealingPool pool;
+
+    // Runs the next chunk of a job, and queues the one after it (or finishes the job)
+    void runChunk(const std::shared_ptr<Run>& run);
+    // Hands the summary of a job to its handle
+    static void finish(Run& run, GenerationStatus status);
+};
+
+#endif // SCHEDULER_H
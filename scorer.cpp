@@ -0,0 +1,226 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the EfficiencyGapScorer class.
+ *
+ * The scorer is the building block for local searches: deltaScore()
+ * evaluates a candidate move without changing anything, and applyMove()
+ * commits it, both in constant time.
+ */
+
+#include "scorer.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+
+#include "error.h"
+#include "testing/SimpleTest.h"
+#include "testmaps.h"
+
+/*
+ * Copies the plan and sums the wasted votes of every district once, O(districts)
+ */
+EfficiencyGapScorer::EfficiencyGapScorer(const Plan& plan) : current(plan) {
+    demWasteTotal = 0;
+    repWasteTotal = 0;
+    votes = 0;
+
+    for (int district = 0; district < current.districtCount(); district++) {
+        int dem = current.districtDem(district);
+        int rep = current.districtRep(district);
+
+        demWasteTotal += wastedDemVotes(dem, rep);
+        repWasteTotal += wastedRepVotes(dem, rep);
+        votes += dem + rep;
+    }
+}
+
+/*
+ * Returns the change in (demWaste - repWaste) of the whole plan by recomputing the
+ * waste of only the 2 districts involved, with and without the precinct.
+ */
+int EfficiencyGapScorer::deltaWaste(int precinct, int fromDistrict, int toDistrict) const {
+    if (fromDistrict == toDistrict) {
+        return 0;
+    }
+
+    DemographicView demo = current.votingMap().demographicAt(precinct);
+    int fromDem = current.districtDem(fromDistrict);
+    int fromRep = current.districtRep(fromDistrict);
+    int toDem = current.districtDem(toDistrict);
+    int toRep = current.districtRep(toDistrict);
+
+    int before = wasteDifference(fromDem, fromRep) + wasteDifference(toDem, toRep);
+    int after = wasteDifference(fromDem - demo.dem, fromRep - demo.rep)
+              + wasteDifference(toDem + demo.dem, toRep + demo.rep);
+    return after - before;
+}
+
+/*
+ * Returns the change in the signed Efficiency Gap, the total votes don't change with
+ * a move, so this is just the change in waste scaled down
+ */
+double EfficiencyGapScorer::deltaScore(int precinct, int fromDistrict, int toDistrict) const {
+    if (votes == 0) {
+        return 0;
+    }
+
+    return double(deltaWaste(precinct, fromDistrict, toDistrict)) / votes;
+}
+
+/*
+ * Removes the waste of the 2 districts, moves the precinct (updating the district
+ * totals through the plan), then adds the waste of the 2 districts back in.
+ */
+void EfficiencyGapScorer::applyMove(int precinct, int fromDistrict, int toDistrict) {
+    if (current.districtOf(precinct) != fromDistrict) {
+        error("applyMove: precinct is not in the district it is being moved from");
+    }
+    if (fromDistrict == toDistrict) {
+        return;
+    }
+
+    for (int district : {fromDistrict, toDistrict}) {
+        demWasteTotal -= wastedDemVotes(current.districtDem(district), current.districtRep(district));
+        repWasteTotal -= wastedRepVotes(current.districtDem(district), current.districtRep(district));
+    }
+
+    current.assign(precinct, toDistrict);
+
+    for (int district : {fromDistrict, toDistrict}) {
+        demWasteTotal += wastedDemVotes(current.districtDem(district), current.districtRep(district));
+        repWasteTotal += wastedRepVotes(current.districtDem(district), current.districtRep(district));
+    }
+}
+
+double EfficiencyGapScorer::efficiencyGap() const {
+    if (votes == 0) {
+        return 0;
+    }
+
+    return double(demWasteTotal - repWasteTotal) / votes;
+}
+
+/*
+ * The same formula (and truncation) as "Gerrymander::howGerrymandered"
+ */
+int EfficiencyGapScorer::score() const {
+    if (votes == 0) {
+        return 0;
+    }
+
+    return 100 * abs(demWasteTotal - repWasteTotal) / votes;
+}
+
+int EfficiencyGapScorer::demWaste() const {
+    return demWasteTotal;
+}
+
+int EfficiencyGapScorer::repWaste() const {
+    return repWasteTotal;
+}
+
+int EfficiencyGapScorer::totalVotes() const {
+    return votes;
+}
+
+const Plan& EfficiencyGapScorer::plan() const {
+    return current;
+}
+
+int EfficiencyGapScorer::wasteDifference(int dem, int rep) const {
+    return wastedDemVotes(dem, rep) - wastedRepVotes(dem, rep);
+}
+
+/*
+ * Every plan already keeps the totals of its districts, so scoring is a pass over 2
+ * arrays per plan. The waste functions have no branches, so the compiler can vectorize it.
+ */
+void scoreBatch(const Plan* plans, size_t count, Score* out) {
+    for (size_t i = 0; i < count; i++) {               // O(total districts)
+        const int* dem = plans[i].demTotals().data();
+        const int* rep = plans[i].repTotals().data();
+        const int districts = plans[i].districtCount();
+
+        int demWaste = 0;
+        int repWaste = 0;
+        int votes = 0;
+        for (int district = 0; district < districts; district++) {
+            demWaste += wastedDemVotes(dem[district], rep[district]);
+            repWaste += wastedRepVotes(dem[district], rep[district]);
+            votes += dem[district] + rep[district];
+        }
+
+        Score& score = out[i];
+        score.demWaste = demWaste;
+        score.repWaste = repWaste;
+        score.votes = votes;
+        score.efficiencyGap = (votes == 0) ? 0 : double(demWaste - repWaste) / votes;
+        score.percent = (votes == 0) ? 0 : 100 * abs(demWaste - repWaste) / votes;
+        score.valid = true;
+    }
+}
+
+
+/************** TESTS **************/
+
+STUDENT_TEST("Wasted votes without branches") {
+    // Evaluated at compile time
+    static_assert(wastedDemVotes(7, 3) == 3, "surplus votes of the winner");
+    static_assert(wastedRepVotes(7, 3) == 3, "every vote of the loser");
+    static_assert(WastedVoteAdvantage<REPUBLICANS>::value(7, 3) == 0, "");
+    static_assert(WastedVoteAdvantage<DEMOCRATS>::value(3, 7) == 0, "");
+
+    // Matches the definition, including ties (which the Republicans win)
+    for (int dem = 0; dem < 20; dem++) {
+        for (int rep = 0; rep < 20; rep++) {
+            EXPECT_EQUAL(wastedDemVotes(dem, rep), (dem > rep) ? dem - rep - 1 : dem);
+            EXPECT_EQUAL(wastedRepVotes(dem, rep), (dem > rep) ? rep : rep - dem - 1);
+            EXPECT_EQUAL(WastedVoteAdvantage<REPUBLICANS>::value(dem, rep), -WastedVoteAdvantage<DEMOCRATS>::value(dem, rep));
+        }
+    }
+}
+
+STUDENT_TEST("Incremental scoring matches scoring from scratch") {
+    // 10x5 grid where the 2 left columns vote Democrat
+    VotingMap map;
+    addGridMap(map, 5, 10, [](int id) { return oneVote(id % 5 < 2); });
+
+    // Cracking
+    Plan plan(map, 5);
+    for (int index = 0; index < 50; index++) {
+        plan.assign(index, index / 10);
+    }
+
+    EfficiencyGapScorer scorer(plan);
+    EXPECT_EQUAL(scorer.score(), 30);
+    EXPECT_EQUAL(scorer.demWaste(), 20);
+    EXPECT_EQUAL(scorer.repWaste(), 5);
+
+    /* While every district is won by the Republicans, a move leaves the waste as it was, so 2 Democratic
+     * precincts of the second district join the first one first (which ties it at 6 to 6)
+     */
+    plan.assign(10, 0);
+    plan.assign(15, 0);
+    scorer = EfficiencyGapScorer(plan);
+
+    // Each move flips the first district, or changes a margin while it is won by the Democrats
+    for (std::pair<int, int> move : {std::make_pair(16, 0), std::make_pair(9, 1), std::make_pair(16, 1), std::make_pair(15, 1)}) {
+        const int precinct = move.first;
+        const int from = scorer.plan().districtOf(precinct);
+        const int to = move.second;
+
+        const int before = scorer.demWaste() - scorer.repWaste();
+        const int delta = scorer.deltaWaste(precinct, from, to);
+        EXPECT(delta != 0);
+        EXPECT(std::abs(scorer.deltaScore(precinct, from, to) - double(delta) / scorer.totalVotes()) < 1e-12);
+        scorer.applyMove(precinct, from, to);
+
+        EXPECT_EQUAL(scorer.demWaste() - scorer.repWaste(), before + delta);
+        EfficiencyGapScorer fromScratch(scorer.plan());
+        EXPECT_EQUAL(fromScratch.demWaste(), scorer.demWaste());
+        EXPECT_EQUAL(fromScratch.repWaste(), scorer.repWaste());
+    }
+
+    EXPECT_ERROR(scorer.applyMove(0, 3, 4));
+}
@@ -0,0 +1,124 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the EfficiencyGapScorer class, which keeps
+ * the Efficiency Gap of a Plan up to date as precincts are moved
+ * between districts.
+ *
+ * Every move only changes the totals of 2 districts, so instead of
+ * re-summing the whole plan, the scorer keeps running per-district
+ * totals (through its Plan) and the wasted votes of each party, and
+ * only recomputes the waste of the 2 districts involved (O(1)).
+ *
+ * It also outlines scoreBatch(), which scores many (finished) plans
+ * at once, for analysing ensembles.
+ */
+
+#pragma once
+
+#ifndef SCORER_H
+#define SCORER_H
+
+#include "plan.h"
+
+/* The wasted votes of each party in a single district.
+ *
+ * Every vote for the losing party is wasted, as is every vote for the winner
+ * beyond the one needed to win. (Shared by the Gerrymander class and the scorer.)
+ *
+ * They sit in the inner loops of the scorers and generators, so instead of a branch,
+ * the result is picked with a mask (demWins is all ones if the Democrats won the
+ * district, and all zeros otherwise), which also lets loops over districts vectorize.
+ */
+constexpr int wastedRepVotes(int dem, int rep) {
+    const int demWins = -int(dem > rep);
+    return (demWins & rep) | (~demWins & (rep - dem - 1));
+}
+
+constexpr int wastedDemVotes(int dem, int rep) {
+    const int demWins = -int(dem > rep);
+    return (demWins & (dem - rep - 1)) | (~demWins & dem);
+}
+
+// The parties that a plan can be gerrymandered for
+enum Party {
+    DEMOCRATS,
+    REPUBLICANS
+};
+
+/* The objective that the greedy generator maximizes for the favored party: the votes the
+ * other party wastes in a district, minus the votes the favored party wastes.
+ *
+ * Objectives are passed to the generator as a template argument (any type with the same
+ * static value() method will do, as long as it is linear in the votes on either side of
+ * dem > rep, like the wasted votes), so the choice is made at compile time.
+ */
+template <Party favored>
+struct WastedVoteAdvantage {
+    static constexpr int value(int dem, int rep) {
+        return (favored == REPUBLICANS) ? wastedDemVotes(dem, rep) - wastedRepVotes(dem, rep)
+                                        : wastedRepVotes(dem, rep) - wastedDemVotes(dem, rep);
+    }
+};
+
+class EfficiencyGapScorer
+{
+public:
+    // Creates a scorer over a copy of the given (fully assigned) plan
+    EfficiencyGapScorer(const Plan& plan);
+
+    // Returns the change in the signed Efficiency Gap if precinct moved from one district to another, O(1)
+    double deltaScore(int precinct, int fromDistrict, int toDistrict) const;
+    // Returns the change in (demWaste - repWaste) if precinct moved from one district to another, O(1)
+    int deltaWaste(int precinct, int fromDistrict, int toDistrict) const;
+    // Moves a precinct from one district to another, updating every total, O(1)
+    void applyMove(int precinct, int fromDistrict, int toDistrict);
+
+    /* Returns the signed Efficiency Gap, (demWaste - repWaste) / totalVotes, where a
+     * positive number means more Democratic votes are being wasted (favoring Republicans)
+     */
+    double efficiencyGap() const;
+    // Returns the Efficiency Gap as a truncated percentage, like "Gerrymander::howGerrymandered"
+    int score() const;
+
+    // Returns the running totals
+    int demWaste() const;
+    int repWaste() const;
+    int totalVotes() const;
+    // Returns the plan in its current state
+    const Plan& plan() const;
+
+private:
+    // The plan being scored, which also holds the per-district totals
+    Plan current;
+    // Wasted votes summed over every district
+    int demWasteTotal;
+    int repWasteTotal;
+    // Votes cast over every district (unchanged by moves)
+    int votes;
+
+    // (demWaste - repWaste) of a single district with the given totals
+    int wasteDifference(int dem, int rep) const;
+};
+
+/* The Efficiency Gap of a single plan of a batch
+ */
+struct Score {
+    // Wasted votes of each party, summed over every district
+    int demWaste;
+    int repWaste;
+    // Votes cast over every district
+    int votes;
+    // The signed Efficiency Gap, like "EfficiencyGapScorer::efficiencyGap()"
+    double efficiencyGap;
+    // The truncated percentage, like "Gerrymander::howGerrymandered(Plan)" (-1 if the plan is not valid)
+    int percent;
+    // Whether the plan is valid (true if it wasn't validated)
+    bool valid;
+};
+
+/* Scores count plans into out (which must have room for count scores), without validating
+ * them, O(total districts)
+ */
+void scoreBatch(const Plan* plans, size_t count, Score* out);
+
+#endif // SCORER_H
@@ -0,0 +1,197 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file is the implementation of the generator stats.
+ *
+ * The counters of every living thread are listed in a registry, which is only
+ * locked when a thread starts or finishes counting, or the stats are collected.
+ * A reset remembers the totals at the time instead of clearing the counters,
+ * since only their own threads can write to them.
+ */
+
+#include "stats.h"
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "testing/SimpleTest.h"
+
+namespace {
+
+struct StatsRegistry {
+    std::mutex lock;
+    // The counters of every living thread
+    std::vector<ThreadStats*> live;
+    // The counters of every finished thread, and the totals at the last reset
+    long long retired[STAT_COUNTERS] = {};
+    long long baseline[STAT_COUNTERS] = {};
+
+    // Adds up every counter (with the lock held)
+    void total(long long* totals) const {
+        for (int counter = 0; counter < STAT_COUNTERS; counter++) {
+            totals[counter] = retired[counter];
+        }
+        for (const ThreadStats* stats : live) {
+            for (int counter = 0; counter < STAT_COUNTERS; counter++) {
+                totals[counter] += stats->values[counter].load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+// Never destroyed, so that threads finishing during shutdown can still retire their counters
+StatsRegistry& statsRegistry() {
+    static StatsRegistry* registry = new StatsRegistry();
+    return *registry;
+}
+
+} // namespace
+
+ThreadStats::ThreadStats() {
+    for (int counter = 0; counter < STAT_COUNTERS; counter++) {
+        values[counter].store(0, std::memory_order_relaxed);
+    }
+
+    StatsRegistry& registry = statsRegistry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    registry.live.push_back(this);
+}
+
+ThreadStats::~ThreadStats() {
+    StatsRegistry& registry = statsRegistry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    for (int counter = 0; counter < STAT_COUNTERS; counter++) {
+        registry.retired[counter] += values[counter].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < registry.live.size(); i++) {
+        if (registry.live[i] == this) {
+            registry.live[i] = registry.live.back();
+            registry.live.pop_back();
+            break;
+        }
+    }
+}
+
+ThreadStats& threadStats() {
+    thread_local ThreadStats stats;
+    return stats;
+}
+
+GeneratorStats collectGeneratorStats() {
+    long long totals[STAT_COUNTERS];
+    StatsRegistry& registry = statsRegistry();
+    {
+        std::lock_guard<std::mutex> guard(registry.lock);
+        registry.total(totals);
+        for (int counter = 0; counter < STAT_COUNTERS; counter++) {
+            totals[counter] -= registry.baseline[counter];
+        }
+    }
+
+    GeneratorStats stats;
+    stats.attempts = totals[ATTEMPTS];
+    stats.validations = totals[VALIDATIONS];
+    stats.validPlans = totals[VALID_PLANS];
+    stats.coverageRejections = totals[COVERAGE_REJECTIONS];
+    stats.populationRejections = totals[POPULATION_REJECTIONS];
+    stats.contiguityRejections = totals[CONTIGUITY_REJECTIONS];
+    stats.scores = totals[SCORES];
+    stats.districtsGrown = totals[DISTRICTS_GROWN];
+    stats.growthSteps = totals[GROWTH_STEPS];
+    stats.generateNs = totals[GENERATE_NS];
+    stats.validateNs = totals[VALIDATE_NS];
+    stats.scoreNs = totals[SCORE_NS];
+    return stats;
+}
+
+void resetGeneratorStats() {
+    StatsRegistry& registry = statsRegistry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    registry.total(registry.baseline);
+}
+
+double GeneratorStats::meanGrowthSteps() const {
+    return districtsGrown == 0 ? 0 : double(growthSteps) / districtsGrown;
+}
+
+#ifdef GERRYMANDER_TRACE
+
+static std::atomic<TraceHook> currentTraceHook(nullptr);
+
+void setTraceHook(TraceHook hook) {
+    currentTraceHook.store(hook, std::memory_order_release);
+}
+
+TraceHook traceHook() {
+    return currentTraceHook.load(std::memory_order_acquire);
+}
+
+#endif // GERRYMANDER_TRACE
+
+
+/************** TESTS **************/
+
+STUDENT_TEST("Adding up the stats of every thread") {
+    resetGeneratorStats();
+    GeneratorStats stats = collectGeneratorStats();
+    EXPECT_EQUAL(stats.attempts, 0);
+    EXPECT_EQUAL(stats.meanGrowthSteps(), 0.0);
+
+    threadStats().add(ATTEMPTS);
+    threadStats().add(DISTRICTS_GROWN, 2);
+    threadStats().add(GROWTH_STEPS, 10);
+
+    // The counters of finished threads are kept
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([]() {
+            threadStats().add(ATTEMPTS, 3);
+            threadStats().add(DISTRICTS_GROWN);
+            threadStats().add(GROWTH_STEPS, 5);
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    stats = collectGeneratorStats();
+    EXPECT_EQUAL(stats.attempts, 13);
+    EXPECT_EQUAL(stats.districtsGrown, 6);
+    EXPECT_EQUAL(stats.meanGrowthSteps(), 5.0);
+
+    {
+        StatTimer timer(SCORE_NS);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT(collectGeneratorStats().scoreNs >= 1000000);
+
+    resetGeneratorStats();
+    EXPECT_EQUAL(collectGeneratorStats().attempts, 0);
+    EXPECT_EQUAL(collectGeneratorStats().scoreNs, 0);
+}
+
+#ifdef GERRYMANDER_TRACE
+
+static int tracedSpans = 0;
+
+static void countSpan(const char*, long long, long long durationNs) {
+    if (durationNs >= 0) {
+        tracedSpans++;
+    }
+}
+
+STUDENT_TEST("Reporting trace spans to the hook") {
+    tracedSpans = 0;
+    setTraceHook(countSpan);
+    {
+        TRACE_SPAN("outer");
+        TRACE_SPAN("inner");
+    }
+    setTraceHook(nullptr);
+    {
+        TRACE_SPAN("unreported");
+    }
+    EXPECT_EQUAL(tracedSpans, 2);
+}
+
+#endif // GERRYMANDER_TRACE
@@ -0,0 +1,148 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the instrumentation of the generators: counters
+ * of what they did (attempts, why plans were turned down, how far the
+ * districts grew) and how long they spent generating, validating and
+ * scoring, along with optional trace spans.
+ *
+ * Every thread counts into its own counters (so counting never takes a
+ * lock or contends for a cache line), and the counters of every thread
+ * are only added up when the stats are asked for. The counters of threads
+ * that have finished are kept, so the workers of the parallel generators
+ * are counted too.
+ *
+ * Trace spans (TRACE_SPAN) report the name, start and duration of a scope
+ * to a hook. They are only compiled in when GERRYMANDER_TRACE is defined,
+ * and expand to nothing otherwise.
+ */
+
+#pragma once
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+
+// The counters every thread keeps
+enum StatCounter {
+    // Attempts at a plan (every try of the retrying generators, and every build of the repaired ones)
+    ATTEMPTS,
+    // Plans that were checked (not answered by the cache), and how many of them were valid
+    VALIDATIONS,
+    VALID_PLANS,
+    // Plans turned down at each check, in the order they are made
+    COVERAGE_REJECTIONS,
+    POPULATION_REJECTIONS,
+    CONTIGUITY_REJECTIONS,
+    // Plans that were scored (not answered by the cache)
+    SCORES,
+    // Districts grown by the generators, and the precincts that were added to them
+    DISTRICTS_GROWN,
+    GROWTH_STEPS,
+    // Nanoseconds spent in each phase
+    GENERATE_NS,
+    VALIDATE_NS,
+    SCORE_NS,
+    // The number of counters
+    STAT_COUNTERS
+};
+
+// The counters of every thread, added up (see "Gerrymander::stats()")
+struct GeneratorStats {
+    long long attempts;
+    long long validations;
+    long long validPlans;
+    long long coverageRejections;
+    long long populationRejections;
+    long long contiguityRejections;
+    long long scores;
+    long long districtsGrown;
+    long long growthSteps;
+    long long generateNs;
+    long long validateNs;
+    long long scoreNs;
+
+    // Returns how many precincts a district grew to on average (0 if none were grown)
+    double meanGrowthSteps() const;
+};
+
+// The counters of a single thread, which only it writes to
+struct ThreadStats {
+    // Atomic so that they can be added up while the thread is counting (relaxed, so they cost a plain add)
+    std::atomic<long long> values[STAT_COUNTERS];
+
+    ThreadStats();
+    // Keeps the counters of the thread after it finishes
+    ~ThreadStats();
+
+    void add(StatCounter counter, long long amount = 1) {
+        values[counter].store(values[counter].load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+};
+
+// Returns the counters of the calling thread
+ThreadStats& threadStats();
+
+// Adds up the counters of every thread (living or finished) since the last reset
+GeneratorStats collectGeneratorStats();
+// Starts counting from 0 again (without touching the counters of the threads)
+void resetGeneratorStats();
+
+// Adds the time from its creation to its destruction to one of the counters of the calling thread
+class StatTimer
+{
+public:
+    explicit StatTimer(StatCounter counter) : counter(counter), start(std::chrono::steady_clock::now()) {}
+
+    ~StatTimer() {
+        threadStats().add(counter, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                       std::chrono::steady_clock::now() - start).count());
+    }
+
+private:
+    StatCounter counter;
+    std::chrono::steady_clock::time_point start;
+};
+
+#ifdef GERRYMANDER_TRACE
+
+// Called at the end of every span, with its name, and its start (since the clock's epoch) and duration in nanoseconds
+typedef void (*TraceHook)(const char* name, long long startNs, long long durationNs);
+
+// Sets the hook that every span is reported to (nullptr => spans aren't reported)
+void setTraceHook(TraceHook hook);
+TraceHook traceHook();
+
+// Reports the scope it lives in to the trace hook
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char* name) : name(name), start(std::chrono::steady_clock::now()) {}
+
+    ~TraceSpan() {
+        TraceHook hook = traceHook();
+        if (hook) {
+            const long long startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count();
+            const long long durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                             std::chrono::steady_clock::now() - start).count();
+            hook(name, startNs, durationNs);
+        }
+    }
+
+private:
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define TRACE_SPAN_NAME(line) traceSpan##line
+#define TRACE_SPAN_AT(name, line) TraceSpan TRACE_SPAN_NAME(line)(name)
+#define TRACE_SPAN(name) TRACE_SPAN_AT(name, __LINE__)
+
+#else
+
+#define TRACE_SPAN(name)
+
+#endif // GERRYMANDER_TRACE
+
+#endif // STATS_H
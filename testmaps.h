@@ -0,0 +1,54 @@
+/* Christopher Lee (2022_08_07)
+ *
+ * This file outlines the grid maps that the tests are built on.
+ *
+ * A grid is numbered row by row (id => row * width + column), and every
+ * precinct borders the ones beside, above and below it. A line of precincts
+ * is a grid with a single row.
+ *
+ * The demographics of every precinct come from a function of its id, so a
+ * test spells out only how its map votes:
+ *
+ * addGridMap(map, 5, 10, [](int id) { return oneVote(id % 5 < 2); })
+ *          => the 10x5 grid, where the 2 left columns vote Democrat
+ */
+
+#pragma once
+
+#ifndef TESTMAPS_H
+#define TESTMAPS_H
+
+#include "set.h"
+#include "votingmap.h"
+
+// Returns the ids of the precincts that border the given one on a width x height grid
+inline Set<int> gridNeighbors(int id, int width, int height) {
+    Set<int> adj;
+    if (id >= width) adj.add(id - width);
+    if (id % width > 0) adj.add(id - 1);
+    if (id % width < width - 1) adj.add(id + 1);
+    if (id < width * (height - 1)) adj.add(id + width);
+    return adj;
+}
+
+// A precinct of one person, who votes Democrat if dem is true (and Republican otherwise)
+inline Demographic oneVote(bool dem) {
+    return Demographic(dem ? 1 : 0, dem ? 0 : 1, 1);
+}
+
+// A precinct of 4 people, who vote Democrat by 3 to 1 if dem is true (and Republican by 3 to 1 otherwise)
+inline Demographic landslide(bool dem) {
+    return Demographic(dem ? 3 : 1, dem ? 1 : 3, 4);
+}
+
+/* Adds a width x height grid to a map (a VotingMap or a Gerrymander), where the
+ * precinct with a given id gets demographic(id)
+ */
+template <typename Map, typename Demographics>
+void addGridMap(Map& map, int width, int height, Demographics demographic) {
+    for (int id = 0; id < width * height; id++) {
+        map.addArea(Area(id, demographic(id), gridNeighbors(id, width, height)));
+    }
+}
+
+#endif // TESTMAPS_H
@@ -10,42 +10,80 @@
 
 #include "votingmap.h"
 
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VOTINGMAP_MMAP
+#endif
 
 #include "error.h"
 #include "random.h"
+#include "rng.h"
 #include "strlib.h"
 #include "testing/SimpleTest.h"
 
 #include "set.h"
 
 // Default constructor
-VotingMap::VotingMap() {}
+VotingMap::VotingMap() {
+    numAreas = 0;
+    totalPopulation = 0;
+    loaded = false;
+    frozen = false;
+    layout = Layout{nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+    snapshot = nullptr;
+    snapshotSize = 0;
+    snapshotMapped = false;
+}
 
 /*
- * Destructor that goes through all IDs and deletes their associated Areas
+ * Destructor that releases the snapshot (the pool owns every Area, so there is nothing to delete)
  */
 VotingMap::~VotingMap() {
-    Vector<int> currentAreas = precinctVector();
-    for (int key : currentAreas) {
-        delete graph[key];
-    }
+    closeSnapshot();
 }
 
 /*
- * Adds an area to the map using {Area*->id : Area*}
+ * Adds an area to the map using {Area.id : slot in the pool}
  *
  * Updates totalPopulation as well as the total amount of elements the map holds
  */
-void VotingMap::addArea(Area* loc) {
-    if (contains(loc->id)) {
+void VotingMap::addArea(Area loc) {
+    if (contains(loc.id)) {
         return;
     }
-
-    graph.put(loc->id, loc);
+    if (loaded) {
+        unload();
+    }
 
     numAreas++;
-    totalPopulation += loc->pop;
+    totalPopulation += loc.pop;
+    frozen = false;
+
+    graph.put(loc.id, pool.size());
+    pool.push_back(std::move(loc));
+}
+
+/*
+ * Moves the area into the pool, and deletes the (now empty) original, so that it
+ * doesn't leak whether or not it was added
+ */
+void VotingMap::addArea(Area* loc) {
+    addArea(std::move(*loc));
+    delete loc;
 }
 
 /*
@@ -85,6 +123,13 @@ Set<int> VotingMap::precinctSet() const {
  * Returns a Vector of ids contained in the map
  */
 Vector<int> VotingMap::precinctVector() const {
+    if (loaded) {
+        Vector<int> result;
+        for (int index = 0; index < numAreas; index++) {
+            result.add(idAt(index));
+        }
+        return result;
+    }
     return graph.keys();
 }
 
@@ -92,53 +137,612 @@ Vector<int> VotingMap::precinctVector() const {
  * Returns the Demographic Struct using data from the given Area from the given id
  */
 Demographic VotingMap::getDemographic(int id) const {
-    Area* cur = getArea(id);
-    if (!cur) {
-        return Demographic{-1, -1, -1};
+    if (!isFrozen()) {
+        const Area& loc = getArea(id);
+        return Demographic{loc.dem, loc.rep, loc.pop};
     }
+    int index = indexOf(id);
 
-    return Demographic{cur->dem, cur->rep, cur->pop};
+    return Demographic{demAt(index), repAt(index), popAt(index)};
 }
 
 /*
- * Returns a Set of ids of the Areas that border the given Area
+ * Returns a view that references the demographic data of the given Area
  */
-Set<int> VotingMap::getAdjacentPrecincts(int id) const {
-    Area* loc = getArea(id);
+DemographicView VotingMap::getDemographicView(int id) const {
+    if (!isFrozen()) {
+        const Area& loc = getArea(id);
+        return DemographicView{loc.dem, loc.rep, loc.pop};
+    }
+    return demographicAt(indexOf(id));
+}
 
-    return loc->adjAreas;
+/*
+ * Returns a Set of ids of the Areas that border the given Area (leaving out
+ * adjacent ids that are not part of the map, like the compact layout does)
+ *
+ * This makes a copy, so the generators use neighborsOf() instead.
+ */
+Set<int> VotingMap::getAdjacentPrecincts(int id) const {
+    Set<int> adj;
+    if (!isFrozen()) {
+        for (int next : getArea(id).adjAreas) {
+            if (contains(next)) {
+                adj.add(next);
+            }
+        }
+        return adj;
+    }
+    for (int next : neighborsOf(indexOf(id))) {
+        adj.add(idAt(next));
+    }
+    return adj;
 }
 
 /*
  * Returns true if the Set of adjacent ids in a given Area (from id)
  * contains the id from adj (int adj)
+ *
+ * Each Area's neighbors are sorted, so this is a binary search of its row.
  */
 bool VotingMap::isAdjacdent(int id, int adj) const {
-    Area* cur = getArea(id);
-    if (!cur) {
+    if (!contains(id) || !contains(adj)) {
         return false;
     }
+    if (!isFrozen()) {
+        return getArea(id).adjAreas.contains(adj);
+    }
 
-    return cur->adjAreas.contains(adj);
+    NeighborView row = neighborsOf(indexOf(id));
+    return std::binary_search(row.begin(), row.end(), indexOf(adj));
 }
 
 /*
  * Returns true if the id is contained within the set
  */
 bool VotingMap::contains(int id) const {
+    if (loaded) {
+        return std::binary_search(layout.ids, layout.ids + numAreas, id);
+    }
     return graph.containsKey(id);
 }
 
+/*
+ * Builds the compact layout from the Areas added so far.
+ *
+ * Since the Map iterates in id order, the dense indices are sorted by id, which
+ * means that the neighbors of each Area come out sorted as well. Adjacent ids that
+ * are not part of the map are dropped.
+ *
+ * The layout is checked again under the lock, so it is only built by the first of
+ * the threads that freeze the map at the same time (the others wait for it).
+ */
+void VotingMap::freeze() const {
+    if (isFrozen()) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(freezeLock);
+    if (frozen.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    ids.clear();
+    dem.clear();
+    rep.clear();
+    pop.clear();
+    offsets.clear();
+    neighbors.clear();
+
+    for (int id : graph) {      // O(n log n)
+        const Area& loc = pool[graph[id]];
+        ids.push_back(id);
+        dem.push_back(loc.dem);
+        rep.push_back(loc.rep);
+        pop.push_back(loc.pop);
+    }
+
+    offsets.push_back(0);
+    for (int id : ids) {        // O(n + e log n)
+        for (int adj : pool[graph[id]].adjAreas) {
+            auto it = std::lower_bound(ids.begin(), ids.end(), adj);
+            if (it != ids.end() && *it == adj) {
+                neighbors.push_back(it - ids.begin());
+            }
+        }
+        offsets.push_back(neighbors.size());
+    }
+
+    useOwnedLayout();
+    frozen.store(true, std::memory_order_release);
+}
+
+/*
+ * Returns the dense index of a given id, if no such id exists (or the
+ * layout is out of date), it throws an error.
+ */
+int VotingMap::indexOf(int id) const {
+    if (!isFrozen()) {
+        error("The map has to be frozen before indexOf: " + integerToString(id));
+    }
+
+    const int* last = layout.ids + numAreas;
+    const int* it = std::lower_bound(layout.ids, last, id);     // O(log n)
+    if (it == last || *it != id) {
+        error("No area for given id: " + integerToString(id));
+    }
+
+    return it - layout.ids;
+}
+
+/*
+ * Parses a line of comma separated integers into fields (spaces around them are allowed).
+ *
+ * Returns false if the line doesn't hold exactly count integers. The fields are read as long long
+ * (which strtoll clamps to its range), so the callers can check them against the range of an int.
+ */
+static bool parseFields(const std::string& line, long long* fields, int count) {
+    const char* cur = line.c_str();
+
+    for (int i = 0; i < count; i++) {
+        char* end = nullptr;
+        fields[i] = std::strtoll(cur, &end, 10);
+        if (end == cur) {
+            return false;
+        }
+
+        cur = end;
+        while (*cur == ' ' || *cur == '\t' || *cur == '\r') {
+            cur++;
+        }
+        if (i < count - 1) {
+            if (*cur != ',') {
+                return false;
+            }
+            cur++;
+        }
+    }
+
+    return *cur == '\0';
+}
+
+/*
+ * Reads the next line that holds data (skipping blank lines and comments), and
+ * keeps track of the line number for error messages
+ */
+static bool nextDataLine(std::istream& input, std::string& line, int& lineNumber) {
+    while (std::getline(input, line)) {
+        lineNumber++;
+
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start != std::string::npos && line[start] != '#') {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Opens both files, and loads them with "loadFromStreams(istream&, istream&)"
+ */
+void VotingMap::loadFromFiles(const std::string& demographicsPath, const std::string& adjacencyPath) {
+    std::ifstream demographics(demographicsPath);
+    if (!demographics) {
+        error("Can't open demographics file: " + demographicsPath);
+    }
+
+    std::ifstream adjacency(adjacencyPath);
+    if (!adjacency) {
+        error("Can't open adjacency file: " + adjacencyPath);
+    }
+
+    loadFromStreams(demographics, adjacency);
+}
+
+/*
+ * Reads both inputs a line at a time (each is read once), then builds the compact layout:
+ *
+ * The Areas are sorted by id (as freeze() would order them), the borders are turned into
+ * dense indices, and counted per Area, so that the offsets and neighbors can be allocated
+ * at their final size and filled in place. Finally, every row is sorted, and every border
+ * is looked up from the other side to check that it is listed both ways.
+ *
+ * O(n log n + e log e)
+ */
+void VotingMap::loadFromStreams(std::istream& demographics, std::istream& adjacency) {
+    if (!isEmpty()) {
+        error("Can only load into an empty map");
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    bool firstLine = true;
+    long long fields[4];
+
+    // Demographics => (id, line) pairs, and the data in the order it was read
+    std::vector<std::pair<int, int>> order;
+    std::vector<int> fileDem;
+    std::vector<int> fileRep;
+    std::vector<int> filePop;
+
+    while (nextDataLine(demographics, line, lineNumber)) {      // O(n)
+        bool header = firstLine;
+        firstLine = false;
+
+        if (!parseFields(line, fields, 4)) {
+            // The first line can be a header
+            if (header) {
+                continue;
+            }
+            error("Malformed demographics on line " + integerToString(lineNumber) + ": " + line);
+        }
+        if (fields[1] < 0 || fields[2] < 0 || fields[3] < 0) {
+            error("Negative demographics on line " + integerToString(lineNumber) + ": " + line);
+        }
+        if (fields[0] < INT_MIN || fields[0] > INT_MAX || fields[1] > INT_MAX || fields[2] > INT_MAX || fields[3] > INT_MAX) {
+            error("Demographics out of range on line " + integerToString(lineNumber) + ": " + line);
+        }
+
+        order.push_back({int(fields[0]), int(order.size())});
+        fileDem.push_back(int(fields[1]));
+        fileRep.push_back(int(fields[2]));
+        filePop.push_back(int(fields[3]));
+    }
+
+    // Dense indices are ordered by id
+    std::sort(order.begin(), order.end());      // O(n log n)
+    const int n = order.size();
+
+    ids.resize(n);
+    dem.resize(n);
+    rep.resize(n);
+    pop.resize(n);
+    long long combined = 0;
+    for (int index = 0; index < n; index++) {
+        if (index > 0 && order[index].first == order[index - 1].first) {
+            error("Repeated id in demographics: " + integerToString(order[index].first));
+        }
+
+        int row = order[index].second;
+        ids[index] = order[index].first;
+        dem[index] = fileDem[row];
+        rep[index] = fileRep[row];
+        pop[index] = filePop[row];
+        combined += pop[index];
+    }
+    if (combined > INT_MAX) {
+        error("The total population of the demographics doesn't fit in an int: " + std::to_string(combined));
+    }
+
+    // Adjacency => (from, to) pairs of dense indices
+    std::vector<std::pair<int, int>> borders;
+    lineNumber = 0;
+    firstLine = true;
+
+    auto denseIndex = [&](long long id) {
+        auto it = std::lower_bound(ids.begin(), ids.end(), id);
+        if (it == ids.end() || *it != id) {
+            error("Unknown id on adjacency line " + integerToString(lineNumber) + ": " + line);
+        }
+        return int(it - ids.begin());
+    };
+
+    while (nextDataLine(adjacency, line, lineNumber)) {      // O(e log n)
+        bool header = firstLine;
+        firstLine = false;
+
+        if (!parseFields(line, fields, 2)) {
+            if (header) {
+                continue;
+            }
+            error("Malformed adjacency on line " + integerToString(lineNumber) + ": " + line);
+        }
+        if (fields[0] < INT_MIN || fields[0] > INT_MAX || fields[1] < INT_MIN || fields[1] > INT_MAX) {
+            error("Id out of range on adjacency line " + integerToString(lineNumber) + ": " + line);
+        }
+        if (fields[0] == fields[1]) {
+            continue;
+        }
+        borders.push_back({denseIndex(fields[0]), denseIndex(fields[1])});
+    }
+
+    // Counts the borders of every Area, then fills each row in place
+    offsets.assign(n + 1, 0);
+    for (const std::pair<int, int>& border : borders) {
+        offsets[border.first + 1]++;
+    }
+    for (int index = 0; index < n; index++) {
+        offsets[index + 1] += offsets[index];
+    }
+
+    neighbors.resize(borders.size());
+    std::vector<int> filled(offsets.begin(), offsets.end() - 1);
+    for (const std::pair<int, int>& border : borders) {        // O(e)
+        neighbors[filled[border.first]++] = border.second;
+    }
+
+    // Sorts every row, and drops borders that were listed more than once
+    int kept = 0;
+    for (int index = 0; index < n; index++) {                   // O(e log e)
+        auto first = neighbors.begin() + offsets[index];
+        auto last = neighbors.begin() + offsets[index + 1];
+        std::sort(first, last);
+        last = std::unique(first, last);
+
+        offsets[index] = kept;
+        kept = std::copy(first, last, neighbors.begin() + kept) - neighbors.begin();
+    }
+    offsets[n] = kept;
+    neighbors.resize(kept);
+
+    // Every border has to be listed from both sides
+    for (int index = 0; index < n; index++) {                   // O(e log e)
+        for (int i = offsets[index]; i < offsets[index + 1]; i++) {
+            int next = neighbors[i];
+            auto first = neighbors.begin() + offsets[next];
+            auto last = neighbors.begin() + offsets[next + 1];
+            if (!std::binary_search(first, last, index)) {
+                error("Border is only listed one way: " + integerToString(ids[index]) + "," + integerToString(ids[next]));
+            }
+        }
+    }
+
+    useOwnedLayout();
+    frozen = true;
+    numAreas = n;
+    totalPopulation = int(combined);
+    loaded = true;
+}
+
+/*
+ * Creates an Area for every precinct of a bulk loaded map, from its compact layout
+ */
+void VotingMap::unload() {
+    loaded = false;
+
+    pool.reserve(numAreas);
+    for (int index = 0; index < numAreas; index++) {
+        Set<int> adj;
+        for (int next : neighborsOf(index)) {
+            adj.add(idAt(next));
+        }
+        graph.put(idAt(index), pool.size());
+        pool.emplace_back(idAt(index), demAt(index), repAt(index), popAt(index), std::move(adj));
+    }
+
+    // The layout is rebuilt from the Areas from now on
+    closeSnapshot();
+}
+
+/*
+ * The header at the start of a snapshot (the arrays follow it)
+ */
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    // SNAPSHOT_BYTE_ORDER as written by the machine that saved the snapshot
+    uint32_t byteOrder;
+    uint32_t size;
+    uint32_t unused;
+    uint64_t borders;
+    int64_t totalPopulation;
+};
+
+static const char SNAPSHOT_MAGIC[8] = {'G', 'M', 'A', 'P', 'S', 'N', 'A', 'P'};
+static const uint32_t SNAPSHOT_VERSION = 1;
+static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+/*
+ * Returns the number of bytes an array of count integers takes up in a snapshot
+ * (rounded up, so that the next array starts on an 8 byte boundary)
+ */
+static size_t snapshotBytes(size_t count) {
+    return (count * sizeof(int) + 7) / 8 * 8;
+}
+
+/*
+ * Writes the header, then each array of the layout (padded with zeros)
+ */
+void VotingMap::saveSnapshot(const std::string& path) const {
+    freeze();
+
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        error("Can't open snapshot file for writing: " + path);
+    }
+
+    const int borders = layout.offsets[numAreas];
+    SnapshotHeader header;
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.size = numAreas;
+    header.unused = 0;
+    header.borders = borders;
+    header.totalPopulation = totalPopulation;
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    const int* arrays[] = {layout.ids, layout.dem, layout.rep, layout.pop, layout.offsets, layout.neighbors};
+    const size_t counts[] = {size_t(numAreas), size_t(numAreas), size_t(numAreas), size_t(numAreas), size_t(numAreas) + 1, size_t(borders)};
+    const char padding[8] = {};
+
+    for (int i = 0; i < 6; i++) {
+        size_t bytes = counts[i] * sizeof(int);
+        output.write(reinterpret_cast<const char*>(arrays[i]), bytes);
+        output.write(padding, snapshotBytes(counts[i]) - bytes);
+    }
+
+    if (!output) {
+        error("Failed to write snapshot file: " + path);
+    }
+}
+
+/*
+ * Maps the whole file, checks the header against the size of the file, and points
+ * the layout at the arrays inside it. Every array is read once, to check that the
+ * indices stay within the arrays, that the rows are sorted like freeze() sorts them,
+ * and that the demographics add up to the header.
+ */
+void VotingMap::openSnapshot(const std::string& path) {
+    if (!isEmpty()) {
+        error("Can only open a snapshot into an empty map");
+    }
+
+#ifdef VOTINGMAP_MMAP
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        error("Can't open snapshot file: " + path);
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size < off_t(sizeof(SnapshotHeader))) {
+        close(file);
+        error("Not a VotingMap snapshot: " + path);
+    }
+
+    void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if (mapped == MAP_FAILED) {
+        error("Can't map snapshot file: " + path);
+    }
+
+    snapshot = static_cast<const char*>(mapped);
+    snapshotSize = info.st_size;
+    snapshotMapped = true;
+#else
+    std::ifstream input(path, std::ios::binary | std::ios::ate);
+    if (!input) {
+        error("Can't open snapshot file: " + path);
+    }
+
+    snapshotSize = input.tellg();
+    snapshotCopy.resize((snapshotSize + 7) / 8);
+    input.seekg(0);
+    input.read(reinterpret_cast<char*>(snapshotCopy.data()), snapshotSize);
+    snapshot = reinterpret_cast<const char*>(snapshotCopy.data());
+    snapshotMapped = false;
+#endif
+
+    SnapshotHeader header;
+    if (snapshotSize < sizeof(header)) {
+        closeSnapshot();
+        error("Not a VotingMap snapshot: " + path);
+    }
+    std::memcpy(&header, snapshot, sizeof(header));
+
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        closeSnapshot();
+        error("Not a VotingMap snapshot: " + path);
+    }
+    if (header.byteOrder != SNAPSHOT_BYTE_ORDER) {
+        closeSnapshot();
+        error("Snapshot was written with a different byte order: " + path);
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        closeSnapshot();
+        error("Unsupported snapshot version " + integerToString(header.version) + ": " + path);
+    }
+
+    const size_t n = header.size;
+    const size_t expected = sizeof(header) + 4 * snapshotBytes(n) + snapshotBytes(n + 1) + snapshotBytes(header.borders);
+    if (snapshotSize != expected) {
+        closeSnapshot();
+        error("Snapshot is truncated or corrupt: " + path);
+    }
+
+    // The arrays follow the header back to back
+    const char* cur = snapshot + sizeof(header);
+    const int** arrays[] = {&layout.ids, &layout.dem, &layout.rep, &layout.pop, &layout.offsets, &layout.neighbors};
+    const size_t counts[] = {n, n, n, n, n + 1, size_t(header.borders)};
+    for (int i = 0; i < 6; i++) {
+        *arrays[i] = reinterpret_cast<const int*>(cur);
+        cur += snapshotBytes(counts[i]);
+    }
+
+    /* Every index and offset is checked once here, so that the readers never leave the arrays (and
+     * every row is strictly increasing, which "isAdjacdent(int, int)" searches it by)
+     */
+    bool consistent = layout.offsets[0] == 0 && size_t(layout.offsets[n]) == header.borders;
+    long long combined = 0;
+    for (size_t index = 0; index < n && consistent; index++) {       // O(V + E)
+        consistent = layout.offsets[index] <= layout.offsets[index + 1]
+                     && (index == 0 || layout.ids[index - 1] < layout.ids[index])
+                     && layout.dem[index] >= 0 && layout.rep[index] >= 0 && layout.pop[index] >= 0;
+        combined += layout.pop[index];
+    }
+    for (size_t index = 0; index < n && consistent; index++) {
+        for (int slot = layout.offsets[index]; slot < layout.offsets[index + 1] && consistent; slot++) {
+            consistent = layout.neighbors[slot] >= 0 && size_t(layout.neighbors[slot]) < n
+                         && (slot == layout.offsets[index] || layout.neighbors[slot - 1] < layout.neighbors[slot]);
+        }
+    }
+    if (!consistent || combined != header.totalPopulation || combined > INT_MAX) {
+        closeSnapshot();
+        error("Snapshot is truncated or corrupt: " + path);
+    }
+
+    numAreas = n;
+    totalPopulation = header.totalPopulation;
+    loaded = true;
+    frozen = true;
+}
+
+/*
+ * Points the layout at the vectors that freeze() and loadFromStreams() build
+ */
+void VotingMap::useOwnedLayout() const {
+    layout = Layout{ids.data(), dem.data(), rep.data(), pop.data(), offsets.data(), neighbors.data()};
+}
+
+/*
+ * Releases the snapshot (the layout no longer points anywhere)
+ */
+void VotingMap::closeSnapshot() {
+    if (!snapshot) {
+        return;
+    }
+
+#ifdef VOTINGMAP_MMAP
+    if (snapshotMapped) {
+        munmap(const_cast<char*>(snapshot), snapshotSize);
+    }
+#endif
+    snapshotCopy.clear();
+    snapshotCopy.shrink_to_fit();
+    snapshot = nullptr;
+    snapshotSize = 0;
+    snapshotMapped = false;
+    layout = Layout{nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+}
+
 /*
  * Returns a given area by its ID number, if no such number exists,
  * it throws an error.
  */
-Area* VotingMap::getArea(int id) const {
+const Area& VotingMap::getArea(int id) const {
     if (!graph.containsKey(id)) {
         error("No area for given id: " + integerToString(id));
     }
 
-    return graph[id];
+    return pool[graph[id]];
+}
+
+/*
+ * Folds every array of the compact layout into the hash, one value at a time
+ */
+uint64_t mapFingerprint(const VotingMap& map) {
+    map.freeze();
+
+    uint64_t hash = streamSeed(0, map.size());
+    for (int index = 0; index < map.size(); index++) {
+        hash = streamSeed(hash, uint32_t(map.idAt(index)));
+        hash = streamSeed(hash, uint32_t(map.demAt(index)));
+        hash = streamSeed(hash, uint32_t(map.repAt(index)));
+        hash = streamSeed(hash, uint32_t(map.popAt(index)));
+        for (int neighbor : map.neighborsOf(index)) {
+            hash = streamSeed(hash, uint32_t(neighbor));
+        }
+    }
+    return hash;
 }
 
 
@@ -208,3 +812,301 @@ PROVIDED_TEST("Testing default map contructor (i.e. the 10x5 one in all the info
     EXPECT_EQUAL(map.isAdjacdent(12, 7), true);
 };
 
+
+STUDENT_TEST("The map owns the Areas added to it") {
+    // Every Area allocated here is deleted by addArea() (the test fails on a leak)
+    VotingMap map;
+    map.addArea(new Area(1, 10, 20, 30, {2}));
+    map.addArea(new Area(1, 99, 99, 99, {}));
+    map.addArea(Area(2, Demographic(4, 5, 9), {1}));
+
+    // The duplicate id was dropped, and the Demographic constructor fills in every field
+    EXPECT_EQUAL(map.size(), 2);
+    EXPECT_EQUAL(map.getDemographic(1).pop, 30);
+    EXPECT_EQUAL(map.getDemographic(2).dem, 4);
+    EXPECT_EQUAL(map.getDemographic(2).rep, 5);
+    EXPECT_EQUAL(map.totalPop(), 39);
+    EXPECT(map.isAdjacdent(2, 1));
+
+    Area area(3, Demographic(1, 2, 3), {1, 2});
+    EXPECT_EQUAL(area.id, 3);
+    EXPECT_EQUAL(area.pop, 3);
+    EXPECT_EQUAL(area.adjAreas, {1, 2});
+}
+
+STUDENT_TEST("Testing the compact layout of the default map") {
+    Set<Area*> areas = defaultMap();
+
+    VotingMap map;
+    for (Area* loc : areas) {
+        map.addArea(loc);
+    }
+    map.freeze();
+
+    // Indices are ordered by id, so the default map is the identity mapping
+    EXPECT_EQUAL(map.indexOf(12), 12);
+    EXPECT_EQUAL(map.idAt(12), 12);
+    EXPECT_EQUAL(map.popAt(12), 1);
+    EXPECT_EQUAL(map.demAt(5), 1);
+    EXPECT_EQUAL(map.repAt(2), 1);
+
+    // Corners have 2 neighbors, edges 3, and the interior 4
+    EXPECT_EQUAL(map.degreeAt(0), 2);
+    EXPECT_EQUAL(map.degreeAt(1), 3);
+    EXPECT_EQUAL(map.degreeAt(12), 4);
+
+    Vector<int> adj;
+    for (int next : map.neighborsOf(12)) {
+        adj.add(next);
+    }
+    EXPECT_EQUAL(adj, {7, 11, 13, 17});
+    EXPECT_EQUAL(map.neighborsOf(0).size(), 2);
+    EXPECT_EQUAL(map.neighborsOf(0)[1], 5);
+
+    // Views reference the map's data rather than copying it
+    EXPECT_EQUAL(&map.demographicAt(12).pop, &map.getDemographicView(12).pop);
+    EXPECT_EQUAL(map.getDemographicView(5).dem, map.getDemographic(5).dem);
+    EXPECT_ERROR(map.indexOf(50));
+}
+
+STUDENT_TEST("Testing the compact layout with sparse ids") {
+    VotingMap map;
+    map.addArea(new Area(50003, 234, 1141, 2527, {50002, 50005}));
+    map.addArea(new Area(50002, 1011, 351, 2837, {50003, 99999}));
+    map.addArea(new Area(50005, 468, 611, 2168, {50003}));
+
+    // The id based readers work before the layout is built, and the dense ones only after
+    EXPECT(!map.isFrozen());
+    EXPECT_EQUAL(map.getDemographic(50005).pop, 2168);
+    EXPECT_EQUAL(map.getAdjacentPrecincts(50002), {50003});
+    EXPECT(!map.isAdjacdent(50002, 99999));
+    EXPECT_ERROR(map.indexOf(50002));
+    EXPECT(!map.isFrozen());
+
+    map.freeze();
+    EXPECT_EQUAL(map.indexOf(50002), 0);
+    EXPECT_EQUAL(map.indexOf(50005), 2);
+    EXPECT_EQUAL(map.idAt(1), 50003);
+    EXPECT_EQUAL(map.getDemographic(50003).rep, 1141);
+
+    // Adjacent ids that are not in the map are dropped
+    EXPECT_EQUAL(map.getAdjacentPrecincts(50002), {50003});
+    EXPECT(map.isAdjacdent(50003, 50005));
+    EXPECT(!map.isAdjacdent(50002, 99999));
+
+    // Adding after a build marks the layout as out of date
+    map.addArea(new Area(50001, 121, 162, 636, {50002}));
+    EXPECT(!map.isFrozen());
+    EXPECT_EQUAL(map.getDemographic(50001).dem, 121);
+    map.freeze();
+    EXPECT_EQUAL(map.indexOf(50002), 1);
+    EXPECT_EQUAL(map.totalPop(), 2527 + 2837 + 2168 + 636);
+}
+
+STUDENT_TEST("Freezing a shared map from several threads") {
+    Set<Area*> areas = defaultMap();
+    VotingMap map;
+    for (Area* loc : areas) {
+        map.addArea(loc);
+    }
+
+    // Every thread freezes the map before reading it, and the layout is built once
+    std::vector<int> degrees(4, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&map, &degrees, i]() {
+            map.freeze();
+            for (int index = 0; index < map.size(); index++) {
+                degrees[i] += map.degreeAt(index);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    // 10 rows of 4 borders, and 9 rows of 5 between them, counted from both sides
+    EXPECT(map.isFrozen());
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQUAL(degrees[i], 2 * (10 * 4 + 9 * 5));
+    }
+}
+
+STUDENT_TEST("Bulk loading a map from CSV") {
+    // The same 3 precincts as above (out of order, with a header and a comment)
+    std::istringstream demographics("id,dem,rep,pop\n"
+                                    "50005, 468, 611, 2168\n"
+                                    "# the middle precinct\n"
+                                    "50003,234,1141,2527\n"
+                                    "50002,1011,351,2837\n");
+    std::istringstream adjacency("id,neighbor\n"
+                                 "50002,50003\n50003,50002\n"
+                                 "50003,50005\n50005,50003\n"
+                                 "50005,50003\n");
+
+    VotingMap map;
+    map.loadFromStreams(demographics, adjacency);
+
+    EXPECT_EQUAL(map.size(), 3);
+    EXPECT_EQUAL(map.totalPop(), 2527 + 2837 + 2168);
+    EXPECT_EQUAL(map.indexOf(50002), 0);
+    EXPECT_EQUAL(map.idAt(1), 50003);
+    EXPECT_EQUAL(map.getDemographic(50005).rep, 611);
+    EXPECT_EQUAL(map.getAdjacentPrecincts(50003), {50002, 50005});
+    EXPECT_EQUAL(map.degreeAt(2), 1);
+    EXPECT(map.contains(50005));
+    EXPECT(!map.contains(50001));
+
+    // Areas can still be added afterwards
+    map.addArea(new Area(50001, 121, 162, 636, {50002}));
+    map.freeze();
+    EXPECT_EQUAL(map.indexOf(50002), 1);
+    EXPECT(map.isAdjacdent(50002, 50003));
+    EXPECT_EQUAL(map.precinctSet(), {50001, 50002, 50003, 50005});
+}
+
+STUDENT_TEST("Bulk loading rejects inconsistent files") {
+    std::istringstream oneWay("1,0,1,1\n2,1,0,1\n");
+    std::istringstream oneWayAdj("1,2\n");
+    VotingMap first;
+    EXPECT_ERROR(first.loadFromStreams(oneWay, oneWayAdj));
+
+    std::istringstream unknown("1,0,1,1\n2,1,0,1\n");
+    std::istringstream unknownAdj("1,3\n3,1\n");
+    VotingMap second;
+    EXPECT_ERROR(second.loadFromStreams(unknown, unknownAdj));
+
+    std::istringstream repeated("1,0,1,1\n1,1,0,1\n");
+    std::istringstream repeatedAdj("");
+    VotingMap third;
+    EXPECT_ERROR(third.loadFromStreams(repeated, repeatedAdj));
+
+    std::istringstream malformed("1,0,1,1\n2,1,0\n");
+    std::istringstream malformedAdj("");
+    VotingMap fourth;
+    EXPECT_ERROR(fourth.loadFromStreams(malformed, malformedAdj));
+
+    VotingMap missing;
+    EXPECT_ERROR(missing.loadFromFiles("no-such-demographics.csv", "no-such-adjacency.csv"));
+
+    // Fields that don't fit in an int (which used to wrap around), and populations that only overflow together
+    for (const std::string& text : {"4294967297,0,1,1\n", "1,0,1,2147483648\n", "1,99999999999999999999,1,1\n",
+                                    "1,0,1,2000000000\n2,0,1,2000000000\n"}) {
+        std::istringstream outOfRange(text);
+        std::istringstream outOfRangeAdj("");
+        VotingMap fifth;
+        EXPECT_ERROR(fifth.loadFromStreams(outOfRange, outOfRangeAdj));
+    }
+
+    std::istringstream farIds("1,0,1,1\n2,1,0,1\n");
+    std::istringstream farIdsAdj("1,4294967298\n4294967298,1\n");
+    VotingMap sixth;
+    EXPECT_ERROR(sixth.loadFromStreams(farIds, farIdsAdj));
+}
+
+/*
+ * A snapshot file in the temporary directory, with a random suffix so that test runs don't share it
+ */
+static std::string testSnapshotPath() {
+    const std::string name = "votingmap-test-" + integerToString(randomInteger(0, 999999)) + ".snapshot";
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+STUDENT_TEST("Saving and opening a snapshot of a map") {
+    Set<Area*> areas = defaultMap();
+
+    VotingMap map;
+    for (Area* loc : areas) {
+        map.addArea(loc);
+    }
+    const std::string path = testSnapshotPath();
+    map.saveSnapshot(path);
+
+    VotingMap opened;
+    opened.openSnapshot(path);
+    EXPECT_EQUAL(opened.size(), 50);
+    EXPECT_EQUAL(opened.totalPop(), 50);
+    EXPECT_EQUAL(opened.getDemographic(5).dem, 1);
+    EXPECT_EQUAL(opened.getAdjacentPrecincts(12), {7, 11, 13, 17});
+    EXPECT(opened.isAdjacdent(12, 7));
+    EXPECT(!opened.contains(50));
+    for (int index = 0; index < map.size(); index++) {
+        EXPECT_EQUAL(opened.degreeAt(index), map.degreeAt(index));
+    }
+
+    // Areas can still be added afterwards (which copies the layout out of the snapshot)
+    opened.addArea(new Area(50, 1, 0, 1, {45}));
+    EXPECT_EQUAL(opened.getAdjacentPrecincts(50), {45});
+    EXPECT_EQUAL(opened.getDemographic(49).rep, 1);
+    std::remove(path.c_str());
+
+    // Anything else is rejected
+    std::ofstream(path) << "id,dem,rep,pop\n1,0,1,1\n";
+    VotingMap text;
+    EXPECT_ERROR(text.openSnapshot(path));
+    std::remove(path.c_str());
+
+    VotingMap missing;
+    EXPECT_ERROR(missing.openSnapshot(path));
+    EXPECT_ERROR(map.openSnapshot(path));
+}
+
+/*
+ * Saves the default map, then overwrites a single integer of one of its arrays
+ */
+static void corruptSnapshot(const std::string& path, size_t offset, int value) {
+    Set<Area*> areas = defaultMap();
+    VotingMap map;
+    for (Area* loc : areas) {
+        map.addArea(loc);
+    }
+    map.saveSnapshot(path);
+
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(offset);
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+STUDENT_TEST("Opening a corrupt snapshot") {
+    const std::string path = testSnapshotPath();
+    const size_t ids = sizeof(SnapshotHeader);
+    const size_t offsets = ids + 4 * snapshotBytes(50);
+    const size_t neighbors = offsets + snapshotBytes(51);
+
+    // Offsets that go backwards
+    corruptSnapshot(path, offsets + 2 * sizeof(int), 1000);
+    VotingMap backwards;
+    EXPECT_ERROR(backwards.openSnapshot(path));
+    EXPECT_EQUAL(backwards.size(), 0);
+
+    // A neighbor outside of the map
+    corruptSnapshot(path, neighbors, 50);
+    VotingMap outside;
+    EXPECT_ERROR(outside.openSnapshot(path));
+
+    // Ids out of order
+    corruptSnapshot(path, ids, 7);
+    VotingMap unsorted;
+    EXPECT_ERROR(unsorted.openSnapshot(path));
+
+    // A row that lists the same neighbor twice (precinct 0 borders 1 and 5)
+    corruptSnapshot(path, neighbors + sizeof(int), 1);
+    VotingMap repeated;
+    EXPECT_ERROR(repeated.openSnapshot(path));
+
+    // Negative votes, and a population that doesn't add up to the header
+    corruptSnapshot(path, ids + snapshotBytes(50), -1);
+    VotingMap negative;
+    EXPECT_ERROR(negative.openSnapshot(path));
+
+    corruptSnapshot(path, ids + 3 * snapshotBytes(50), 100000);
+    VotingMap miscounted;
+    EXPECT_ERROR(miscounted.openSnapshot(path));
+
+    // And untouched, it opens
+    corruptSnapshot(path, ids, 0);
+    VotingMap fine;
+    fine.openSnapshot(path);
+    EXPECT_EQUAL(fine.getAdjacentPrecincts(0), {1, 5});
+    std::remove(path.c_str());
+}
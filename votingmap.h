@@ -12,6 +12,30 @@
  * The Area struct holds data for a given precinct => Demographic data,
  * identification number, and the Set of precincts that are adjacent/border
  * the given precinct
+ *
+ * The VotingMap owns its Areas: they are kept by value in one contiguous pool,
+ * and Areas passed in by pointer are moved into the pool and deleted straight
+ * away (so the caller must have allocated them with new, and can't use them
+ * afterwards).
+ *
+ * A built VotingMap can be saved as a binary snapshot, which is opened by
+ * mapping the file into memory (the arrays are used in place, so opening
+ * only has to check the adjacency once, and processes that open the same
+ * snapshot share its pages). The layout of a snapshot (version 1) is:
+ *
+ * header => magic "GMAPSNAP", version, byte order marker, size, number of borders, total population
+ * ids => index => id (sorted)
+ * dem, rep, pop => index => demographic data
+ * offsets => index => first neighbor (size + 1 entries)
+ * neighbors => the adjacent indices of every Area, back to back
+ *
+ * where every array is 32-bit integers, starting on an 8 byte boundary.
+ *
+ * Threads => a VotingMap can be read from any number of threads at once, as long
+ * as nothing is added while they read it, and freeze() was called after the last
+ * addArea() (the dense accessors assume it, and check it in debug builds). The
+ * readers never build the layout themselves: before it is built, the id based
+ * readers look the Areas up in the pool instead.
  */
 
 #pragma once
@@ -20,8 +44,19 @@
 #define VOTINGMAP_H
 
 
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "map.h"
 #include "set.h"
+#include "testing/MemoryDiagnostics.h"
 
 struct Demographic {
     // Votes for the Democratic Party
@@ -52,21 +87,62 @@ struct Area
     // A collection of all the Areas that physically border this Area
     Set<int> adjAreas;
 
-    // Constructor that initializes every variable to the User's specification
-    Area(int idNum, int democrat, int republican, int population, Set<int> adjacentAreas) {
-        id = idNum;
-        dem = democrat;
-        rep = republican;
-        pop = population;
-        adjAreas = adjacentAreas;
-    };
+    // Constructor that initializes every variable to the User's specification (the adjacency is moved in)
+    Area(int idNum, int democrat, int republican, int population, Set<int> adjacentAreas)
+        : id(idNum), dem(democrat), rep(republican), pop(population), adjAreas(std::move(adjacentAreas)) {}
 
     /* Constructor that initializes every variable to the User's specification,
      * using a Demographic struct
      */
-    Area(int idNum, Demographic demo, Set<int> adjacentAreas) {
-        Area(idNum, demo.dem, demo.rep, demo.pop, adjacentAreas);
-    };
+    Area(int idNum, Demographic demo, Set<int> adjacentAreas)
+        : Area(idNum, demo.dem, demo.rep, demo.pop, std::move(adjacentAreas)) {}
+
+    // Areas allocated with new are counted, so that the tests report any that leak
+    TRACK_ALLOCATIONS_OF(Area);
+};
+
+/* A non-owning view of the dense indices adjacent to an Area.
+ *
+ * It points directly into the VotingMap's adjacency buffer, so it is free to
+ * create and iterate over (no copies), but it is only valid while the map is
+ * not modified.
+ */
+struct NeighborView {
+    // The first and one-past-the-last neighbor in the buffer
+    const int* first;
+    const int* last;
+
+    const int* begin() const {
+        return first;
+    }
+
+    const int* end() const {
+        return last;
+    }
+
+    int size() const {
+        return last - first;
+    }
+
+    bool isEmpty() const {
+        return first == last;
+    }
+
+    int operator[](int index) const {
+        return first[index];
+    }
+};
+
+/* A non-owning view of the demographic data of an Area, which references the
+ * VotingMap's arrays instead of copying them into a Demographic struct.
+ */
+struct DemographicView {
+    // Votes for the Democratic Party
+    const int& dem;
+    // Votes for the Republican Party
+    const int& rep;
+    // Total population in the Area
+    const int& pop;
 };
 
 class VotingMap
@@ -75,12 +151,40 @@ public:
     // Default constructor that implicitly initializes member variables with their default values
     VotingMap();
 
-    // Destructor that deletes all the used memory on the heap
+    // Destructor that releases the snapshot (the Areas are freed with the pool)
     ~VotingMap();
 
-    // Adds an area to the Graph
+    // A map owns its pool and snapshot, so it can't be copied
+    VotingMap(const VotingMap&) = delete;
+    VotingMap& operator=(const VotingMap&) = delete;
+
+    // Adds an area to the Graph (moving it into the pool), unless its id is already on the map
+    void addArea(Area loc);
+    // Moves an area allocated with new into the pool, and deletes it (even if its id is already on the map)
     void addArea(Area* loc);
 
+    /* Bulk loading, for maps too large to build one Area at a time
+     *
+     * The demographics are lines of "id,dem,rep,pop", and the adjacency is lines of
+     * "id,neighbor" (every border listed in both directions). Blank lines, lines
+     * starting with '#', and a header line are skipped.
+     *
+     * The compact layout is built directly (already frozen), without creating any Areas.
+     * The map has to be empty, and any malformed line, repeated id, unknown id, or
+     * one-sided border throws an error.
+     */
+    void loadFromFiles(const std::string& demographicsPath, const std::string& adjacencyPath);
+    void loadFromStreams(std::istream& demographics, std::istream& adjacency);
+
+    // Writes the compact layout of the map to a binary snapshot
+    void saveSnapshot(const std::string& path) const;
+    /* Opens a snapshot written by saveSnapshot() into an empty map (it is memory mapped where that
+     * is supported, and read into memory otherwise). Throws an error if the file isn't a snapshot of
+     * this version, was written with a different byte order, or is truncated or corrupt (the offsets,
+     * neighbors and ids are checked in a single O(V + E) pass, which is all that is read up front).
+     */
+    void openSnapshot(const std::string& path);
+
     // Returns how many elements are in the graph
     int size() const;
     // Returns if there are no elements in the graph
@@ -94,28 +198,153 @@ public:
 
     // Returns a Demographic struct of a given Area with an id of the input
     Demographic getDemographic(int id) const;
+    // Returns a view of the demographics of a given Area with an id of the input (no copy)
+    DemographicView getDemographicView(int id) const;
     // Returns the adjacent Precincts/Areas of given Area with an id of the input
     Set<int> getAdjacentPrecincts(int id) const;
     // Returns whether 2 Areas border each other
     bool isAdjacdent(int id, int adj) const;
     // Returns whether the given element exists in the graph
     bool contains(int id) const;
+
+    /* Dense (compact) layout
+     *
+     * Every Area is given an index from 0 to size() - 1 (ordered by id), and the
+     * data is stored as flat arrays indexed by that number, with the adjacency in
+     * compressed-sparse-row form. The layout is built by freeze(), which has to be
+     * called after the last addArea() before any of the dense accessors (bulk
+     * loaded and opened maps are already frozen).
+     */
+
+    // Builds the compact layout (if it is out of date), safe to call from several threads at once
+    void freeze() const;
+    // Returns whether the compact layout is up to date
+    bool isFrozen() const;
+    // Returns the dense index of the Area with the given id (throws an error if the map isn't frozen)
+    int indexOf(int id) const;
+    // Returns the id of the Area at the given dense index
+    int idAt(int index) const;
+    // Returns the Democratic votes of the Area at the given dense index
+    int demAt(int index) const;
+    // Returns the Republican votes of the Area at the given dense index
+    int repAt(int index) const;
+    // Returns the population of the Area at the given dense index
+    int popAt(int index) const;
+    // Returns a view of the demographics of the Area at the given dense index
+    DemographicView demographicAt(int index) const;
+    // Returns how many Areas border the Area at the given dense index
+    int degreeAt(int index) const;
+    // Returns a view of the dense indices bordering the Area at the given dense index
+    NeighborView neighborsOf(int index) const;
 private:
     /* A adjanency Graph containing Area structs
      *
      * The only caveat is that it doesnt immediately relate the element to elements that are adjacent;
      * instead, it relates an id to an Area that contains information of what Areas are adjacent
      *
-     * id => Area* => Set<id> AdjacentElements
+     * id => slot in the pool => Area => Set<id> AdjacentElements
      */
-    Map<int, Area*> graph;
+    Map<int, int> graph;
+    // Every Area added, by value, in the order they were added
+    std::vector<Area> pool;
     // Totoal number of elements in the graph
     int numAreas;
     // The combined population of all the element in the graph
     int totalPopulation;
+    // Whether the map was bulk loaded (or opened), in which case the compact layout is the only copy (graph is empty)
+    bool loaded;
+
+    /* The compact layout, rebuilt by freeze() whenever an Area was added since the
+     * last build (hence mutable, so that a map shared as const can be frozen)
+     */
+    mutable std::atomic<bool> frozen;
+    // Held while the layout is built, so that threads freezing the same map build it once
+    mutable std::mutex freezeLock;
+    // The arrays that are read, which point into either the vectors below or a snapshot
+    struct Layout {
+        const int* ids;
+        const int* dem;
+        const int* rep;
+        const int* pop;
+        const int* offsets;
+        const int* neighbors;
+    };
+    mutable Layout layout;
+    // index => id (sorted, so that indexOf() can binary search it)
+    mutable std::vector<int> ids;
+    // index => demographic data
+    mutable std::vector<int> dem;
+    mutable std::vector<int> rep;
+    mutable std::vector<int> pop;
+    // index => [offsets[index], offsets[index + 1]) range in neighbors
+    mutable std::vector<int> offsets;
+    // Adjacent indices of every Area, stored back to back (sorted within each Area)
+    mutable std::vector<int> neighbors;
+
+    // The snapshot the layout points into (nullptr if there is none)
+    const char* snapshot;
+    size_t snapshotSize;
+    // Whether the snapshot is memory mapped, or was read into snapshotCopy
+    bool snapshotMapped;
+    std::vector<uint64_t> snapshotCopy;
 
     // Returns a given Area from the graph
-    Area* getArea(int id) const;
+    const Area& getArea(int id) const;
+    // Recreates the Areas of a bulk loaded map, so that more can be added to it
+    void unload();
+    // Points the layout at the vectors (after they were built)
+    void useOwnedLayout() const;
+    // Unmaps (or frees) the snapshot
+    void closeSnapshot();
 };
 
+/* Returns a hash of the layout and demographics of the map, which every reader of a file
+ * written from it (a plan stream, or a shard of a cluster) must agree on, O(V + E)
+ */
+uint64_t mapFingerprint(const VotingMap& map);
+
+/* The dense accessors sit in the inner loops of every generator, so they are
+ * defined here (inline), and assume freeze() has already been called (which
+ * is only checked in debug builds).
+ */
+inline bool VotingMap::isFrozen() const {
+    return frozen.load(std::memory_order_acquire);
+}
+
+inline int VotingMap::idAt(int index) const {
+    assert(isFrozen());
+    return layout.ids[index];
+}
+
+inline int VotingMap::demAt(int index) const {
+    assert(isFrozen());
+    return layout.dem[index];
+}
+
+inline int VotingMap::repAt(int index) const {
+    assert(isFrozen());
+    return layout.rep[index];
+}
+
+inline int VotingMap::popAt(int index) const {
+    assert(isFrozen());
+    return layout.pop[index];
+}
+
+inline DemographicView VotingMap::demographicAt(int index) const {
+    assert(isFrozen());
+    return DemographicView{layout.dem[index], layout.rep[index], layout.pop[index]};
+}
+
+inline int VotingMap::degreeAt(int index) const {
+    assert(isFrozen());
+    return layout.offsets[index + 1] - layout.offsets[index];
+}
+
+inline NeighborView VotingMap::neighborsOf(int index) const {
+    assert(isFrozen());
+    const int* base = layout.neighbors;
+    return NeighborView{base + layout.offsets[index], base + layout.offsets[index + 1]};
+}
+
 #endif // VOTINGMAP_H